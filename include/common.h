@@ -3,14 +3,22 @@
 
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "config.h"
+#include "futex_lock.h"
+#include "shm_ring.h"
+#include "mailbox.h"
+#include "stats.h"
+#include "seqlock.h"
+#include "occupancy.h"
+#include "fairq.h"
+#include "seatmap.h"
+#include "fleet.h"
 
 enum SemaphoreIndex {
     SEM_SHM_MUTEX = 0,
     SEM_LOG_MUTEX,
     SEM_STATION_ENTRY,
-    SEM_ENTRANCE_PASSENGER,
-    SEM_ENTRANCE_BIKE,
     SEM_BOARDING_MUTEX,
     SEM_BUS_READY,
     SEM_TICKET_OFFICE_BASE
@@ -18,19 +26,64 @@ enum SemaphoreIndex {
 #define SEM_TICKET_OFFICE(id) (SEM_TICKET_OFFICE_BASE + (id))
 #define SEM_TICKET_QUEUE_SLOTS   (SEM_TICKET_OFFICE_BASE + TICKET_OFFICES)
 #define SEM_BOARDING_QUEUE_SLOTS (SEM_TICKET_QUEUE_SLOTS + 1)
-#define SEM_COUNT (SEM_BOARDING_QUEUE_SLOTS + 1)
+/* Two entrances per bus, so buses at different bays board independently */
+#define SEM_ENTRANCE_BASE        (SEM_BOARDING_QUEUE_SLOTS + 1)
+#define SEM_ENTRANCE_PASSENGER(id) (SEM_ENTRANCE_BASE + 2 * (id))
+#define SEM_ENTRANCE_BIKE(id)    (SEM_ENTRANCE_BASE + 2 * (id) + 1)
+#define SEM_BUS_MUTEX_BASE       (SEM_ENTRANCE_BASE + 2 * MAX_BUSES)
+#define SEM_BUS_MUTEX(id)        (SEM_BUS_MUTEX_BASE + (id))
+#define SEM_OFFICE_MUTEX_BASE    (SEM_BUS_MUTEX_BASE + MAX_BUSES)
+#define SEM_OFFICE_MUTEX(id)     (SEM_OFFICE_MUTEX_BASE + (id))
+#define SEM_COUNT (SEM_OFFICE_MUTEX_BASE + TICKET_OFFICES)
 
+/*
+ * Lock hierarchy for shm_data_t - acquire top to bottom, release in reverse:
+ *   1. SEM_SHM_MUTEX        station: flags, passengers_transported,
+ *                           bay_bus, process PIDs
+ *   2. SEM_BUS_MUTEX(i)     buses[i]; several buses in ascending i
+ *   3. SEM_OFFICE_MUTEX(i)  offices[i]; several offices in ascending i
+ * Passenger flow counters (stats) and office ticket counters are atomics
+ * and need no lock. Drivers take only their own bus lock per request;
+ * whole-state readers use shm_read_status() (seqlock, no lock taken) or
+ * shm_lock_all() when they must also block writers (final stats).
+ * SEM_TICKET_OFFICE(i) and SEM_ENTRANCE_* are service gates, not state locks:
+ * they may be held while taking a state lock, never the other way round.
+ */
+
+/* Lock-free read of one aligned station word on a request hot path (writers
+ * still hold the owning lock); the value may be one update stale. */
+#define SHM_READ(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+
+/* Ticket requests are queued by passenger class (CLASS_*), so an office
+ * can serve the classes by weight (SysV queue) */
 enum TicketMsgType {
     MSG_TICKET_REQUEST = 1,
-    MSG_TICKET_GRANTED = 2
+    MSG_TICKET_GRANTED = 2,
+    MSG_TICKET_REQUEST_SENIOR = 3,
+    MSG_TICKET_REQUEST_BIKE = 4,
+    MSG_TICKET_REQUEST_FAMILY = 5,
+    MSG_TICKET_REQUEST_VIP = 6
 };
 
+/* Boarding requests are queued by class, so a driver only takes the
+ * classes its bus still has room for and serves them by weight (SysV
+ * queue). The types rise with the room a request needs - one seat, two,
+ * one seat and a rack, two and a rack - so a msgrcv() range takes what
+ * fits (see boarding_classes() in ipc.c); a VIP with a bike or a child
+ * queues with that class (boarding_class). With --assign every
+ * request is booked on a bus and queued for it alone, under
+ * MSG_BOARD_REQUEST_BOOKED + bus id; the class types are then unused. */
 enum BoardingMsgType {
-    MSG_BOARD_REQUEST_VIP = 1,
-    MSG_BOARD_REQUEST = 2,
-    MSG_BOARD_GRANTED = 3,
+    MSG_BOARD_REQUEST_VIP = 1,      /* VIP walk-on */
+    MSG_BOARD_REQUEST = 2,          /* Walk-on: one seat, no bike */
+    MSG_BOARD_GRANTED = 3,          /* Replies only, never queued as requests */
     MSG_BOARD_DENIED = 4,
-    MSG_BOARD_WAIT = 5
+    MSG_BOARD_WAIT = 5,
+    MSG_BOARD_REQUEST_SENIOR = 6,   /* Walk-on, SENIOR_AGE or older */
+    MSG_BOARD_REQUEST_FAMILY = 7,   /* Adult with a child: two seats */
+    MSG_BOARD_REQUEST_BIKE = 8,     /* One seat and a bike place */
+    MSG_BOARD_REQUEST_BIKE_FAMILY = 9, /* Bike class needing two seats */
+    MSG_BOARD_REQUEST_BOOKED = 10   /* + bus id: seat booked on that bus */
 };
 
 enum DispatchMsgType {
@@ -40,18 +93,152 @@ enum DispatchMsgType {
     MSG_DISPATCH_SHUTDOWN = 99
 };
 
+/* Passenger as carried on the wire: 8 bytes instead of passenger_info_t */
+#define PASSENGER_BIKE        0x01
+#define PASSENGER_VIP         0x02
+#define PASSENGER_TICKET      0x04
+#define PASSENGER_CHILD_WITH  0x08
+#define PASSENGER_BOOKED      0x10  /* Seat booked on the bus asked (--assign) */
+
+typedef struct {
+    pid_t pid;
+    uint8_t age;
+    uint8_t child_age;
+    uint8_t seat_count;
+    uint8_t flags;         /* PASSENGER_* */
+} wire_passenger_t;
+
+/* Why a boarding request was turned down; rendered to text only for logs */
+typedef enum {
+    DENY_NONE = 0,
+    DENY_NO_TICKET,
+    DENY_BOARDING_BLOCKED,
+    DENY_NOT_AT_STATION,
+    DENY_BOARDING_CLOSED,
+    DENY_NO_SEATS,         /* deny_arg = { seats needed, seats free } */
+    DENY_BIKE_CAPACITY,    /* deny_arg = { bikes on board, bike places of the bus } */
+    DENY_NOT_ACTIVE        /* Request reached a bus that is not boarding right now */
+} deny_code_t;
+
+typedef struct {
+    long mtype;
+    wire_passenger_t passenger;
+    uint32_t request_id;   /* Per-sender sequence; doubles as the mailbox token */
+    int16_t reply_slot;    /* Requester's mailbox, -1 = reply via response queue */
+    uint8_t ticket_office_id;
+    uint8_t approved;
+    int8_t bus_id;         /* Reply: bus the seat is booked on (--assign), -1 none */
+} ticket_msg_t;
+
 typedef struct {
+    long mtype;
+    wire_passenger_t passenger;
+    uint32_t request_id;   /* Per-sender sequence; doubles as the mailbox token */
+    int16_t reply_slot;    /* Requester's mailbox, -1 = reply via response queue */
+    uint8_t bus_id;
+    uint8_t approved;
+    uint8_t deny;          /* deny_code_t */
+    uint8_t attempts;      /* Boarding tries already made, for aging (saturates) */
+    uint16_t deny_arg[2];
+    uint8_t reply;         /* Responses: MSG_BOARD_GRANTED, _DENIED, or _WAIT (parked,
+                            * the final reply follows) */
+    uint8_t rack;          /* Granted: bike rack place (1-based), 0 none */
+    uint16_t seat[2];      /* Granted: seat numbers (1-based), 0 unused; an adult
+                            * with a child sits in seat[0], the child in seat[1] */
+} boarding_msg_t;
+
+/* Boarding requests no bus could seat, parked with a MSG_BOARD_WAIT reply
+ * until a bus opens boarding, oldest first; see driver.c. They keep their
+ * SEM_BOARDING_QUEUE_SLOTS slot, so with slots the list never overflows.
+ * Guarded by SEM_SHM_MUTEX. */
+#define PARKED_MAX MAX_BOARDING_QUEUE_REQUESTS
+
+typedef struct {
+    int count;
+    boarding_msg_t requests[PARKED_MAX];
+} park_list_t;
+
+/* Owner of a seat booking (--assign), so the watchdog can give back the
+ * seats of a passenger who is gone without boarding or cancelling. Every
+ * booking holds a seat, so the table never runs out. Claimed by CAS on
+ * pid; bus is -1 until occupancy_book() took the seats. */
+#define BOOKINGS_MAX (MAX_BUSES * MAX_BUS_CAPACITY)
+
+typedef struct {
+    _Atomic pid_t pid;         /* Passenger, 0 if the entry is free */
+    _Atomic int bus;
+    uint8_t seats;
+    uint8_t bike;
+} booking_t;
+
+/* Cache-line aligned per bus: drivers never false-share each other's state */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) futex_mutex_t lock;  /* Backs SEM_BUS_MUTEX(id) in futex lock mode */
+    _Atomic uint32_t seq;     /* Seqlock, bumped by every SEM_BUS_MUTEX(id) section */
     int id;
+    bus_model_t model;        /* Vehicle (--fleet); set by the creator, read-only after */
     bool at_station;
     bool boarding_open;
-    int passenger_count;
-    int bike_count;
-    int entering_count;
+    occupancy_t occupancy;    /* Seats, bikes, entering + closed bit; CAS only, no lock */
+    occupancy_t booked;       /* Seats and bikes booked but not yet boarded (--assign) */
     time_t departure_time;
     time_t return_time;
+    _Atomic int boarded_people;  /* Seats boarded onto this bus over the whole run */
+    _Atomic int boarded_vip_people;
+    _Atomic int departures;      /* Trips made, with the seats and bikes they took */
+    _Atomic int departed_seats;
+    _Atomic int departed_bikes;
 } bus_state_t;
 
+/* One cache line per ticket office */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) futex_mutex_t lock;  /* Backs SEM_OFFICE_MUTEX(id) in futex lock mode */
+    pid_t busy_pid;           /* Passenger being served, 0 when idle */
+    /* Written only by this office, without a lock: the slot is their shard */
+    _Atomic int tickets_issued;
+    _Atomic int tickets_sold_people;
+    _Atomic int tickets_denied;
+} office_state_t;
+
+/* Process roles whose memory behaviour is reported separately */
+typedef enum {
+    MEM_ROLE_DISPATCHER = 0,
+    MEM_ROLE_OFFICE,
+    MEM_ROLE_DRIVER,
+    MEM_ROLE_PASSENGER,
+    MEM_ROLE_COUNT
+} mem_role_t;
+
+/* Page faults and dTLB load misses taken between attach and detach, summed
+ * over every process of a role (see ipc_mem_init) */
 typedef struct {
+    _Atomic long minor_faults;
+    _Atomic long major_faults;
+    _Atomic long dtlb_misses;
+    _Atomic int processes;
+    _Atomic int tlb_processes;  /* Processes whose dTLB counter could be read */
+} mem_role_stats_t;
+
+typedef struct {
+    int lock_mode;             /* ipc_lock_mode_t chosen by the creator (dispatcher) */
+    futex_mutex_t shm_mutex;   /* Backs SEM_SHM_MUTEX (station lock) when lock_mode is IPC_LOCK_FUTEX */
+    _Atomic uint32_t station_seq; /* Seqlock, bumped by every SEM_SHM_MUTEX section */
+    _Atomic uint32_t bus_events;  /* Futex idle drivers sleep on, see shm_bus_notify() */
+    _Atomic uint32_t board_events; /* Futex passengers waiting for a bus sleep on, likewise */
+    /* Requests per class mtype on the SysV queues, counted before msgsnd()
+     * and after msgrcv(), so a zero means none: the class probes skip it */
+    _Atomic int ticket_queued[MSG_TICKET_REQUEST_VIP + 1];
+    _Atomic int board_queued[MSG_BOARD_REQUEST_BOOKED];
+    int transport;             /* ipc_transport_t chosen by the creator (dispatcher) */
+    bool assign_seats;         /* --assign: seats booked before boarding, see shm_book_seat() */
+    time_t start_time;         /* Simulation start, for throughput in final stats */
+    size_t segment_size;       /* Bytes reserved for this segment (page-size rounded) */
+    bool huge_pages;           /* Backed by SHM_HUGETLB pages */
+    bool pin_segment;          /* --hugepages: long-lived roles pre-fault and mlock() it */
+    _Atomic int pinned;        /* Processes holding it locked in RAM */
+    _Atomic int pin_refused;   /* Processes whose mlock() failed (RLIMIT_MEMLOCK) */
+    mem_role_stats_t mem[MEM_ROLE_COUNT];
+
     bool simulation_running;
     bool station_open;
     bool boarding_allowed;
@@ -60,29 +247,31 @@ typedef struct {
     bool station_closed;
     bool test_fill_queue;  /* When true, dispatcher won't end simulation (used by --test11) */
 
-    int total_passengers_created;
     int passengers_transported;
-    int passengers_waiting;
-    int passengers_in_office;
-    int passengers_left_early;
-
-    int adults_created;
-    int children_created;
-    int vip_people_created;
-    int tickets_sold_people;
-    int tickets_denied;
-    int boarded_people;
-    int boarded_vip_people;
 
-    bus_state_t buses[MAX_BUSES];
-    int active_bus_id;
-
-    int ticket_office_busy[TICKET_OFFICES];
-    int tickets_issued;
+    int bays;                  /* Boarding bays (--bays), fixed by the creator */
+    int bay_bus[MAX_BUSES];    /* Bus boarding at bay b (or due back to it), -1 while free */
+    long no_bus_ms;            /* Time with no bus boarding at any bay, see shm_bays_changed() */
+    long no_bus_since_ms;      /* CLOCK_MONOTONIC ms the current stretch began, 0 if none */
 
     pid_t dispatcher_pid;
     pid_t driver_pids[MAX_BUSES];
     pid_t ticket_office_pids[TICKET_OFFICES];
+
+    park_list_t parked;        /* Requests waiting for a bus with room */
+
+    stat_counters_t stats;                /* Lock-free passenger flow counters (STAT_*) */
+    wait_hist_t ticket_wait[CLASS_COUNT]; /* Request to reply at a ticket office, per class */
+    wait_hist_t board_wait[CLASS_COUNT];  /* First boarding try to boarded, per class */
+
+    bus_state_t buses[MAX_BUSES];         /* Each guarded by SEM_BUS_MUTEX(i) */
+    booking_t bookings[BOOKINGS_MAX];     /* Seat ledger owners, see shm_book_seat() */
+    seat_map_t seat_maps[MAX_BUSES];      /* Seats taken on bus i, written by its driver only */
+    seat_map_t rack_maps[MAX_BUSES];      /* ...and places on its bike rack */
+    office_state_t offices[TICKET_OFFICES]; /* Each guarded by SEM_OFFICE_MUTEX(i) */
+
+    shm_ring_t ticket_ring;    /* Ticket requests when transport is IPC_TRANSPORT_RING */
+    mailbox_t reply_mailboxes[REPLY_MAILBOXES];  /* Per-passenger ticket/boarding replies */
 } shm_data_t;
 
 typedef struct {
@@ -95,23 +284,79 @@ typedef struct {
     bool has_child_with;
     int child_age;
     int seat_count;
-    int assigned_bus;
+    int assigned_bus;      /* Bus boarded, or with --assign the one booked on */
+    bool booked;           /* Holds a booking on assigned_bus, not boarded yet */
 } passenger_info_t;
 
-typedef struct {
-    long mtype;
-    passenger_info_t passenger;
-    int ticket_office_id;
-    bool approved;
-} ticket_msg_t;
+static inline wire_passenger_t passenger_to_wire(const passenger_info_t *p) {
+    wire_passenger_t w;
+    w.pid = p->pid;
+    w.age = (uint8_t)p->age;
+    w.child_age = (uint8_t)p->child_age;
+    w.seat_count = (uint8_t)p->seat_count;
+    w.flags = (p->has_bike ? PASSENGER_BIKE : 0) |
+              (p->is_vip ? PASSENGER_VIP : 0) |
+              (p->has_ticket ? PASSENGER_TICKET : 0) |
+              (p->has_child_with ? PASSENGER_CHILD_WITH : 0) |
+              (p->booked ? PASSENGER_BOOKED : 0);
+    return w;
+}
 
-typedef struct {
-    long mtype;
-    passenger_info_t passenger;
-    int bus_id;
-    bool approved;
-    char reason[64];
-} boarding_msg_t;
+/* Scheduling class of a passenger: VIP, then a bike, then a child decide */
+static inline int passenger_class(const wire_passenger_t *p) {
+    if (p->flags & PASSENGER_VIP) {
+        return CLASS_VIP;
+    }
+    if (p->flags & PASSENGER_BIKE) {
+        return CLASS_BIKE;
+    }
+    if (p->seat_count > 1) {
+        return CLASS_FAMILY;
+    }
+    return p->age >= SENIOR_AGE ? CLASS_SENIOR : CLASS_REGULAR;
+}
+
+static inline long ticket_request_type(int cls) {
+    static const long types[CLASS_COUNT] = {
+        MSG_TICKET_REQUEST_VIP, MSG_TICKET_REQUEST, MSG_TICKET_REQUEST_SENIOR,
+        MSG_TICKET_REQUEST_BIKE, MSG_TICKET_REQUEST_FAMILY
+    };
+    return types[cls];
+}
+
+static inline long boarding_request_type(int cls) {
+    static const long types[CLASS_COUNT] = {
+        MSG_BOARD_REQUEST_VIP, MSG_BOARD_REQUEST, MSG_BOARD_REQUEST_SENIOR,
+        MSG_BOARD_REQUEST_BIKE, MSG_BOARD_REQUEST_FAMILY
+    };
+    return types[cls];
+}
+
+/* Class whose boarding queue carries a passenger's request: the room it
+ * needs decides first, so VIP stands only for walk-ons; a VIP with a bike
+ * or a child still goes first within the driver's batch */
+static inline int boarding_class(const wire_passenger_t *p) {
+    if (p->flags & PASSENGER_BIKE) {
+        return CLASS_BIKE;
+    }
+    if (p->seat_count > 1) {
+        return CLASS_FAMILY;
+    }
+    return passenger_class(p);
+}
+
+/* mtype of a boarding request: the booked bus' own, else the class' (a
+ * cyclist's by the seats it needs) */
+static inline long boarding_msg_type(const wire_passenger_t *p, int bus_id) {
+    if (p->flags & PASSENGER_BOOKED) {
+        return MSG_BOARD_REQUEST_BOOKED + bus_id;
+    }
+    int cls = boarding_class(p);
+    if (cls == CLASS_BIKE && p->seat_count > 1) {
+        return MSG_BOARD_REQUEST_BIKE_FAMILY;
+    }
+    return boarding_request_type(cls);
+}
 
 typedef struct {
     long mtype;
@@ -121,8 +366,73 @@ typedef struct {
 } dispatch_msg_t;
 
 #define IS_CHILD(age) ((age) < CHILD_AGE_LIMIT)
-#define BUS_HAS_PASSENGER_SPACE(bus) ((bus).passenger_count < BUS_CAPACITY)
-#define BUS_HAS_BIKE_SPACE(bus) ((bus).bike_count < BIKE_CAPACITY)
 #define BUS_ENTRANCE_CLEAR(bus) ((bus).entering_count == 0)
 
+/* Lock-free copy of station + bus state, see shm_read_status() */
+typedef struct {
+    bool at_station;
+    bool boarding_open;
+    int passenger_count;
+    int bike_count;
+    int entering_count;
+    time_t departure_time;
+} bus_status_t;
+
+typedef struct {
+    bool simulation_running;
+    bool station_open;
+    bool boarding_allowed;
+    bool early_departure_flag;
+    bool spawning_stopped;
+    bool station_closed;
+    bool test_fill_queue;
+    int passengers_transported;
+    int bays;
+    int bay_bus[MAX_BUSES];
+    bus_status_t buses[MAX_BUSES];  /* Each bus consistent on its own */
+} status_snapshot_t;
+
+/* Bay the bus is boarding at, -1 if none. No lock: bays change hands under
+ * SEM_SHM_MUTEX, and a stale answer is caught by the occupancy CAS or the
+ * next look */
+static inline int shm_bay_of(shm_data_t *shm, int bus_id) {
+    for (int b = 0; b < shm->bays; b++) {
+        if (SHM_READ(shm->bay_bus[b]) == bus_id) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/* Run totals kept per bus / per office; hold shm_lock_all() for a consistent bus sum */
+static inline int shm_tickets_issued(shm_data_t *shm) {
+    int total = 0;
+    for (int i = 0; i < TICKET_OFFICES; i++) total += atomic_load_explicit(&shm->offices[i].tickets_issued, memory_order_relaxed);
+    return total;
+}
+
+static inline int shm_tickets_sold_people(shm_data_t *shm) {
+    int total = 0;
+    for (int i = 0; i < TICKET_OFFICES; i++) total += atomic_load_explicit(&shm->offices[i].tickets_sold_people, memory_order_relaxed);
+    return total;
+}
+
+static inline int shm_tickets_denied(shm_data_t *shm) {
+    int total = 0;
+    for (int i = 0; i < TICKET_OFFICES; i++) total += atomic_load_explicit(&shm->offices[i].tickets_denied, memory_order_relaxed);
+    return total;
+}
+
+static inline int shm_boarded_people(shm_data_t *shm) {
+    int total = 0;
+    for (int i = 0; i < MAX_BUSES; i++) total += atomic_load_explicit(&shm->buses[i].boarded_people, memory_order_relaxed);
+    return total;
+}
+
+static inline int shm_boarded_vip_people(shm_data_t *shm) {
+    int total = 0;
+    for (int i = 0; i < MAX_BUSES; i++) total += atomic_load_explicit(&shm->buses[i].boarded_vip_people, memory_order_relaxed);
+    return total;
+}
+
 #endif
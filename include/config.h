@@ -2,12 +2,26 @@
 #define CONFIG_H
 
 #define MAX_BUSES           3
-#define BUS_CAPACITY        10
+#define BOARDING_BAYS       1     /* Buses boarding at once (default of --bays, at most MAX_BUSES) */
+#define BUS_CAPACITY        10    /* Standard bus; --fleet sets each bus' vehicle */
 #define BIKE_CAPACITY       3
 #define BOARDING_INTERVAL   8
 #define MIN_RETURN_TIME     3
 #define MAX_RETURN_TIME     8
 
+/* Other vehicles of --fleet (seats, bike places, round trip seconds) and
+ * the largest bus it accepts */
+#define MIDI_CAPACITY         6
+#define MIDI_BIKE_CAPACITY    1
+#define MIDI_MIN_RETURN_TIME  2
+#define MIDI_MAX_RETURN_TIME  6
+#define ARTIC_CAPACITY        18
+#define ARTIC_BIKE_CAPACITY   5
+#define ARTIC_MIN_RETURN_TIME 5
+#define ARTIC_MAX_RETURN_TIME 11
+#define MAX_BUS_CAPACITY      64
+#define MAX_BIKE_CAPACITY     8
+
 #define TICKET_OFFICES      2
 #define TICKET_PROCESS_TIME 1
 #define MAX_TICKET_QUEUE_REQUESTS   200
@@ -21,26 +35,56 @@
 #define BIKE_PERCENT        20
 #define ADULT_WITH_CHILD_PERCENT  15
 #define ADULT_MIN_AGE       18
+#define SENIOR_AGE          65    /* Own scheduling class from this age */
 #define MIN_ARRIVAL_MS      200
 #define MAX_ARRIVAL_MS      1000
 
 #define DISPATCHER_INTERVAL 3
 
-#define LOG_DIR             "logs"
-#define LOG_MASTER          "logs/master.log"
-#define LOG_DISPATCHER      "logs/dispatcher.log"
-#define LOG_TICKET_OFFICE   "logs/ticket_office.log"
-#define LOG_DRIVER          "logs/driver.log"
-#define LOG_PASSENGER       "logs/passenger.log"
-#define LOG_STATS           "logs/stats.log"
+#define CACHE_LINE_SIZE     64
+#define STAT_SHARDS         16    /* Per-CPU shards of the passenger flow counters */
+#define REPLY_MAILBOXES     4096  /* Reply slots in shm; overflow falls back to resp queues */
+#define SOCK_BATCH          16    /* Requests drained per recvmmsg() with --transport=sock */
+#define BOARDING_BATCH      16    /* Boarding requests a driver decides per wakeup (max --board_batch) */
+#define BOARDING_AGING      3     /* Tries after which a request goes before the packed ones */
+
+/* Service shares of the passenger classes at ticket offices and buses
+ * (--sched_weights=V,R,S,B,F) and how long a class may go unserved */
+#define CLASS_WEIGHT_VIP     8
+#define CLASS_WEIGHT_REGULAR 2
+#define CLASS_WEIGHT_SENIOR  4
+#define CLASS_WEIGHT_BIKE    2
+#define CLASS_WEIGHT_FAMILY  3
+#define CLASS_AGING_MS       5000
 
+#define LOG_DIR             "logs"   /* Instance N > 0 logs to logs/run-N */
+#define LOG_MASTER          "master.log"
+#define LOG_DISPATCHER      "dispatcher.log"
+#define LOG_TICKET_OFFICE   "ticket_office.log"
+#define LOG_DRIVER          "driver.log"
+#define LOG_PASSENGER       "passenger.log"
+#define LOG_STATS           "stats.log"
+
+/* SysV keys of run N (--instance, BUS_INSTANCE) are
+ * IPC_KEY_BASE + N * IPC_KEYS_PER_INSTANCE + offset; instance 0 is the
+ * classic fixed set. The ceiling is pid_max, so --instance=auto fits. */
 #define IPC_KEY_BASE        0x4255
-#define SHM_KEY             (IPC_KEY_BASE + 0x01)
-#define SEM_KEY             (IPC_KEY_BASE + 0x02)
-#define MSG_TICKET_KEY      (IPC_KEY_BASE + 0x03)
-#define MSG_TICKET_RESP_KEY (IPC_KEY_BASE + 0x04)
-#define MSG_BOARDING_KEY    (IPC_KEY_BASE + 0x05)
-#define MSG_BOARDING_RESP_KEY (IPC_KEY_BASE + 0x06)
-#define MSG_DISPATCH_KEY    (IPC_KEY_BASE + 0x07)
+#define IPC_KEYS_PER_INSTANCE 0x10
+#define IPC_INSTANCE_MAX    4194304
+#define SHM_KEY_OFFSET              0x01
+#define SEM_KEY_OFFSET              0x02
+#define MSG_TICKET_KEY_OFFSET       0x03
+#define MSG_TICKET_RESP_KEY_OFFSET  0x04
+#define MSG_BOARDING_KEY_OFFSET     0x05
+#define MSG_BOARDING_RESP_KEY_OFFSET 0x06
+#define MSG_DISPATCH_KEY_OFFSET     0x07
+
+/* POSIX message queues used instead of the request queues with --transport=mq
+ * (".<N>" appended for instance N > 0) */
+#define MQ_TICKET_NAME      "/city_bus_ticket"
+#define MQ_BOARDING_NAME    "/city_bus_boarding"
+/* Abstract AF_UNIX names with --transport=sock:
+ * <prefix>.<instance>.office.<id>, .bus.<id>, .passenger.<pid> */
+#define SOCK_NAME_PREFIX    "city_bus"
 
 #endif
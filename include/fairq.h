@@ -0,0 +1,53 @@
+#ifndef FAIRQ_H
+#define FAIRQ_H
+
+#include <stdint.h>
+
+/*
+ * Order in which a ticket office or a driver serves the classes of
+ * passengers queued for it. Each class is due at a virtual time ("pass")
+ * that moves on by FAIRQ_STRIDE / weight with every request served, and
+ * the class due first is served next, so while classes are backlogged
+ * they share service in proportion to their weights (weighted fair
+ * queuing, as stride scheduling). A class that had nothing queued comes
+ * back at the current virtual time instead of with the credit it would
+ * have banked. On top of that a class not served for CLASS_AGING_MS goes
+ * before all the others, which bounds how long its oldest request waits
+ * whatever the weights. --sched=fifo keeps VIPs first, then arrival order.
+ *
+ * State is per serving process; nothing here is shared or locked.
+ */
+typedef enum {
+    CLASS_VIP = 0,
+    CLASS_REGULAR,
+    CLASS_SENIOR,     /* SENIOR_AGE and older, travelling alone */
+    CLASS_BIKE,
+    CLASS_FAMILY,     /* Adult with a child */
+    CLASS_COUNT
+} passenger_class_t;
+
+typedef struct {
+    int fifo;
+    long aging_ms;
+    uint32_t weight[CLASS_COUNT];
+    uint64_t pass[CLASS_COUNT];
+    uint64_t vnow;                  /* Pass of the request served last */
+    long last_ms[CLASS_COUNT];      /* Last served, or last found with nothing queued */
+} fairq_t;
+
+/* `policy` "fifo" or "wfq" (NULL = wfq), `weights` "V,R,S,B,F" (NULL or
+ * malformed = the CLASS_WEIGHT_* defaults) */
+void fairq_init(fairq_t *s, const char *policy, const char *weights, long now_ms);
+/* Every class, in the order to try them: aged ones first, the longest
+ * unserved leading, then by pass */
+void fairq_order(const fairq_t *s, long now_ms, int *order);
+void fairq_served(fairq_t *s, int cls, long now_ms);
+/* `cls` was tried and had nothing queued */
+void fairq_idle(fairq_t *s, int cls, long now_ms);
+/* Order for a batch already received: writes the indices of the `n`
+ * requests of classes cls[] as they should be served (oldest first within
+ * a class) and counts them as served */
+void fairq_arrange(fairq_t *s, const int *cls, int n, long now_ms, int *order);
+const char *fairq_class_name(int cls);
+
+#endif
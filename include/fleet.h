@@ -0,0 +1,29 @@
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+#include "occupancy.h"
+
+/*
+ * Vehicle of each bus (--fleet, BUS_FLEET): its seats, bike places and the
+ * range its round trip takes. The spec lists the buses from bus 0, comma
+ * separated, each a preset - standard, midi, articulated - or
+ * SEATS/BIKES/MIN-MAX (seconds); buses left out are standard. The creator
+ * fills shm from it once, nobody changes it after.
+ */
+#define FLEET_NAME_LEN  16
+
+typedef struct {
+    char name[FLEET_NAME_LEN];  /* Preset, or the SEATS/BIKES/MIN-MAX entry itself */
+    occ_capacity_t capacity;
+    uint16_t min_return;
+    uint16_t max_return;
+} bus_model_t;
+
+/* Fill models[MAX_BUSES] from `spec` (NULL or "" = all standard). 0, or -1
+ * with the offending entry and why in `err`. */
+int fleet_parse(const char *spec, bus_model_t *models, char *err, size_t errlen);
+
+#endif
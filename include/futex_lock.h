@@ -0,0 +1,35 @@
+#ifndef FUTEX_LOCK_H
+#define FUTEX_LOCK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Process-shared mutex that lives directly in shared memory.
+ * The lock word holds the owner PID (0 = free) plus a waiters bit, so the
+ * uncontended lock/unlock is a single CAS/exchange with no syscall. Contended
+ * lockers spin briefly, then sleep on the word with FUTEX_WAIT.
+ *
+ * Robustness: a sleeping locker periodically checks whether the owner PID is
+ * still alive; if it died while holding the lock (e.g. --test1 SIGKILLs a
+ * driver), the lock is taken over and EOWNERDEAD is returned.
+ */
+typedef struct {
+    _Atomic uint32_t word;
+} futex_mutex_t;
+
+#define FUTEX_MUTEX_WAITERS 0x80000000u
+
+/* Returns 0, or EOWNERDEAD when the lock was recovered from a dead owner. */
+int futex_mutex_lock(futex_mutex_t *m);
+/* Returns 0 on success, EBUSY if the lock is held. Never blocks. */
+int futex_mutex_trylock(futex_mutex_t *m);
+void futex_mutex_unlock(futex_mutex_t *m);
+int futex_mutex_is_locked(futex_mutex_t *m);
+
+/* Raw shared (non-private) futex helpers. timeout is relative, NULL = forever. */
+int futex_wait(_Atomic uint32_t *addr, uint32_t expected, const struct timespec *timeout);
+int futex_wake(_Atomic uint32_t *addr, int count);
+
+#endif
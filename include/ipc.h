@@ -3,15 +3,45 @@
 
 #include "common.h"
 
+#include <sys/sem.h>
+#include <time.h>
+
 int ipc_create_all(void);
 int ipc_attach_all(void);
 void ipc_detach_all(void);
 void ipc_cleanup_all(void);
 int ipc_resources_exist(void);
+/* Whether this instance's shm is still attached by some process, i.e. another
+ * simulation is running under the same --instance id */
+int ipc_resources_in_use(void);
+/* Run id from BUS_INSTANCE (0 if unset); selects the SysV keys, mqueue and
+ * socket names and the log directory, so runs with different ids never meet */
+int ipc_get_instance(void);
+
+/* Memory residency and accounting. ipc_mem_init() right after attach tags
+ * the process with its role; with --hugepages (BUS_SHM_HUGE) the segment is
+ * created on huge pages when the kernel has them, and every role but the
+ * short-lived passengers mlock()s its mapping, which also pre-faults it.
+ * ipc_mem_flush() adds the page faults and dTLB misses taken since the
+ * last flush to shm->mem[role]; ipc_detach_all() does a final one.
+ * ipc_mem_tick() flushes at most once a second, for the loops of roles that
+ * may still be attached when the dispatcher writes the final stats. */
+void ipc_mem_init(mem_role_t role);
+void ipc_mem_flush(void);
+void ipc_mem_tick(void);
 
 shm_data_t* ipc_get_shm(void);
 int ipc_get_shmid(void);
 
+/* Backend of the shm state locks (station, bus, office - see common.h),
+ * selected once at startup via BUS_LOCK_MODE */
+typedef enum {
+    IPC_LOCK_SYSV = 0,   /* semop() on the SysV semaphore set (default) */
+    IPC_LOCK_FUTEX = 1   /* futex_mutex_t inside shm_data_t next to the data */
+} ipc_lock_mode_t;
+
+ipc_lock_mode_t ipc_get_lock_mode(void);
+
 int ipc_get_semid(void);
 int sem_lock(int sem_num);
 int sem_trylock(int sem_num);  /* Non-blocking; use when holder may be stopped (e.g. SIGSTOP) */
@@ -19,23 +49,164 @@ void sem_unlock(int sem_num);
 int sem_getval(int sem_num);
 void sem_setval(int sem_num, int value);
 
+/* Several semaphore operations applied all-or-nothing in one semtimedop()
+ * (timeout NULL = block). Taking a gate and a state lock together this way
+ * never holds one while blocked on the other. Futex-backed state locks
+ * (--lock=futex) cannot join the semop: their releases run before it and
+ * their acquisitions after it, in the order given, ignoring the timeout.
+ * Returns 0, or -1 (EAGAIN on timeout/IPC_NOWAIT, EIDRM once removed). */
+#define SEM_OPS_MAX 8
+int sem_ops(const struct sembuf *ops, int nops, const struct timespec *timeout);
+
+/* Every shm state lock in hierarchy order, for whole-state snapshots */
+void shm_lock_all(void);
+int shm_trylock_all(void);  /* 0, or -1 with nothing held */
+void shm_unlock_all(void);
+
+/* Consistent copy of station state and of each bus without taking any lock;
+ * writers are never delayed by it. Zeroed if shm is not attached. */
+void shm_read_status(status_snapshot_t *out);
+
+/* Idle drivers sleep on a shm event counter instead of polling. Whoever
+ * changes bay_bus, a bus' boarding_open, station_closed or
+ * simulation_running calls shm_bus_notify() after unlocking. A driver takes
+ * shm_bus_events() BEFORE looking at that state, then shm_bus_wait() returns
+ * at once if anything moved since, else on the next notify or `timeout_ms`.
+ * Passengers waiting for a bus do the same on a word of their own
+ * (shm_board_events/shm_board_wait); a notify wakes only as many of them
+ * as the buses boarding at the bays have seats left - all once the run or
+ * boarding is over. */
+uint32_t shm_bus_events(void);
+void shm_bus_notify(void);
+void shm_bus_wait(uint32_t seen, int timeout_ms);
+uint32_t shm_board_events(void);
+void shm_board_wait(uint32_t seen, int timeout_ms);
+
+/* With SEM_SHM_MUTEX held: the bus to give a bay to, searching after bus
+ * `after` (-1: from bus 0). A live bus open at the station without a bay -
+ * of those the one sized for the queue (STAT_WAITING): the smallest that
+ * seats everyone waiting, else the largest - else the live one due back
+ * soonest, which stands by and boards the moment it returns. -1 if there
+ * is none. */
+int shm_next_bay_bus(int after);
+
+/* Seat ledger with --assign (shm->assign_seats): book the seats and bike
+ * place of `p` on the bus that leaves soonest with room for them -
+ * boarding at a bay, then due back to one, then the rest - and return it,
+ * or -1 if all are booked out. A booking `p` already holds (one whose
+ * ticket reply it never got) is returned as it is. The passenger then
+ * queues for that bus alone and is sure to fit; the booking lasts until
+ * the driver admits them, shm_unbook_seat(), or the watchdog finds them
+ * gone (shm_reclaim_bookings). No lock: see occupancy_book(). */
+int shm_book_seat(const wire_passenger_t *p);
+void shm_unbook_seat(int bus, const wire_passenger_t *p);
+/* Watchdog: give back the seats booked for passengers no longer alive;
+ * returns how many bookings */
+int shm_reclaim_bookings(void);
+/* The driver of `bus` is gone and its ledger cleared: forget its owners */
+void shm_drop_bookings(int bus);
+
+/* With SEM_SHM_MUTEX held, after bay_bus or a bus' at_station changed:
+ * keeps the clock of time with no bus boarding at any bay. shm_no_bus_ms()
+ * reads it, including a stretch still running. */
+void shm_bays_changed(void);
+long shm_no_bus_ms(void);
+
+/* Request transport, selected once at startup via BUS_TRANSPORT */
+typedef enum {
+    IPC_TRANSPORT_SYSV = 0,  /* SysV message queues for everything (default) */
+    IPC_TRANSPORT_RING = 1,  /* Ticket requests through the lock-free shm ring */
+    IPC_TRANSPORT_MQ = 2,    /* Ticket and boarding requests through POSIX mqueues,
+                              * VIP boarding requests at a higher mq priority */
+    IPC_TRANSPORT_SOCK = 3   /* Requests and replies as AF_UNIX datagrams to per-office,
+                              * per-bus and per-passenger sockets, drained in batches */
+} ipc_transport_t;
+
+ipc_transport_t ipc_get_transport(void);
+const char *ipc_transport_name(void);  /* "sysv", "ring", "mq" or "sock" */
+/* Whether a SEM_*_QUEUE_SLOTS semaphore bounds the active transport
+ * (the ring is bounded by its own capacity and sockets by their receive
+ * queues, neither needs a slot semaphore). */
+int ipc_queue_slots_enabled(int slots_sem);
+
+/* Per-process reply mailbox in shm. Once open, msg_send_ticket/boarding
+ * stamp requests with it, responders post the reply straight into it and
+ * msg_recv_*_resp wait on it instead of msgrcv(mtype = pid) on the shared
+ * response queues. Returns the slot or -1 (table full: queues are used).
+ * Closed by ipc_detach_all(). */
+int ipc_mailbox_open(void);
+void ipc_mailbox_close(void);
+
+/* Own socket with --transport=sock (no-op otherwise): offices and drivers
+ * bind the address requests are sent to, passengers the one replies come
+ * back to. Closed by ipc_detach_all(). A driver's id also picks the
+ * booked requests it receives with --assign. */
+typedef enum {
+    IPC_ENDPOINT_OFFICE = 0,
+    IPC_ENDPOINT_BUS,
+    IPC_ENDPOINT_PASSENGER
+} ipc_endpoint_t;
+
+int ipc_endpoint_open(ipc_endpoint_t kind, int id);
+
 int ipc_get_msgid_ticket(void);
 int ipc_get_msgid_boarding(void);
 int ipc_get_msgid_dispatch(void);
 
+/* With the ring and mq transports a blocking msg_recv_ticket()/msg_recv_boarding()
+ * returns -1/EINTR every few hundred ms while idle, so callers re-check their
+ * shutdown flags. */
 int msg_send_ticket(ticket_msg_t *msg);
 int msg_send_ticket_resp(ticket_msg_t *msg);
 ssize_t msg_recv_ticket(ticket_msg_t *msg, long mtype, int flags);
 ssize_t msg_recv_ticket_resp(ticket_msg_t *msg, long mtype, int flags);
+/* Up to `max` (<= SOCK_BATCH) requests per call - one recvmmsg() with the
+ * socket transport, a single message otherwise - and the replies to a batch
+ * in one sendmmsg(). Returns the number of messages or -1 like msg_recv_*.
+ * Passenger classes are served by the fairq.h scheduler (BUS_SCHED): on the
+ * SysV queue by picking the class to receive from (`mtype` is then unused),
+ * with sockets by ordering the batch. The ring and mq carry tickets FIFO. */
+int msg_recv_ticket_batch(ticket_msg_t *msgs, int max, long mtype, int flags);
+int msg_send_ticket_resp_batch(ticket_msg_t *msgs, int count);
 
 int msg_send_boarding(boarding_msg_t *msg);
 int msg_send_boarding_resp(boarding_msg_t *msg);
 ssize_t msg_recv_boarding(boarding_msg_t *msg, long mtype, int flags);
+/* Like a blocking msg_recv_boarding(), but with mq gives up with -1/ETIMEDOUT
+ * at `deadline` (wall clock), so a driver wakes for its departure. The SysV
+ * queue has no timed receive; there msgrcv() is cut short by a SIGALRM
+ * timer armed for `deadline`. Unlike msg_recv_boarding(), a signal returns
+ * -1/EINTR instead of being retried. */
+ssize_t msg_recv_boarding_until(boarding_msg_t *msg, long mtype, int flags, time_t deadline);
+/* Batch variant of msg_recv_boarding_until() (deadline 0 = none, IPC_NOWAIT
+ * honoured): waits for the first request, then takes up to `max` (<= SOCK_BATCH)
+ * already queued without waiting again. Passenger classes are served in the
+ * order of the fairq.h scheduler (BUS_SCHED): on the SysV queue by picking
+ * the class to receive from, with mq and sockets by ordering the batch.
+ * On the SysV queue only request classes that fit `seats` free seats and
+ * `bikes` free bike places are taken, and no more than fill them; 0 if
+ * none can fit. The mq transport takes any request while a seat is free
+ * (else 0), sockets any request. With --assign a driver takes only the
+ * requests booked on its bus (its mtype; with mq too, the SysV queue). */
+int msg_recv_boarding_batch(boarding_msg_t *msgs, int max, int seats, int bikes,
+                            int flags, time_t deadline);
+int msg_send_boarding_resp_batch(boarding_msg_t *msgs, int count);
+/* Put a request a driver took back in front of the buses without waiting,
+ * keeping its reply address: on the shared queue, or with sockets to bus
+ * msg->bus_id. -1 (EAGAIN) if there is no room. */
+int msg_requeue_boarding(boarding_msg_t *msg);
 ssize_t msg_recv_boarding_resp(boarding_msg_t *msg, long mtype, int flags);
+/* Human-readable deny code (with its deny_arg values) for logging */
+const char *boarding_deny_text(const boarding_msg_t *msg, char *buf, size_t len);
+/* Seat numbers and rack place of a granted request, e.g. "seats 3+4" or
+ * "seat 7, rack 2" */
+const char *boarding_places_text(const boarding_msg_t *msg, char *buf, size_t len);
 
 int msg_send_dispatch(dispatch_msg_t *msg);
 ssize_t msg_recv_dispatch(dispatch_msg_t *msg, long mtype, int flags);
 
+int msg_ticket_queue_depth(void);
+
 void ipc_check_queue_health(void);
 
 #endif
@@ -20,7 +20,11 @@ typedef enum {
 
 // Creates log directory if it doesn't exist.
 int log_init(void);
-// Log a formatted event to a specific file.
+// This run's log directory: LOG_DIR, or LOG_DIR/run-<instance> for instance > 0.
+const char *log_get_dir(void);
+// Removes the previous run's log files from the log directory.
+void log_clear(void);
+// Log a formatted event to a specific file (a name inside the log directory).
 void log_event(const char *filename, log_level_t level, const char *format, ...);
 // Specific log functions event handler for different files.
 void log_master(log_level_t level, const char *format, ...);
@@ -0,0 +1,58 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "config.h"
+
+/*
+ * Single-reply mailboxes in shared memory. A waiter claims a slot, arms it
+ * with a fresh token per request and sends (slot, token) along with the
+ * request; the responder posts the reply straight into the slot and wakes
+ * exactly that waiter with FUTEX_WAKE on the slot's state word.
+ *
+ * state = (generation << 3) | MAILBOX_*. Every arm and release bumps the
+ * generation, so a late reply to an abandoned request fails its CAS and is
+ * dropped instead of reaching the next owner. One that already won its CAS
+ * holds the slot BUSY: arm and release wait it out and a steal skips the
+ * slot, so its final store never lands on the next generation. A responder
+ * may first post a provisional reply ("wait, the answer follows"); the
+ * waiter reads it and keeps waiting on the same token, and the final reply
+ * replaces it if it has not been read yet.
+ */
+#define MAILBOX_PAYLOAD 56   /* state + owner + payload = one cache line */
+
+enum MailboxState {
+    MAILBOX_FREE = 0,
+    MAILBOX_WAITING = 1,
+    MAILBOX_BUSY = 2,
+    MAILBOX_READY = 3,
+    MAILBOX_PROVISIONAL = 4
+};
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t state;
+    pid_t owner;
+    unsigned char data[MAILBOX_PAYLOAD];
+} mailbox_t;
+
+/* Claim a free slot (probing from `hint`, stealing slots of dead owners).
+ * Returns the slot index or -1 if the table is full. */
+int mailbox_claim(mailbox_t *table, int count, int hint, pid_t owner);
+void mailbox_release(mailbox_t *box);
+/* Start a new request on an owned slot; returns the token to send along. */
+uint32_t mailbox_arm(mailbox_t *box);
+/* Deliver a reply. Returns 0, or -1 if the token is stale (reply dropped). */
+int mailbox_post(mailbox_t *box, uint32_t token, const void *data, size_t len);
+/* Deliver a reply that a final one will follow; -1 also if that is already in */
+int mailbox_post_provisional(mailbox_t *box, uint32_t token, const void *data, size_t len);
+/* Wait for the reply to `token`, at most `timeout` (relative). Returns 0 with
+ * the final reply copied out, 1 with a provisional one (wait again for the
+ * final), or -1 with errno ETIMEDOUT/EINTR (retry) or EIDRM. */
+int mailbox_wait(mailbox_t *box, uint32_t token, void *data, size_t len,
+                 const struct timespec *timeout);
+
+#endif
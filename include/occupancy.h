@@ -0,0 +1,105 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include "config.h"
+
+/*
+ * Seats taken, bikes on board and seats of people still walking in for one
+ * bus, packed into a single word so admission is one compare-and-swap: a
+ * reservation checks the bus' seats and bike places and the closed bit and
+ * bumps seats, bikes and entering together. Seats minus entering is who is
+ * really on board. Departure sets the closed bit
+ * with the same CAS, and only while nobody is entering - once it succeeds
+ * the entrance is clear and no reservation can get in any more. A driver
+ * that finds someone in the door sets the closing bit (no new reservations)
+ * and sleeps on the word; the last one to finish entering wakes it.
+ *
+ * word = closed << 31 | closing << 30 | entering << 20 | bikes << 10 | seats
+ */
+typedef _Atomic uint32_t occupancy_t;
+
+#define OCC_FIELD_BITS   10
+#define OCC_FIELD_MASK   ((1u << OCC_FIELD_BITS) - 1)
+#define OCC_SEATS(w)     ((int)((w) & OCC_FIELD_MASK))
+#define OCC_BIKES(w)     ((int)(((w) >> OCC_FIELD_BITS) & OCC_FIELD_MASK))
+#define OCC_ENTERING(w)  ((int)(((w) >> (2 * OCC_FIELD_BITS)) & OCC_FIELD_MASK))
+#define OCC_CLOSED       (1u << 31)
+#define OCC_CLOSING      (1u << 30)
+
+_Static_assert(MAX_BUS_CAPACITY <= (int)OCC_FIELD_MASK && MAX_BIKE_CAPACITY <= (int)OCC_FIELD_MASK,
+               "capacities must fit an occupancy field");
+
+/* Seats and bike places of one bus (fleet.h), at most MAX_BUS_CAPACITY and
+ * MAX_BIKE_CAPACITY */
+typedef struct {
+    uint16_t seats;
+    uint16_t bikes;
+} occ_capacity_t;
+
+typedef enum {
+    OCC_RESERVED = 0,
+    OCC_FULL,          /* Not enough free seats */
+    OCC_NO_BIKE_SPACE,
+    OCC_IS_CLOSED      /* Bus has closed its doors for departure */
+} occ_result_t;
+
+typedef struct {
+    uint8_t seats;         /* 1, or 2 for an adult with a child */
+    uint8_t bike;
+    uint8_t first;         /* VIP or aged: placed before the packed ones */
+} occ_request_t;
+
+/* Take seats (and a bike place) for a batch of people in one CAS and count
+ * them as entering. Requests are admitted in order while they fit - a
+ * refused one does not stop a smaller one behind it - and result[i] says
+ * why not. Returns how many were admitted; *word is the occupancy with
+ * them all in (the refusing state when none was). */
+int occupancy_reserve_many(occupancy_t *occ, occ_capacity_t cap, const occ_request_t *req,
+                           int n, occ_result_t *result, uint32_t *word);
+/* Order a batch for occupancy_reserve_many() so it fills the bus best
+ * from `word`: requests marked `first` in arrival order, then the set of
+ * the others that takes the most seats (then bike places, then earliest
+ * arrivals) - a small knapsack - and the rest last, to be refused. Writes
+ * the indices of req[] into order[n]; n <= BOARDING_BATCH. */
+void occupancy_pack(uint32_t word, occ_capacity_t cap, const occ_request_t *req, int n, int *order);
+/* `seats` counted as entering by occupancy_reserve_many() are inside */
+void occupancy_entered(occupancy_t *occ, int seats);
+/* Close for departure if nobody is entering: 1 with *word = final load,
+ * 0 with *word showing who is still in the door */
+int occupancy_close(occupancy_t *occ, uint32_t *word);
+/* Like occupancy_close(), but if someone is entering stop new reservations
+ * and sleep until the door is clear (or `timeout` / a signal) */
+int occupancy_close_wait(occupancy_t *occ, const struct timespec *timeout, uint32_t *word);
+/* Empty and open again (bus back at the station) */
+void occupancy_reset(occupancy_t *occ);
+/* Clear the seats of whoever is on board and the bikes, keep the seats
+ * still entering and the rest; returns the seats cleared */
+int occupancy_take_seats(occupancy_t *occ);
+
+/*
+ * Seat ledger of a bus (--assign): `booked` holds the seats and bike
+ * places sold for it but not boarded yet, in the seats and bikes fields.
+ * A booking must fit on top of both that and who is on the bus now, so
+ * everyone booked fits in - the ones not in time go on the next trip,
+ * which has even more room. Admission reserves the occupancy first and
+ * unbooks after; the ledger is read before the occupancy, so a passenger
+ * between the two is counted twice, never not at all.
+ */
+int occupancy_book(occupancy_t *booked, occupancy_t *occ, occ_capacity_t cap,
+                   int seats, int bike);  /* 1 or 0: full */
+void occupancy_unbook(occupancy_t *booked, int seats, int bike);  /* Stops at zero */
+
+static inline int occupancy_seats(occupancy_t *occ) {
+    return OCC_SEATS(atomic_load_explicit(occ, memory_order_relaxed));
+}
+
+/* Seats of people already on board (not still in the door) */
+static inline int occupancy_on_board(occupancy_t *occ) {
+    uint32_t w = atomic_load_explicit(occ, memory_order_relaxed);
+    return OCC_SEATS(w) - OCC_ENTERING(w);
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SEATMAP_H
+#define SEATMAP_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * Which seats of a bus (or places on its bike rack) are taken, one bit per
+ * place. Seats come in rows of two - places 2k and 2k+1 - so an adult with
+ * a child can be given a whole row. Besides the bits each map keeps three
+ * summary words, bit w standing for bits[w]: some place free, a whole row
+ * free, a row with one of its two places free. Finding a place is then a
+ * count-trailing-zeros on a summary and one on the word it points at,
+ * however large the bus.
+ *
+ * Only the bus' own driver writes a map (it admits and departs); anyone
+ * may read the bits, e.g. for a trip report, the summaries are its own.
+ * The count is kept by the occupancy word (occupancy.h): a driver takes a
+ * place only after reserving it there, so a place is always free.
+ */
+#define SEATMAP_WORDS(places)  (((places) + 63) / 64)
+#define SEATMAP_MAX_WORDS      SEATMAP_WORDS(MAX_BUS_CAPACITY > MAX_BIKE_CAPACITY ? MAX_BUS_CAPACITY : MAX_BIKE_CAPACITY)
+
+_Static_assert(SEATMAP_MAX_WORDS <= 64, "one summary word per map");
+
+typedef struct {
+    int places;
+    bool rows;                                 /* Seats in rows of two; a rack has none */
+    _Atomic uint64_t bits[SEATMAP_MAX_WORDS];  /* Bit i set: place i taken */
+    uint64_t any_free;
+    uint64_t row_free;
+    uint64_t half_free;
+} seat_map_t;
+
+/* Empty map of `places` (<= 64 * SEATMAP_MAX_WORDS), seats in rows or not */
+void seatmap_init(seat_map_t *m, int places, bool rows);
+/* Everyone off: every place free again */
+void seatmap_clear(seat_map_t *m);
+/* A place for one, in a row already half taken if there is one (keeping
+ * whole rows for families), else the first free. -1 if full. */
+int seatmap_take(seat_map_t *m);
+/* Both places of the first free row; returns the first, the second is the
+ * next one. -1 if no row is whole. */
+int seatmap_take_pair(seat_map_t *m);
+/* Map as text for logs: 'X' taken, '.' free, rows split by a space */
+char *seatmap_format(const seat_map_t *m, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sched.h>
+
+/*
+ * Sequence counter for data whose writers are already serialized by a lock.
+ * Odd = write in progress. Readers copy the data between read_begin() and
+ * read_retry() and start over if a writer got in between: no lock, no
+ * syscall, and a reader can never hold up a writer.
+ */
+#define SEQLOCK_SPINS_BEFORE_YIELD 1000
+
+static inline void seqlock_write_begin(_Atomic uint32_t *seq) {
+    uint32_t s = atomic_load_explicit(seq, memory_order_relaxed);
+    if ((s & 1u) == 0) {  /* Odd already: previous writer died mid-section */
+        atomic_store_explicit(seq, s + 1, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void seqlock_write_end(_Atomic uint32_t *seq) {
+    uint32_t s = atomic_load_explicit(seq, memory_order_relaxed);
+    if (s & 1u) {  /* Even: unbalanced unlock (e.g. lock failed at shutdown) */
+        atomic_store_explicit(seq, s + 1, memory_order_release);
+    }
+}
+
+static inline uint32_t seqlock_read_begin(_Atomic uint32_t *seq) {
+    uint32_t s;
+    int spins = 0;
+    while ((s = atomic_load_explicit(seq, memory_order_acquire)) & 1u) {
+        if (++spins >= SEQLOCK_SPINS_BEFORE_YIELD) {
+            sched_yield();  /* Writer preempted (or stopped): let it run */
+            spins = 0;
+        }
+    }
+    return s;
+}
+
+static inline int seqlock_read_retry(_Atomic uint32_t *seq, uint32_t start) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != start;
+}
+
+#endif
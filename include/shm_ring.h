@@ -0,0 +1,52 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "config.h"
+
+/*
+ * Bounded multi-producer/multi-consumer ring living in shared memory
+ * (Vyukov-style: every slot carries a sequence number, producers and
+ * consumers claim positions with a CAS on tail/head).
+ *
+ * Enqueue/dequeue never take a lock or make a syscall. Blocking callers sleep
+ * on an eventcount futex only when the ring is empty (consumers) or full
+ * (producers), and are woken by the opposite side.
+ */
+#define SHM_RING_SLOTS    256   /* Power of two, >= MAX_TICKET_QUEUE_REQUESTS */
+#define SHM_RING_PAYLOAD  56    /* Slot = 8 byte header + payload = one cache line */
+
+typedef struct {
+    _Atomic uint32_t seq;
+    uint32_t len;
+    unsigned char data[SHM_RING_PAYLOAD];
+} shm_ring_slot_t;
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tail;      /* Next position to produce */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t head;      /* Next position to consume */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t items_ec;  /* Bumped after every enqueue */
+    _Atomic uint32_t items_waiters;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t space_ec;  /* Bumped after every dequeue */
+    _Atomic uint32_t space_waiters;
+    _Alignas(CACHE_LINE_SIZE) shm_ring_slot_t slots[SHM_RING_SLOTS];
+} shm_ring_t;
+
+void shm_ring_init(shm_ring_t *ring);
+
+/* Non-blocking: 0 on success, -1/EAGAIN if full (enqueue) / empty (dequeue). */
+int shm_ring_try_enqueue(shm_ring_t *ring, const void *data, size_t len);
+int shm_ring_try_dequeue(shm_ring_t *ring, void *data, size_t len);
+
+/* Sleep until the ring may have items/space, at most `timeout` (relative).
+ * Returns 0 when woken or the state already changed, -1 with errno
+ * ETIMEDOUT/EINTR otherwise. Callers loop around try_* + wait. */
+int shm_ring_wait_items(shm_ring_t *ring, const struct timespec *timeout);
+int shm_ring_wait_space(shm_ring_t *ring, const struct timespec *timeout);
+
+int shm_ring_depth(shm_ring_t *ring);
+
+#endif
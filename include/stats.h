@@ -0,0 +1,57 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include "config.h"
+
+/*
+ * Passenger flow counters that are only ever added to or subtracted from.
+ * Each counter is split over STAT_SHARDS cache-line shards; a writer does a
+ * single atomic add on the shard of the CPU it is running on (no lock, no
+ * syscall) and readers sum every shard. Sums taken while passengers are
+ * moving can be transiently off by the people in flight, as before; once
+ * the simulation is quiet they are exact.
+ */
+enum StatCounter {
+    STAT_CREATED = 0,     /* People created (adult + child) */
+    STAT_ADULTS,
+    STAT_CHILDREN,
+    STAT_VIP_CREATED,
+    STAT_IN_OFFICE,       /* People queued at / being served by a ticket office */
+    STAT_WAITING,         /* People at the station waiting for a bus */
+    STAT_LEFT_EARLY,
+    STAT_COUNT
+};
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic int value[STAT_COUNT];
+} stat_shard_t;
+
+typedef struct {
+    stat_shard_t shards[STAT_SHARDS];
+} stat_counters_t;
+
+void stat_reset(stat_counters_t *stats);
+void stat_add(stat_counters_t *stats, int counter, int delta);
+int stat_sum(stat_counters_t *stats, int counter);
+
+/*
+ * Wait times in ms, log-linear: exact below WAIT_SUB_BUCKETS ms, then
+ * WAIT_SUB_BUCKETS buckets per power of two (at most 1/8 off), up to about
+ * 17 minutes. Passengers add their own wait once; percentiles are read at
+ * the end.
+ */
+#define WAIT_SUB_BUCKETS 8
+#define WAIT_BUCKETS     (WAIT_SUB_BUCKETS * 18)
+
+typedef struct {
+    _Atomic int count[WAIT_BUCKETS];
+    _Atomic long max_ms;
+} wait_hist_t;
+
+void wait_hist_add(wait_hist_t *hist, long ms);
+int wait_hist_count(wait_hist_t *hist);
+/* Upper bound of the bucket holding the `pct`th percentile, 0 if empty */
+long wait_hist_percentile(wait_hist_t *hist, int pct);
+
+#endif
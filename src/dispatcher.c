@@ -106,42 +106,63 @@ static void init_shared_state(shm_data_t *shm) {
     shm->station_closed = false;
     shm->test_fill_queue = false;
     
-    shm->total_passengers_created = 0;
     shm->passengers_transported = 0;
-    shm->passengers_waiting = 0;
-    shm->passengers_in_office = 0;
-    shm->passengers_left_early = 0;
-
-    shm->adults_created = 0;
-    shm->children_created = 0;
-    shm->vip_people_created = 0;
-    shm->tickets_sold_people = 0;
-    shm->tickets_denied = 0;
-    shm->boarded_people = 0;
-    shm->boarded_vip_people = 0;
+    stat_reset(&shm->stats);
+    memset(shm->ticket_wait, 0, sizeof(shm->ticket_wait));
+    memset(shm->board_wait, 0, sizeof(shm->board_wait));
+    memset(shm->bookings, 0, sizeof(shm->bookings));
+    
+    /* Vehicles (--fleet, main checked the spec) */
+    bus_model_t models[MAX_BUSES];
+    char fleet_err[96];
+    if (fleet_parse(getenv("BUS_FLEET"), models, fleet_err, sizeof(fleet_err)) != 0) {
+        log_dispatcher(LOG_WARN, "Ignoring fleet: %s", fleet_err);
+        fleet_parse(NULL, models, fleet_err, sizeof(fleet_err));
+    }
     
     for (int i = 0; i < MAX_BUSES; i++) {
         shm->buses[i].id = i;
+        shm->buses[i].model = models[i];
         shm->buses[i].at_station = true;
         shm->buses[i].boarding_open = false;
-        shm->buses[i].passenger_count = 0;
-        shm->buses[i].bike_count = 0;
-        shm->buses[i].entering_count = 0;
+        occupancy_reset(&shm->buses[i].occupancy);
+        occupancy_reset(&shm->buses[i].booked);
+        seatmap_init(&shm->seat_maps[i], models[i].capacity.seats, true);
+        seatmap_init(&shm->rack_maps[i], models[i].capacity.bikes, false);
         shm->buses[i].departure_time = 0;
         shm->buses[i].return_time = 0;
+        shm->buses[i].boarded_people = 0;
+        shm->buses[i].boarded_vip_people = 0;
+        shm->buses[i].departures = 0;
+        shm->buses[i].departed_seats = 0;
+        shm->buses[i].departed_bikes = 0;
         shm->driver_pids[i] = 0;
     }
     
-    shm->active_bus_id = 0;  /* Bus 0 starts as active */
+    /* Boarding bays (--bays=N, main checked the range); buses 0..N-1 start at them */
+    const char *bays = getenv("BUS_BAYS");
+    shm->bays = BOARDING_BAYS;
+    if (bays && atoi(bays) >= 1 && atoi(bays) <= MAX_BUSES) {
+        shm->bays = atoi(bays);
+    }
+    for (int b = 0; b < MAX_BUSES; b++) {
+        shm->bay_bus[b] = b < shm->bays ? b : -1;
+    }
+    shm->no_bus_ms = 0;
+    shm->no_bus_since_ms = 0;
+    shm->parked.count = 0;  /* No passenger waits for a bus yet */
     
     /* Initialize ticket offices */
     for (int i = 0; i < TICKET_OFFICES; i++) {
-        shm->ticket_office_busy[i] = 0;
+        shm->offices[i].busy_pid = 0;
+        atomic_store(&shm->offices[i].tickets_issued, 0);
+        atomic_store(&shm->offices[i].tickets_sold_people, 0);
+        atomic_store(&shm->offices[i].tickets_denied, 0);
         shm->ticket_office_pids[i] = 0;
     }
     
-    shm->tickets_issued = 0;
     shm->dispatcher_pid = getpid();
+    shm->start_time = time(NULL);
 }
 
 static void forward_signal_to_drivers(shm_data_t *shm, int sig) {
@@ -175,6 +196,7 @@ static void process_signals(shm_data_t *shm) {
             shm->station_open = false;
             shm->spawning_stopped = true;   /* main should stop spawning */
             sem_unlock(SEM_SHM_MUTEX);
+            shm_bus_notify();
 
             log_dispatcher(LOG_WARN, "Station CLOSED - no new entries, waiting passengers can still board");
             printf(COLOR_RED "[DISPATCHER] SIGUSR2 processed - station closed, waiting passengers will be transported\n" COLOR_RESET);
@@ -189,11 +211,11 @@ static void process_signals(shm_data_t *shm) {
     }
 }
 
-static int all_buses_at_station_and_empty(shm_data_t *shm) {
+static int all_buses_at_station_and_empty(const status_snapshot_t *status) {
     for (int i = 0; i < MAX_BUSES; i++) {
-        if (!shm->buses[i].at_station) return 0;
-        if (shm->buses[i].passenger_count != 0) return 0;
-        if (shm->buses[i].entering_count != 0) return 0;
+        if (!status->buses[i].at_station) return 0;
+        if (status->buses[i].passenger_count != 0) return 0;
+        if (status->buses[i].entering_count != 0) return 0;
     }
     return 1;
 }
@@ -202,35 +224,59 @@ static int all_buses_at_station_and_empty(shm_data_t *shm) {
 static void check_bus_departures(shm_data_t *shm) {
     time_t now = time(NULL);
     
-    sem_lock(SEM_SHM_MUTEX);
     for (int i = 0; i < MAX_BUSES; i++) {
         bus_state_t *bus = &shm->buses[i];
         
+        sem_lock(SEM_BUS_MUTEX(i));
+        int at_station = bus->at_station;
+        int passengers = occupancy_seats(&bus->occupancy);
+        time_t departure_time = bus->departure_time;
+        sem_unlock(SEM_BUS_MUTEX(i));
+        
         /* Only check active buses at station with passengers */
-        if (!bus->at_station || bus->passenger_count == 0) continue;
-        if (bus->departure_time == 0) continue;
+        if (!at_station || passengers == 0) continue;
+        if (departure_time == 0) continue;
         
         /* If departure time exceeded by more than 2 seconds, force departure */
-        if (now > bus->departure_time + 2) {
-            pid_t driver_pid = shm->driver_pids[i];
+        if (now > departure_time + 2) {
+            pid_t driver_pid = SHM_READ(shm->driver_pids[i]);
             if (driver_pid > 0) {
-                sem_unlock(SEM_SHM_MUTEX);
                 log_dispatcher(LOG_WARN, "Overseer: Bus %d overdue (>2s), forcing departure via SIGUSR1", i);
                 kill(driver_pid, SIGUSR1);
-                sem_lock(SEM_SHM_MUTEX);
             }
         }
     }
-    sem_unlock(SEM_SHM_MUTEX);
 }
 
-/* Overseer: detect dead drivers and reassign active_bus_id */
+/* --assign: requests booked on a bus whose driver is gone would wait
+ * forever on its queue. Answer them, so the passengers book another bus.
+ * (Sockets: the requests went down with the driver's socket.) */
+static void turn_away_booked(shm_data_t *shm) {
+    for (int i = 0; i < MAX_BUSES; i++) {
+        if (SHM_READ(shm->driver_pids[i]) > 0) {
+            continue;
+        }
+        boarding_msg_t request;
+        while (msg_recv_boarding(&request, MSG_BOARD_REQUEST_BOOKED + i, IPC_NOWAIT) != -1) {
+            boarding_msg_t reply = request;
+            reply.mtype = request.passenger.pid;
+            reply.approved = false;
+            reply.deny = DENY_NOT_ACTIVE;
+            reply.reply = MSG_BOARD_DENIED;
+            if (msg_send_boarding_resp(&reply) == -1) {
+                log_dispatcher(LOG_WARN, "Watchdog: Failed to turn away PID %d", request.passenger.pid);
+            } else {
+                log_dispatcher(LOG_INFO, "Watchdog: PID %d was booked on bus %d, whose driver is gone",
+                               request.passenger.pid, i);
+            }
+        }
+    }
+}
+
+/* Overseer: detect dead drivers and give their bays to other buses */
 static void check_driver_health(shm_data_t *shm) {
     sem_lock(SEM_SHM_MUTEX);
     
-    int active_bus = shm->active_bus_id;
-    int active_driver_dead = 0;
-    
     /* Check all drivers */
     for (int i = 0; i < MAX_BUSES; i++) {
         pid_t pid = shm->driver_pids[i];
@@ -240,60 +286,87 @@ static void check_driver_health(shm_data_t *shm) {
                 /* Driver is dead */
                 log_dispatcher(LOG_WARN, "Watchdog: Driver %d (PID %d) is dead, clearing", i, pid);
                 shm->driver_pids[i] = 0;
+                sem_lock(SEM_BUS_MUTEX(i));
                 shm->buses[i].boarding_open = false;
-                
-                if (i == active_bus) {
-                    active_driver_dead = 1;
-                }
+                sem_unlock(SEM_BUS_MUTEX(i));
+                /* Its seats are sold no more; the passengers booked on it book again */
+                occupancy_reset(&shm->buses[i].booked);
+                shm_drop_bookings(i);
             }
         }
     }
     
-    /* If active driver died, find a new active bus */
-    if (active_driver_dead || (active_bus >= 0 && shm->driver_pids[active_bus] == 0)) {
-        int new_active = -1;
-        
-        /* Find first live driver at station */
-        for (int i = 0; i < MAX_BUSES; i++) {
-            if (shm->driver_pids[i] > 0 && shm->buses[i].at_station) {
-                new_active = i;
-                break;
-            }
+    /* A bay whose driver is gone, or left empty because every bus was busy,
+     * goes to a live bus at the station, else to the one due back first */
+    int changed = 0;
+    for (int b = 0; b < shm->bays; b++) {
+        int bus = shm->bay_bus[b];
+        if (bus >= 0 && shm->driver_pids[bus] > 0) {
+            continue;
         }
-        
-        if (new_active >= 0) {
-            shm->active_bus_id = new_active;
-            /* Reset departure time for new active bus */
+        int new_bus = shm_next_bay_bus(-1);
+        if (new_bus == bus) {
+            continue;  /* Still empty */
+        }
+        shm->bay_bus[b] = new_bus;
+        changed = 1;
+        if (new_bus >= 0 && SHM_READ(shm->buses[new_bus].at_station)) {
+            /* Reset departure time for the bus taking the bay */
             int boarding_interval = log_is_perf_mode() ? 1 : BOARDING_INTERVAL;
-            shm->buses[new_active].departure_time = time(NULL) + boarding_interval;
-            shm->buses[new_active].boarding_open = true;
-            sem_unlock(SEM_SHM_MUTEX);
-            log_dispatcher(LOG_WARN, "Watchdog: Reassigned active bus to %d (driver PID %d)", 
-                          new_active, shm->driver_pids[new_active]);
+            sem_lock(SEM_BUS_MUTEX(new_bus));
+            shm->buses[new_bus].departure_time = time(NULL) + boarding_interval;
+            shm->buses[new_bus].boarding_open = true;
+            sem_unlock(SEM_BUS_MUTEX(new_bus));
+            log_dispatcher(LOG_WARN, "Watchdog: Reassigned bay %d to bus %d (driver PID %d)",
+                          b, new_bus, shm->driver_pids[new_bus]);
+        } else if (new_bus >= 0) {
+            log_dispatcher(LOG_INFO, "Watchdog: Bay %d reserved for bus %d, due back first",
+                          b, new_bus);
         } else {
-            /* No live driver at station - set to -1, passengers will wait */
-            shm->active_bus_id = -1;
-            sem_unlock(SEM_SHM_MUTEX);
-            log_dispatcher(LOG_WARN, "Watchdog: No live drivers at station, active_bus_id = -1");
+            /* No live driver to take it - passengers use the other bays or wait */
+            log_dispatcher(LOG_WARN, "Watchdog: No live driver for bay %d, bay empty", b);
+        }
+    }
+    if (changed) {
+        shm_bays_changed();
+    }
+    sem_unlock(SEM_SHM_MUTEX);
+    if (changed) {
+        shm_bus_notify();
+    }
+    if (shm->assign_seats) {
+        turn_away_booked(shm);
+        int reclaimed = shm_reclaim_bookings();
+        if (reclaimed > 0) {
+            log_dispatcher(LOG_INFO, "Watchdog: Gave back %d booking(s) of passengers gone", reclaimed);
         }
-    } else {
-        sem_unlock(SEM_SHM_MUTEX);
     }
 }
 
 static void print_status(shm_data_t *shm) {
-    sem_lock(SEM_SHM_MUTEX);
+    /* Seqlock snapshot: polled every loop, must never hold up a driver */
+    status_snapshot_t status;
+    shm_read_status(&status);
     
-    int station_open = shm->station_open;
-    int boarding_allowed = shm->boarding_allowed;
-    int early_depart = shm->early_departure_flag;
-    int created = shm->total_passengers_created;
-    int transported = shm->passengers_transported;
-    int waiting = shm->passengers_waiting;
-    int in_office = shm->passengers_in_office;
-    int tickets = shm->tickets_issued;
-    int active_bus = shm->active_bus_id;
-    sem_unlock(SEM_SHM_MUTEX);
+    int station_open = status.station_open;
+    int boarding_allowed = status.boarding_allowed;
+    int early_depart = status.early_departure_flag;
+    int created = stat_sum(&shm->stats, STAT_CREATED);
+    int transported = status.passengers_transported;
+    int waiting = stat_sum(&shm->stats, STAT_WAITING);
+    int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+    int tickets = shm_tickets_issued(shm);
+    char bays[4 * MAX_BUSES] = "";  /* Bus at each bay, "-" when free */
+    int len = 0;
+    for (int b = 0; b < status.bays; b++) {
+        int bus = status.bay_bus[b];
+        const char *sep = b > 0 ? "," : "";
+        if (bus >= 0) {
+            len += snprintf(bays + len, sizeof(bays) - len, "%s%d", sep, bus);
+        } else {
+            len += snprintf(bays + len, sizeof(bays) - len, "%s-", sep);
+        }
+    }
 
     const char *log_mode = getenv("BUS_LOG_MODE");
     int is_minimal = (log_mode && strcmp(log_mode, "minimal") == 0);
@@ -305,23 +378,23 @@ static void print_status(shm_data_t *shm) {
         fflush(stdout);
     } else {
         log_dispatcher(LOG_INFO,
-                      "STATUS station=%s boarding=%s early=%s created=%d transported=%d waiting=%d in_office=%d tickets=%d active_bus=%d",
+                      "STATUS station=%s boarding=%s early=%s created=%d transported=%d waiting=%d in_office=%d tickets=%d bays=%s",
                       station_open ? "OPEN" : "CLOSED",
                       boarding_allowed ? "ALLOWED" : "BLOCKED",
                       early_depart ? "YES" : "NO",
-                      created, transported, waiting, in_office, tickets, active_bus);
+                      created, transported, waiting, in_office, tickets, bays);
     }
 }
 
 static int check_simulation_end(shm_data_t *shm) {
-    sem_lock(SEM_SHM_MUTEX);
-    int done = !shm->simulation_running;
-    int stop = shm->spawning_stopped;
-    int waiting = shm->passengers_waiting;
-    int in_office = shm->passengers_in_office;
-    int buses_done = all_buses_at_station_and_empty(shm);
-    int test_fill_queue = shm->test_fill_queue;
-    sem_unlock(SEM_SHM_MUTEX);
+    status_snapshot_t status;
+    shm_read_status(&status);
+    int done = !status.simulation_running;
+    int stop = status.spawning_stopped;
+    int waiting = stat_sum(&shm->stats, STAT_WAITING);
+    int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+    int buses_done = all_buses_at_station_and_empty(&status);
+    int test_fill_queue = status.test_fill_queue;
 
     /* During the queue-fill test (--test11), we keep the dispatcher running so that
      * ticket offices remain alive and can drain the queue after SIGCONT. */
@@ -338,28 +411,170 @@ static int check_simulation_end(shm_data_t *shm) {
     return 0;
 }
 
+/* Segment residency and the page faults / dTLB misses each role took while
+ * attached (processes that have not detached yet are not counted); to stdout,
+ * or to stats.log when to_log is set */
+static void print_memory_stats(shm_data_t *shm, int to_log) {
+    static const char *const roles[MEM_ROLE_COUNT] = {
+        "dispatcher", "offices", "drivers", "passengers"
+    };
+    if (to_log) {
+        log_stats("Shared memory: %zu kB on %s pages, locked in %d process(es), mlock refused in %d",
+                  shm->segment_size / 1024, shm->huge_pages ? "huge" : "normal",
+                  atomic_load(&shm->pinned), atomic_load(&shm->pin_refused));
+    } else {
+        printf("Shared memory: %zu kB on %s pages, locked in %d process(es)\n",
+               shm->segment_size / 1024, shm->huge_pages ? "huge" : "normal",
+               atomic_load(&shm->pinned));
+    }
+    for (int r = 0; r < MEM_ROLE_COUNT; r++) {
+        mem_role_stats_t *mem = &shm->mem[r];
+        int processes = atomic_load(&mem->processes);
+        if (processes == 0) {
+            continue;
+        }
+        long minor = atomic_load(&mem->minor_faults);
+        long major = atomic_load(&mem->major_faults);
+        char tlb[48];
+        int tlb_processes = atomic_load(&mem->tlb_processes);
+        if (tlb_processes > 0) {
+            snprintf(tlb, sizeof(tlb), "%.0f/process",
+                     (double)atomic_load(&mem->dtlb_misses) / tlb_processes);
+        } else {
+            snprintf(tlb, sizeof(tlb), "n/a");  /* No PMU access */
+        }
+        if (to_log) {
+            log_stats("Memory %s (%d): page faults minor=%ld (%.1f/process) major=%ld, dTLB load misses %s",
+                      roles[r], processes, minor, (double)minor / processes, major, tlb);
+        } else {
+            printf("Memory %s (%d): %.1f minor faults/process, dTLB misses %s\n",
+                   roles[r], processes, (double)minor / processes, tlb);
+        }
+    }
+}
+
+/* Wait time percentiles of each passenger class that had any */
+static void print_wait_stats(shm_data_t *shm, int to_log) {
+    struct { const char *name; wait_hist_t *hist; } waits[] = {
+        { "Ticket wait", shm->ticket_wait },
+        { "Boarding wait", shm->board_wait }
+    };
+    for (size_t w = 0; w < sizeof(waits) / sizeof(waits[0]); w++) {
+        for (int c = 0; c < CLASS_COUNT; c++) {
+            wait_hist_t *hist = &waits[w].hist[c];
+            int count = wait_hist_count(hist);
+            if (count == 0) {
+                continue;
+            }
+            long p50 = wait_hist_percentile(hist, 50);
+            long p90 = wait_hist_percentile(hist, 90);
+            long p99 = wait_hist_percentile(hist, 99);
+            long max = atomic_load(&hist->max_ms);
+            if (to_log) {
+                log_stats("%s %s (%d): p50=%ldms p90=%ldms p99=%ldms max=%ldms",
+                          waits[w].name, fairq_class_name(c), count, p50, p90, p99, max);
+            } else {
+                printf("%s %s (%d): p50 %.1fs, p90 %.1fs, p99 %.1fs, max %.1fs\n",
+                       waits[w].name, fairq_class_name(c), count,
+                       p50 / 1000.0, p90 / 1000.0, p99 / 1000.0, max / 1000.0);
+            }
+        }
+    }
+}
+
+/* Load and throughput of each vehicle type (--fleet), buses of a type summed */
+static void print_fleet_stats(shm_data_t *shm, double elapsed, int to_log) {
+    for (int i = 0; i < MAX_BUSES; i++) {
+        const bus_model_t *model = &shm->buses[i].model;
+        int seen = 0;
+        for (int j = 0; j < i && !seen; j++) {
+            seen = strcmp(shm->buses[j].model.name, model->name) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+        int buses = 0, departures = 0, seats = 0, bikes = 0, boarded = 0;
+        for (int j = i; j < MAX_BUSES; j++) {
+            bus_state_t *bus = &shm->buses[j];
+            if (strcmp(bus->model.name, model->name) != 0) {
+                continue;
+            }
+            buses++;
+            departures += atomic_load(&bus->departures);
+            seats += atomic_load(&bus->departed_seats);
+            bikes += atomic_load(&bus->departed_bikes);
+            boarded += atomic_load(&bus->boarded_people);
+        }
+        double trip_seats = departures > 0 ? (double)seats / departures : 0.0;
+        double trip_bikes = departures > 0 ? (double)bikes / departures : 0.0;
+        if (to_log) {
+            log_stats("Vehicle %s (%d buses, %d seats, %d bikes, return %d-%ds): %d departures, %.1f seats/trip (%.0f%%), %.1f bikes/trip, %.2f boarded/s",
+                      model->name, buses, model->capacity.seats, model->capacity.bikes,
+                      model->min_return, model->max_return, departures, trip_seats,
+                      100.0 * trip_seats / model->capacity.seats, trip_bikes, boarded / elapsed);
+        } else {
+            printf("Vehicle %s (x%d, %d seats, %d bikes): %d departures, %.1f seats/trip (%.0f%%), %.2f boarded/s\n",
+                   model->name, buses, model->capacity.seats, model->capacity.bikes, departures,
+                   trip_seats, 100.0 * trip_seats / model->capacity.seats, boarded / elapsed);
+        }
+    }
+}
+
 static void print_final_stats(shm_data_t *shm) {
-    sem_lock(SEM_SHM_MUTEX);
-    int created = shm->total_passengers_created;
+    shm_lock_all();
+    int created = stat_sum(&shm->stats, STAT_CREATED);
     int transported = shm->passengers_transported;
-    int waiting = shm->passengers_waiting;
-    int in_office = shm->passengers_in_office;
-    int left_early = shm->passengers_left_early;
-    int tickets = shm->tickets_issued;
-    int adults = shm->adults_created;
-    int children = shm->children_created;
-    int vip_created = shm->vip_people_created;
-    int sold_people = shm->tickets_sold_people;
-    int denied = shm->tickets_denied;
-    int boarded = shm->boarded_people;
-    int boarded_vip = shm->boarded_vip_people;
+    int waiting = stat_sum(&shm->stats, STAT_WAITING);
+    int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+    int left_early = stat_sum(&shm->stats, STAT_LEFT_EARLY);
+    int tickets = shm_tickets_issued(shm);
+    int adults = stat_sum(&shm->stats, STAT_ADULTS);
+    int children = stat_sum(&shm->stats, STAT_CHILDREN);
+    int vip_created = stat_sum(&shm->stats, STAT_VIP_CREATED);
+    int sold_people = shm_tickets_sold_people(shm);
+    int denied = shm_tickets_denied(shm);
+    int boarded = shm_boarded_people(shm);
+    int boarded_vip = shm_boarded_vip_people(shm);
     int on_bus = 0;
+    int departures = 0;
+    int departed_seats = 0;
+    int departed_bikes = 0;
+    long departed_capacity = 0;       /* Seats and bike places of the departed vehicles */
+    long departed_racks = 0;
+    long fleet_capacity = 0;          /* ...and of the whole fleet, for a run with no departure */
+    long fleet_racks = 0;
     for (int i = 0; i < MAX_BUSES; i++) {
-        on_bus += shm->buses[i].passenger_count;
+        int trips = atomic_load(&shm->buses[i].departures);
+        on_bus += occupancy_on_board(&shm->buses[i].occupancy);
+        departures += trips;
+        departed_seats += atomic_load(&shm->buses[i].departed_seats);
+        departed_bikes += atomic_load(&shm->buses[i].departed_bikes);
+        departed_capacity += (long)trips * shm->buses[i].model.capacity.seats;
+        departed_racks += (long)trips * shm->buses[i].model.capacity.bikes;
+        fleet_capacity += shm->buses[i].model.capacity.seats;
+        fleet_racks += shm->buses[i].model.capacity.bikes;
     }
-    sem_unlock(SEM_SHM_MUTEX);
+    time_t start_time = shm->start_time;
+    long no_bus_ms = shm_no_bus_ms();
+    shm_unlock_all();
 
     int sum = transported + waiting + in_office + on_bus + left_early;
+    double elapsed = difftime(time(NULL), start_time);
+    if (elapsed < 1.0) {
+        elapsed = 1.0;
+    }
+    double tickets_per_sec = tickets / elapsed;
+    double boarded_per_sec = boarded / elapsed;
+    double no_bus_per_hour = no_bus_ms / 1000.0 * 3600.0 / elapsed;
+    /* Average load of a departure: seats and bike racks taken, of what the
+     * departed vehicles had (with none, of the average vehicle configured) */
+    double trip_seats = departures > 0 ? (double)departed_seats / departures : 0.0;
+    double trip_bikes = departures > 0 ? (double)departed_bikes / departures : 0.0;
+    double trip_capacity = departures > 0 ? (double)departed_capacity / departures
+                                          : (double)fleet_capacity / MAX_BUSES;
+    double trip_racks = departures > 0 ? (double)departed_racks / departures
+                                       : (double)fleet_racks / MAX_BUSES;
+    const char *transport = ipc_transport_name();
     if (created != sum) {
         log_dispatcher(LOG_WARN, "STATS INCONSISTENCY: created=%d but transported+waiting+in_office+on_bus+left_early=%d (diff=%d)",
                        created, sum, created - sum);
@@ -373,6 +588,16 @@ static void print_final_stats(shm_data_t *shm) {
     printf(COLOR_GREEN "Transported people: %d\n" COLOR_RESET, transported);
     printf(COLOR_YELLOW "Left early (station closed): %d\n" COLOR_RESET, left_early);
     printf("Remaining: waiting=%d in_office=%d\n", waiting, in_office);
+    printf("Throughput (%s, %.0fs): %.1f tickets/s, %.1f boarded/s\n",
+           transport, elapsed, tickets_per_sec, boarded_per_sec);
+    printf("No bus boarding: %.1fs (%.0f s/hour)\n", no_bus_ms / 1000.0, no_bus_per_hour);
+    printf("Load per departure (%d): %.1f/%.1f seats (%.0f%%, %.1f empty), %.1f/%.1f bikes\n",
+           departures, trip_seats, trip_capacity, 100.0 * trip_seats / trip_capacity,
+           trip_capacity - trip_seats, trip_bikes, trip_racks);
+    print_fleet_stats(shm, elapsed, 0);
+    print_wait_stats(shm, 0);
+    ipc_mem_flush();  /* Add the dispatcher's own counts before reporting */
+    print_memory_stats(shm, 0);
     printf(COLOR_CYAN "================================\n\n" COLOR_RESET);
 
     log_dispatcher(LOG_INFO,
@@ -386,9 +611,18 @@ static void print_final_stats(shm_data_t *shm) {
     log_stats("Transported people: %d", transported);
     log_stats("Left early (station closed): %d", left_early);
     log_stats("Remaining: waiting=%d in_office=%d", waiting, in_office);
+    log_stats("Throughput (transport=%s, %.0fs): %.1f tickets/s, %.1f boarded/s",
+              transport, elapsed, tickets_per_sec, boarded_per_sec);
+    log_stats("No bus boarding at any bay: %.1fs (%.0f s/hour)", no_bus_ms / 1000.0, no_bus_per_hour);
+    log_stats("Load per departure (%d departures): %.1f/%.1f seats (%.0f%%, %.1f empty), %.1f/%.1f bikes",
+              departures, trip_seats, trip_capacity, 100.0 * trip_seats / trip_capacity,
+              trip_capacity - trip_seats, trip_bikes, trip_racks);
+    print_fleet_stats(shm, elapsed, 1);
     if (on_bus > 0) {
         log_stats("Still on buses: %d", on_bus);
     }
+    print_wait_stats(shm, 1);
+    print_memory_stats(shm, 1);
     log_stats("Consistency: created=%d, transported+waiting+in_office+on_bus+left_early=%d", created, sum);
     log_stats("======================================");
     log_dispatcher(LOG_INFO, "Final statistics written to stats.log");
@@ -423,6 +657,7 @@ int main(void) {
     }
     
     init_shared_state(shm);
+    ipc_mem_init(MEM_ROLE_DISPATCHER);
     
     log_dispatcher(LOG_INFO, "Dispatcher started and IPC resources created");
     log_dispatcher(LOG_INFO, "DISPATCHER_PID=%d - Send SIGUSR1 for early departure, SIGUSR2 to CLOSE station (end simulation)", getpid());
@@ -478,17 +713,19 @@ int main(void) {
     // Shutdown sequence
     log_dispatcher(LOG_INFO, "Dispatcher shutting down...");
     if (sem_lock(SEM_SHM_MUTEX) == 0) {
+        for (int i = 0; i < MAX_BUSES; i++) {
+            sem_lock(SEM_BUS_MUTEX(i));
+        }
         shm->simulation_running = false;
         /* If any passengers are still recorded as being on buses, count them as
          * transported before final statistics. This covers edge cases where a
          * bus was mid-cycle when shutdown was triggered (e.g. perf mode). */
         int on_bus_total = 0;
         for (int i = 0; i < MAX_BUSES; i++) {
-            int on_bus = shm->buses[i].passenger_count;
+            int on_bus = occupancy_take_seats(&shm->buses[i].occupancy);
             if (on_bus > 0) {
                 shm->passengers_transported += on_bus;
                 on_bus_total += on_bus;
-                shm->buses[i].passenger_count = 0;
             }
         }
         if (on_bus_total > 0) {
@@ -496,7 +733,11 @@ int main(void) {
                            "Dispatcher: accounting %d passengers still on buses as transported at shutdown",
                            on_bus_total);
         }
+        for (int i = MAX_BUSES - 1; i >= 0; i--) {
+            sem_unlock(SEM_BUS_MUTEX(i));
+        }
         sem_unlock(SEM_SHM_MUTEX);
+        shm_bus_notify();
     }
     log_dispatcher(LOG_INFO, "Waiting for processes to exit gracefully...");
     sleep(2);
@@ -9,10 +9,20 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/msg.h>
+
+#define IDLE_WAIT_MS       1000  /* Longest sleep of a bus that is not boarding */
+#define SOCK_IDLE_WAIT_MS  200   /* ...with sockets, which must turn away stray requests */
+
+_Static_assert(BOARDING_BATCH <= SOCK_BATCH, "a boarding batch is one recvmmsg()");
+
 static volatile sig_atomic_t g_running = 1;
 static volatile sig_atomic_t g_early_departure = 0;
 static int g_bus_id = 0;
+static occ_capacity_t g_capacity;           /* Seats and bike places of our vehicle (--fleet) */
+static int g_board_batch = BOARDING_BATCH;  /* Requests decided per wakeup, --board_batch */
+static int g_board_pack = 1;                /* Pack the batch into the bus, 0 = --board_policy=fifo */
 
 static void handle_shutdown(int sig) {
     (void)sig;
@@ -38,59 +48,66 @@ static void setup_signals(void) {
     if (sigaction(SIGUSR1, &sa, NULL) == -1) perror("sigaction SIGUSR1");
 }
 
-static int can_board(shm_data_t *shm, const boarding_msg_t *request, char *reason) {
+/* DENY_NONE if the passenger may try for a seat, otherwise why not. No
+ * lock: the flags are advisory, the occupancy CAS has the final word. */
+static deny_code_t boarding_precheck(shm_data_t *shm, const boarding_msg_t *request) {
     bus_state_t *bus = &shm->buses[g_bus_id];
-    const passenger_info_t *p = &request->passenger;
+    const wire_passenger_t *p = &request->passenger;
     
     /* Check if passenger has valid ticket */
-    if (!p->has_ticket && !p->is_vip) {
-        snprintf(reason, 64, "No valid ticket");
-        return 0;
+    if (!(p->flags & (PASSENGER_TICKET | PASSENGER_VIP))) {
+        return DENY_NO_TICKET;
     }
     
-    /* Check if boarding is allowed */
-    if (!shm->boarding_allowed) {
-        snprintf(reason, 64, "Boarding blocked by dispatcher");
-        return 0;
+    /* Check if boarding is allowed (station flag, read without the station lock) */
+    if (!SHM_READ(shm->boarding_allowed)) {
+        return DENY_BOARDING_BLOCKED;
     }
     
     /* Check if bus is at station */
-    if (!bus->at_station) {
-        snprintf(reason, 64, "Bus not at station");
-        return 0;
+    if (!SHM_READ(bus->at_station)) {
+        return DENY_NOT_AT_STATION;
     }
     
-    /* Check if boarding is open for this bus */
-    if (!bus->boarding_open) {
-        snprintf(reason, 64, "Bus boarding not open");
-        return 0;
+    /* Only buses at a bay board. With sockets a request is addressed to a
+     * bus and can reach one that is not; a shared queue is only read at a bay */
+    if (ipc_get_transport() == IPC_TRANSPORT_SOCK && shm_bay_of(shm, g_bus_id) < 0) {
+        return DENY_NOT_ACTIVE;
     }
     
-    /* Check passenger capacity - need room for seat_count seats
-     * (1 for adult alone, 2 for adult with child) */
-    int seats_needed = p->seat_count > 0 ? p->seat_count : 1;
-    if (bus->passenger_count + seats_needed > BUS_CAPACITY) {
-        snprintf(reason, 64, "Not enough seats (%d needed, %d available)", 
-                 seats_needed, BUS_CAPACITY - bus->passenger_count);
-        return 0;
+    /* Check if boarding is open for this bus */
+    if (!SHM_READ(bus->boarding_open)) {
+        return DENY_BOARDING_CLOSED;
     }
     
-    /* Check bicycle capacity if passenger has bike */
-    if (p->has_bike && bus->bike_count >= BIKE_CAPACITY) {
-        snprintf(reason, 64, "Bus at bicycle capacity (%d/%d)", 
-                 bus->bike_count, BIKE_CAPACITY);
-        return 0;
+    return DENY_NONE;
+}
+
+/* Reply for a refused reservation, with the numbers for the capacity codes
+ * taken from the occupancy once the whole batch is in */
+static deny_code_t reservation_deny(occ_result_t result, uint32_t word,
+                                    const occ_request_t *wanted, boarding_msg_t *response) {
+    switch (result) {
+        case OCC_RESERVED:
+            return DENY_NONE;
+        case OCC_FULL:
+            response->deny_arg[0] = wanted->seats;
+            response->deny_arg[1] = (uint16_t)(g_capacity.seats - OCC_SEATS(word));
+            return DENY_NO_SEATS;
+        case OCC_NO_BIKE_SPACE:
+            response->deny_arg[0] = (uint16_t)OCC_BIKES(word);
+            response->deny_arg[1] = g_capacity.bikes;
+            return DENY_BIKE_CAPACITY;
+        case OCC_IS_CLOSED:
+        default:
+            return DENY_BOARDING_CLOSED;
     }
-    
-    
-    reason[0] = '\0';
-    return 1;
 }
 
 /* Validate boarding request message */
 static int validate_boarding_request(const boarding_msg_t *request) {
-    /* Check mtype is valid boarding request */
-    if (request->mtype != MSG_BOARD_REQUEST && request->mtype != MSG_BOARD_REQUEST_VIP) {
+    /* Check mtype is the boarding request type of the passenger's class (or booked bus) */
+    if (request->mtype != boarding_msg_type(&request->passenger, request->bus_id)) {
         log_driver(LOG_ERROR, "Bus %d: Invalid message type %ld", g_bus_id, request->mtype);
         return 0;
     }
@@ -118,110 +135,495 @@ static int validate_boarding_request(const boarding_msg_t *request) {
     return 1;
 }
 
-static void process_boarding_request(shm_data_t *shm, boarding_msg_t *request) {
-    boarding_msg_t response;
-    memset(&response, 0, sizeof(response));
+/*
+ * Boarding pipeline. The main loop is the admission stage: it checks and
+ * reserves seats for a batch of requests and answers the refused ones. The
+ * admitted ones are queued to their entrance, where one worker thread per
+ * door walks them in and sends the approval - so a cyclist and a walk-on
+ * passenger enter at the same time, and the next requests are decided while
+ * the previous passenger is still in the door. Every queued passenger counts
+ * as entering in the occupancy word, so close_doors() waits for both doors.
+ */
+typedef struct {
+    pthread_t thread;
+    int entrance_sem;                   /* SEM_ENTRANCE_PASSENGER/_BIKE of this bus */
+    const char *name;
+    boarding_msg_t queue[MAX_BUS_CAPACITY]; /* Approved replies; each holds a seat, so it never overflows */
+    int head;
+    int count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} door_t;
+
+static door_t g_doors[2] = {           /* Indexed by "has a bike" */
+    { .name = "passenger",
+      .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER },
+    { .name = "bike",
+      .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER },
+};
+static int g_doors_stop = 0;            /* Under each door's mutex */
+
+/* One passenger through the door: the entrance is theirs while they walk in */
+static void walk_in(shm_data_t *shm, door_t *door, boarding_msg_t *reply) {
+    bus_state_t *bus = &shm->buses[g_bus_id];
+    int seats = reply->passenger.seat_count;
+    int have_door = (sem_lock(door->entrance_sem) == 0);
+    
+    if (!log_is_perf_mode() && g_running) {
+        /* Walking in takes a while; the occupancy word counts the
+         * passenger as entering until then, which holds off departure.
+         * On shutdown whoever is queued just steps in. */
+        usleep(seats * 300000);
+    }
+    occupancy_entered(&bus->occupancy, seats);
+    /* Out of the station's waiting count in the same step that seats them,
+     * so the passenger balance holds even if they never read the reply */
+    stat_add(&shm->stats, STAT_WAITING, -seats);
+    atomic_fetch_add_explicit(&bus->boarded_people, seats, memory_order_relaxed);
+    if (reply->passenger.flags & PASSENGER_VIP) {
+        atomic_fetch_add_explicit(&bus->boarded_vip_people, seats, memory_order_relaxed);
+    }
+    uint32_t word = atomic_load(&bus->occupancy);
+    int current_count = OCC_SEATS(word);
+    int current_bikes = OCC_BIKES(word);
+    if (have_door) {
+        sem_unlock(door->entrance_sem);
+    }
     
-    /* Set response mtype to passenger's PID */
-    response.mtype = request->passenger.pid;
-    response.passenger = request->passenger;
-    response.bus_id = g_bus_id;
+    if (msg_send_boarding_resp(reply) == -1) {
+        log_driver(LOG_ERROR, "Bus %d: Failed to send boarding approval to PID %d",
+                  g_bus_id, reply->passenger.pid);
+    }
+    char places[48];
+    boarding_places_text(reply, places, sizeof(places));
+    if (reply->passenger.flags & PASSENGER_VIP) {
+        log_driver(LOG_INFO, "Bus %d: VIP PID %d priority boarded, %s (Total: %d/%d)",
+                  g_bus_id, reply->passenger.pid, places, current_count, g_capacity.seats);
+    } else if (reply->passenger.flags & PASSENGER_CHILD_WITH) {
+        log_driver(LOG_INFO, "Bus %d: Adult PID %d + child boarded (%d seats), %s (Total: %d/%d, Bikes: %d/%d)",
+                  g_bus_id, reply->passenger.pid, seats, places,
+                  current_count, g_capacity.seats, current_bikes, g_capacity.bikes);
+    } else {
+        log_driver(LOG_INFO, "Bus %d: Passenger PID %d boarded through the %s door, %s (Total: %d/%d, Bikes: %d/%d)",
+                  g_bus_id, reply->passenger.pid, door->name, places,
+                  current_count, g_capacity.seats, current_bikes, g_capacity.bikes);
+    }
+}
+
+static void *door_worker(void *arg) {
+    door_t *door = arg;
+    shm_data_t *shm = ipc_get_shm();
     
-    int seats = request->passenger.seat_count > 0 ? request->passenger.seat_count : 1;
-    sem_lock(SEM_SHM_MUTEX);
-    if (can_board(shm, request, response.reason)) {
-        response.approved = true;
+    pthread_mutex_lock(&door->mutex);
+    while (1) {
+        while (door->count == 0 && !g_doors_stop) {
+            pthread_cond_wait(&door->cond, &door->mutex);
+        }
+        if (door->count == 0) {
+            break;  /* Stopping, and everyone admitted is in */
+        }
+        boarding_msg_t reply = door->queue[door->head];
+        door->head = (door->head + 1) % MAX_BUS_CAPACITY;
+        door->count--;
+        pthread_mutex_unlock(&door->mutex);
         
-        shm->buses[g_bus_id].entering_count++;
-        sem_unlock(SEM_SHM_MUTEX);
-        int entrance_sem = request->passenger.has_bike ? 
-                          SEM_ENTRANCE_BIKE : SEM_ENTRANCE_PASSENGER;
-        sem_lock(entrance_sem);
+        walk_in(shm, door, &reply);
         
-        if (!log_is_perf_mode()) {
-            usleep(seats * 300000);
+        pthread_mutex_lock(&door->mutex);
+    }
+    pthread_mutex_unlock(&door->mutex);
+    return NULL;
+}
+
+static void door_enqueue(door_t *door, const boarding_msg_t *reply) {
+    pthread_mutex_lock(&door->mutex);
+    door->queue[(door->head + door->count) % MAX_BUS_CAPACITY] = *reply;
+    door->count++;
+    pthread_cond_signal(&door->cond);
+    pthread_mutex_unlock(&door->mutex);
+}
+
+/* Door workers take no signals: SIGUSR1, SIGALRM and shutdown go to the main loop */
+static int doors_start(void) {
+    g_doors[0].entrance_sem = SEM_ENTRANCE_PASSENGER(g_bus_id);
+    g_doors[1].entrance_sem = SEM_ENTRANCE_BIKE(g_bus_id);
+    
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int started = 0;
+    for (; started < 2; started++) {
+        if (pthread_create(&g_doors[started].thread, NULL, door_worker, &g_doors[started]) != 0) {
+            break;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return started == 2 ? 0 : -1;
+}
+
+/* Let the doors finish whoever is still walking in, then join them */
+static void doors_stop(void) {
+    for (int d = 0; d < 2; d++) {
+        pthread_mutex_lock(&g_doors[d].mutex);
+        g_doors_stop = 1;
+        pthread_cond_signal(&g_doors[d].cond);
+        pthread_mutex_unlock(&g_doors[d].mutex);
+    }
+    for (int d = 0; d < 2; d++) {
+        pthread_join(g_doors[d].thread, NULL);
+    }
+}
+
+/* Reply to `request` from this bus, a denial with `deny` until changed */
+static void make_reply(boarding_msg_t *reply, const boarding_msg_t *request, deny_code_t deny) {
+    memset(reply, 0, sizeof(*reply));
+    reply->mtype = request->passenger.pid;  /* Response queue: addressed by PID */
+    reply->reply_slot = request->reply_slot;
+    reply->request_id = request->request_id;
+    reply->passenger = request->passenger;
+    reply->bus_id = (uint8_t)g_bus_id;
+    reply->deny = (uint8_t)deny;
+    reply->reply = MSG_BOARD_DENIED;
+}
+
+/* Refusals that only mean "not this bus, not now" */
+static int deny_defers(int deny) {
+    switch (deny) {
+        case DENY_NO_SEATS:
+        case DENY_BIKE_CAPACITY:
+        case DENY_NOT_ACTIVE:
+        case DENY_NOT_AT_STATION:
+        case DENY_BOARDING_CLOSED:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Another bus boarding at a bay right now - with `room` only one with
+ * the seats and bike place `request` needs - or -1 */
+static int other_boarding_bus(shm_data_t *shm, const boarding_msg_t *request, int room) {
+    int seats = request->passenger.seat_count;
+    int bike = (request->passenger.flags & PASSENGER_BIKE) != 0;
+    for (int b = 0; b < shm->bays; b++) {
+        int bus = SHM_READ(shm->bay_bus[b]);
+        if (bus < 0 || bus == g_bus_id ||
+            !SHM_READ(shm->buses[bus].at_station) || !SHM_READ(shm->buses[bus].boarding_open)) {
+            continue;
         }
-        sem_lock(SEM_SHM_MUTEX);
-        shm->buses[g_bus_id].passenger_count += seats;  /* Count all seats */
-        if (request->passenger.has_bike) {
-            shm->buses[g_bus_id].bike_count++;
+        uint32_t word = atomic_load(&shm->buses[bus].occupancy);
+        occ_capacity_t cap = shm->buses[bus].model.capacity;
+        if (room && ((word & (OCC_CLOSED | OCC_CLOSING)) || OCC_SEATS(word) + seats > cap.seats ||
+                     (bike && OCC_BIKES(word) >= cap.bikes))) {
+            continue;
         }
-        shm->buses[g_bus_id].entering_count--;
-        shm->passengers_waiting -= seats;
-        if (shm->passengers_waiting < 0) {
-            shm->passengers_waiting = 0;
+        return bus;
+    }
+    return -1;
+}
+
+/* Add requests to the park list, oldest first, as far as it has room and
+ * the simulation runs; returns how many */
+static int park_requests(shm_data_t *shm, const boarding_msg_t *requests, int n) {
+    park_list_t *list = &shm->parked;
+    int parked = 0;
+    sem_lock(SEM_SHM_MUTEX);
+    while (parked < n && list->count < PARKED_MAX && shm->simulation_running) {
+        boarding_msg_t *slot = &list->requests[list->count++];
+        *slot = requests[parked++];
+        if (slot->attempts < UINT8_MAX) {
+            slot->attempts++;  /* Counts as a try, for aging */
         }
-        shm->boarded_people += seats;
-        if (request->passenger.is_vip) {
-            shm->boarded_vip_people += seats;
+    }
+    int waiting = list->count;
+    sem_unlock(SEM_SHM_MUTEX);
+    if (parked > 0) {
+        log_driver(LOG_INFO, "Bus %d: Parked %d passenger(s) for the next bus (%d parked)",
+                  g_bus_id, parked, waiting);
+    }
+    return parked;
+}
+
+/* Send final replies (the passengers give their queue slots back) */
+static void deny_requests(boarding_msg_t *replies, int n) {
+    for (int r = 0; r < n; r++) {
+        char reason[64];
+        log_driver(LOG_WARN, "Bus %d: Boarding denied for PID %d - %s",
+                  g_bus_id, replies[r].passenger.pid,
+                  boarding_deny_text(&replies[r], reason, sizeof(reason)));
+    }
+    if (n > 0 && msg_send_boarding_resp_batch(replies, n) == -1) {
+        log_driver(LOG_ERROR, "Bus %d: Failed to send %d boarding response(s)", g_bus_id, n);
+    }
+}
+
+/*
+ * Answer the requests this bus refused; replies[i] (from make_reply) goes
+ * with requests[i], n <= SOCK_BATCH. A passenger only turned away by this
+ * bus (deny_defers) is not sent off to ask again: the request goes on to
+ * another bus boarding now that has room for it, on every transport (on a
+ * shared queue it is requeued, and a full bus only takes what fits) - or
+ * else is parked with a MSG_BOARD_WAIT reply until a bus opens boarding
+ * (release_parked). The passenger holds its queue slot until the final
+ * reply either way.
+ */
+static void refuse_requests(shm_data_t *shm, const boarding_msg_t *requests,
+                            boarding_msg_t *replies, int n) {
+    int running = SHM_READ(shm->simulation_running);
+    boarding_msg_t parking[SOCK_BATCH];
+    boarding_msg_t waits[SOCK_BATCH];
+    int nwaits = 0;
+    int ndenied = 0;
+    for (int i = 0; i < n; i++) {
+        boarding_msg_t reply = replies[i];
+        if (running && deny_defers(reply.deny)) {
+            /* A booked seat is on this bus: it only waits for our next trip */
+            int booked = (requests[i].passenger.flags & PASSENGER_BOOKED) != 0;
+            int to = !booked ? other_boarding_bus(shm, &requests[i], 1) : -1;
+            if (to >= 0) {
+                boarding_msg_t forward = requests[i];
+                forward.bus_id = (uint8_t)to;
+                if (msg_requeue_boarding(&forward) == 0) {
+                    log_driver(LOG_INFO, "Bus %d: PID %d passed on to bus %d",
+                              g_bus_id, reply.passenger.pid, to);
+                    continue;
+                }
+            }
+            reply.reply = MSG_BOARD_WAIT;
+            parking[nwaits] = requests[i];
+            waits[nwaits++] = reply;
+            continue;
         }
-        int current_count = shm->buses[g_bus_id].passenger_count;
-        int current_bikes = shm->buses[g_bus_id].bike_count;
-        sem_unlock(SEM_SHM_MUTEX);
-        
-        /* Release entrance */
-        sem_unlock(entrance_sem);
-        if (request->passenger.is_vip) {
-            log_driver(LOG_INFO, "Bus %d: VIP PID %d priority boarded (Total: %d/%d)",
-                      g_bus_id, request->passenger.pid, current_count, BUS_CAPACITY);
-        } else if (request->passenger.has_child_with) {
-            log_driver(LOG_INFO, "Bus %d: Adult PID %d + child boarded (%d seats) (Total: %d/%d, Bikes: %d/%d)",
-                      g_bus_id, request->passenger.pid, seats,
-                      current_count, BUS_CAPACITY, current_bikes, BIKE_CAPACITY);
-        } else {
-            log_driver(LOG_INFO, "Bus %d: Passenger PID %d boarded (Total: %d/%d, Bikes: %d/%d)",
-                      g_bus_id, request->passenger.pid,
-                      current_count, BUS_CAPACITY, current_bikes, BIKE_CAPACITY);
+        replies[ndenied++] = reply;
+    }
+    /* The wait reply goes out before the request can be released, so the
+     * final one always comes after it */
+    if (nwaits > 0 && msg_send_boarding_resp_batch(waits, nwaits) == -1) {
+        log_driver(LOG_ERROR, "Bus %d: Failed to send %d wait response(s)", g_bus_id, nwaits);
+    }
+    for (int w = park_requests(shm, parking, nwaits); w < nwaits; w++) {
+        replies[ndenied] = waits[w];  /* Park list full or shutting down */
+        replies[ndenied++].reply = MSG_BOARD_DENIED;
+    }
+    deny_requests(replies, ndenied);
+}
+
+/* This bus has just started boarding: every parked request goes back in
+ * front of it, oldest first, in one go (sockets: to our own socket) - a
+ * booked one to the queue of its own bus. With `deny` set (shutdown) they
+ * get that final reply instead. */
+static void release_parked(shm_data_t *shm, deny_code_t deny) {
+    boarding_msg_t parked[PARKED_MAX];
+    sem_lock(SEM_SHM_MUTEX);
+    int n = shm->parked.count;
+    memcpy(parked, shm->parked.requests, (size_t)n * sizeof(boarding_msg_t));
+    shm->parked.count = 0;
+    sem_unlock(SEM_SHM_MUTEX);
+    
+    boarding_msg_t replies[PARKED_MAX];
+    int ndenied = 0;
+    for (int i = 0; i < n; i++) {
+        if (!(parked[i].passenger.flags & PASSENGER_BOOKED)) {
+            parked[i].bus_id = (uint8_t)g_bus_id;
+        }
+        if (deny == DENY_NONE && msg_requeue_boarding(&parked[i]) == 0) {
+            continue;
         }
+        make_reply(&replies[ndenied++], &parked[i], deny != DENY_NONE ? deny : DENY_NOT_ACTIVE);
+    }
+    if (n > ndenied) {
+        log_driver(LOG_INFO, "Bus %d: Boarding open, released %d parked passenger(s)",
+                  g_bus_id, n - ndenied);
+    }
+    deny_requests(replies, ndenied);
+}
+
+/* Number the seats and rack place of an admitted request on the bus' maps.
+ * A family gets a whole row while there is one. The occupancy word already
+ * holds the places, so a full map only happens when the shutdown sweep
+ * emptied the word under a bus still boarding: the place stays unnumbered. */
+static void assign_places(shm_data_t *shm, boarding_msg_t *response) {
+    seat_map_t *seats = &shm->seat_maps[g_bus_id];
+    int count = response->passenger.seat_count;
+    int first = count == 2 ? seatmap_take_pair(seats) : -1;
+    
+    if (first >= 0) {
+        response->seat[0] = (uint16_t)(first + 1);
+        response->seat[1] = (uint16_t)(first + 2);
     } else {
-        response.approved = false;
-        sem_unlock(SEM_SHM_MUTEX);
-        
-        log_driver(LOG_WARN, "Bus %d: Boarding denied for PID %d - %s",
-                  g_bus_id, request->passenger.pid, response.reason);
+        for (int k = 0; k < count && k < 2; k++) {
+            response->seat[k] = (uint16_t)(seatmap_take(seats) + 1);
+        }
+    }
+    if (response->passenger.flags & PASSENGER_BIKE) {
+        response->rack = (uint8_t)(seatmap_take(&shm->rack_maps[g_bus_id]) + 1);
     }
-    if (msg_send_boarding_resp(&response) == -1) {
-        log_driver(LOG_ERROR, "Bus %d: Failed to send boarding response to PID %d",
-                  g_bus_id, request->passenger.pid);
+    if (response->seat[0] == 0 || (count == 2 && response->seat[1] == 0)) {
+        log_driver(LOG_WARN, "Bus %d: No free seat on the map for PID %d",
+                  g_bus_id, response->passenger.pid);
+    } else if (count == 2 && first < 0) {
+        log_driver(LOG_INFO, "Bus %d: No free row for PID %d + child, seated apart (%d, %d)",
+                  g_bus_id, response->passenger.pid, response->seat[0], response->seat[1]);
     }
 }
 
-static void wait_for_entrance_clear(shm_data_t *shm) {
-    int entering;
-    do {
-        sem_lock(SEM_SHM_MUTEX);
-        entering = shm->buses[g_bus_id].entering_count;
-        sem_unlock(SEM_SHM_MUTEX);
-        
-        if (entering > 0) {
-            log_driver(LOG_INFO, "Bus %d: Waiting for %d passengers to finish entering",
-                      g_bus_id, entering);
-            if (!log_is_perf_mode()) {
-                usleep(100000);
+/* Admission stage for a batch of requests: after the flag checks the seats
+ * and bike places of all of them are reserved with one occupancy CAS and
+ * the admitted ones are handed to their door. VIPs and passengers who have
+ * tried BOARDING_AGING times go first; the rest are packed to fill the
+ * seats and bike racks left (arrival order with --board_policy=fifo). The
+ * refused ones are answered together by refuse_requests(). */
+static void process_boarding_batch(shm_data_t *shm, const boarding_msg_t *requests, int count) {
+    bus_state_t *bus = &shm->buses[g_bus_id];
+    boarding_msg_t decided[BOARDING_BATCH];
+    occ_request_t wanted[BOARDING_BATCH];
+    occ_request_t packed[BOARDING_BATCH];
+    occ_result_t result[BOARDING_BATCH];
+    int candidate[BOARDING_BATCH];  /* Requests that passed the flag checks */
+    int order[BOARDING_BATCH];      /* Candidates in the order they are reserved */
+    int source[BOARDING_BATCH];     /* Request each decision answers */
+    int ndecided = 0;
+    int ncandidates = 0;
+    
+    for (int i = 0; i < count && i < BOARDING_BATCH; i++) {
+        const boarding_msg_t *request = &requests[i];
+        if (!validate_boarding_request(request)) {
+            log_driver(LOG_WARN, "Bus %d: Discarding invalid boarding request", g_bus_id);
+            continue;
+        }
+        boarding_msg_t *response = &decided[ndecided];
+        make_reply(response, request, boarding_precheck(shm, request));
+        source[ndecided] = i;
+        if (response->deny == DENY_NONE) {
+            wanted[ncandidates].seats = (uint8_t)request->passenger.seat_count;
+            wanted[ncandidates].bike = (request->passenger.flags & PASSENGER_BIKE) != 0;
+            wanted[ncandidates].first = (request->passenger.flags & PASSENGER_VIP) ||
+                                        request->attempts >= BOARDING_AGING;
+            candidate[ncandidates++] = ndecided;
+        }
+        ndecided++;
+    }
+    
+    uint32_t word = atomic_load(&bus->occupancy);
+    for (int c = 0; c < ncandidates; c++) {
+        order[c] = c;
+    }
+    if (g_board_pack && ncandidates > 1) {
+        /* Only this driver reserves on its bus, so the plan holds for the CAS */
+        occupancy_pack(word, g_capacity, wanted, ncandidates, order);
+    }
+    for (int c = 0; c < ncandidates; c++) {
+        packed[c] = wanted[order[c]];
+    }
+    int admitted = ncandidates > 0 ?
+                   occupancy_reserve_many(&bus->occupancy, g_capacity, packed, ncandidates,
+                                          result, &word) : 0;
+    for (int c = 0; c < ncandidates; c++) {
+        boarding_msg_t *response = &decided[candidate[order[c]]];
+        response->deny = (uint8_t)reservation_deny(result[c], word, &packed[c], response);
+        if (response->deny == DENY_NONE) {
+            response->approved = true;
+            response->reply = MSG_BOARD_GRANTED;
+            if (response->passenger.flags & PASSENGER_BOOKED) {
+                /* In the occupancy now, so off the ledger (see occupancy_book) */
+                shm_unbook_seat(g_bus_id, &response->passenger);
             }
+            assign_places(shm, response);
+            door_enqueue(&g_doors[packed[c].bike], response);
         }
-    } while (entering > 0 && g_running);
+    }
+    
+    /* Admitted passengers get their approval and give their slot back with the door */
+    boarding_msg_t refused_requests[BOARDING_BATCH];
+    boarding_msg_t refused[BOARDING_BATCH];
+    int nrefused = 0;
+    for (int r = 0; r < ndecided; r++) {
+        if (!decided[r].approved) {
+            refused_requests[nrefused] = requests[source[r]];
+            refused[nrefused++] = decided[r];
+        }
+    }
+    refuse_requests(shm, refused_requests, refused, nrefused);
+    if (ndecided > 1) {
+        log_driver(LOG_INFO, "Bus %d: Boarding batch of %d requests, %d admitted (Total: %d/%d, Bikes: %d/%d)",
+                  g_bus_id, ndecided, admitted, OCC_SEATS(word), g_capacity.seats,
+                  OCC_BIKES(word), g_capacity.bikes);
+    }
+}
+
+/* Close the doors: the CAS only succeeds with nobody entering, and from then
+ * on every reservation is refused. Otherwise sleep until the last one in
+ * wakes us. Only our own door workers can be entering, so this ends even on
+ * shutdown (they stop walking slowly then). Returns the final occupancy. */
+static uint32_t close_doors(shm_data_t *shm) {
+    struct timespec slice = { 0, 100000000L };
+    uint32_t word;
+    while (!occupancy_close_wait(&shm->buses[g_bus_id].occupancy, &slice, &word)) {
+        log_driver(LOG_INFO, "Bus %d: Waiting for passengers to finish entering (%d seats)",
+                  g_bus_id, OCC_ENTERING(word));
+    }
+    return word;
+}
+
+/* Claim a bay that is free or whose bus is away (we are here first, even
+ * if it was reserved for another); SEM_SHM_MUTEX held. Returns the bay, or
+ * -1 if they are all boarding. */
+static int take_free_bay(shm_data_t *shm) {
+    if (shm_bay_of(shm, g_bus_id) >= 0) {
+        return -1;
+    }
+    for (int b = 0; b < shm->bays; b++) {
+        int bus = shm->bay_bus[b];
+        /* Other buses' locks may rank below ours: peek at their flag instead */
+        if (bus < 0 || !SHM_READ(shm->buses[bus].at_station)) {
+            shm->bay_bus[b] = g_bus_id;
+            return b;
+        }
+    }
+    return -1;
 }
 
 static void depart_bus(shm_data_t *shm) {
     bus_state_t *bus = &shm->buses[g_bus_id];
-    wait_for_entrance_clear(shm);
+    uint32_t occupancy = close_doors(shm);
     
     sem_lock(SEM_SHM_MUTEX);
+    sem_lock(SEM_BUS_MUTEX(g_bus_id));
     bus->boarding_open = false;
     bus->at_station = false;
-    int return_delay = MIN_RETURN_TIME + rand() % (MAX_RETURN_TIME - MIN_RETURN_TIME + 1);
+    int return_delay = bus->model.min_return + rand() % (bus->model.max_return - bus->model.min_return + 1);
     bus->return_time = time(NULL) + return_delay;
-    
-    int passengers = bus->passenger_count;
-    int bikes = bus->bike_count;
+    shm_bays_changed();
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    long late_ms = (long)(now.tv_sec - bus->departure_time) * 1000L + now.tv_nsec / 1000000L;
+    
+    /* Doors closed: the maps are final for this trip */
+    char seat_map[2 * SEATMAP_MAX_WORDS * 64];
+    char rack_map[2 * SEATMAP_MAX_WORDS * 64];
+    seatmap_format(&shm->seat_maps[g_bus_id], seat_map, sizeof(seat_map));
+    seatmap_format(&shm->rack_maps[g_bus_id], rack_map, sizeof(rack_map));
+    seatmap_clear(&shm->seat_maps[g_bus_id]);
+    seatmap_clear(&shm->rack_maps[g_bus_id]);
+    
+    int bikes = OCC_BIKES(occupancy);
+    /* Counted as transported now, so off the "on bus" books (unless the
+     * dispatcher's shutdown sweep got them first); the closed bit stays
+     * until we are back */
+    int passengers = occupancy_take_seats(&bus->occupancy);
     shm->passengers_transported += passengers;
+    atomic_fetch_add(&bus->departures, 1);
+    atomic_fetch_add(&bus->departed_seats, passengers);
+    atomic_fetch_add(&bus->departed_bikes, bikes);
     int transported_after = shm->passengers_transported;
     
+    sem_unlock(SEM_BUS_MUTEX(g_bus_id));
     sem_unlock(SEM_SHM_MUTEX);
+    shm_bus_notify();
     
-    log_driver(LOG_INFO, "Bus %d: DEPARTED with %d passengers and %d bikes (return in %d seconds) - transported count now: %d",
-              g_bus_id, passengers, bikes, return_delay, transported_after);
+    log_driver(LOG_INFO, "Bus %d: DEPARTED with %d passengers and %d bikes (return in %d seconds, %+ld ms vs schedule) - transported count now: %d",
+              g_bus_id, passengers, bikes, return_delay, late_ms, transported_after);
+    log_driver(LOG_INFO, "Bus %d: Trip seats [%s] rack [%s]", g_bus_id, seat_map, rack_map);
     if (!log_is_perf_mode()) {
         sleep(return_delay);
     }
@@ -229,30 +631,35 @@ static void depart_bus(shm_data_t *shm) {
         usleep(10000);
     }
     sem_lock(SEM_SHM_MUTEX);
+    sem_lock(SEM_BUS_MUTEX(g_bus_id));
     bus->at_station = true;
-    bus->passenger_count = 0;
-    bus->bike_count = 0;
+    occupancy_reset(&bus->occupancy);
     bus->boarding_open = true;
     int boarding_interval = log_is_perf_mode() ? 1 : BOARDING_INTERVAL;
     bus->departure_time = time(NULL) + boarding_interval;
-    int current_active = shm->active_bus_id;
-    if (current_active < 0 || !shm->buses[current_active].at_station) {
-        shm->active_bus_id = g_bus_id;
-        log_driver(LOG_INFO, "Bus %d: Became active bus (previous active %d not at station)", 
-                  g_bus_id, current_active);
+    int bay = take_free_bay(shm);
+    if (bay >= 0) {
+        log_driver(LOG_INFO, "Bus %d: Became active bus at bay %d", g_bus_id, bay);
+    } else if ((bay = shm_bay_of(shm, g_bus_id)) >= 0) {
+        log_driver(LOG_INFO, "Bus %d: Boarding at reserved bay %d on arrival", g_bus_id, bay);
     }
+    shm_bays_changed();
+    sem_unlock(SEM_BUS_MUTEX(g_bus_id));
     sem_unlock(SEM_SHM_MUTEX);
+    shm_bus_notify();
     
     log_driver(LOG_INFO, "Bus %d: RETURNED to station, boarding open",
               g_bus_id);
+    if (bay >= 0) {
+        release_parked(shm, DENY_NONE);
+    }
 }
 
 static int check_shutdown(shm_data_t *shm) {
-    sem_lock(SEM_SHM_MUTEX);
-    int running = shm->simulation_running;
-    int waiting = shm->passengers_waiting;
-    int station_closed = shm->station_closed;
-    sem_unlock(SEM_SHM_MUTEX);
+    /* Polled once per request: read the station fields without the station lock */
+    int running = SHM_READ(shm->simulation_running);
+    int waiting = stat_sum(&shm->stats, STAT_WAITING);
+    int station_closed = SHM_READ(shm->station_closed);
     
     /* Don't shutdown if passengers are still waiting (even if station closed) */
     if (station_closed && waiting > 0) {
@@ -267,11 +674,11 @@ static int g_depart_when_full = 0;  /* Set by --full flag */
 static int should_depart(shm_data_t *shm) {
     time_t now = time(NULL);
     
-    sem_lock(SEM_SHM_MUTEX);
+    sem_lock(SEM_BUS_MUTEX(g_bus_id));
     time_t depart_time = shm->buses[g_bus_id].departure_time;
-    int passengers = shm->buses[g_bus_id].passenger_count;
-    int at_capacity = (passengers >= BUS_CAPACITY);
-    sem_unlock(SEM_SHM_MUTEX);
+    int passengers = occupancy_seats(&shm->buses[g_bus_id].occupancy);
+    int at_capacity = (passengers >= g_capacity.seats);
+    sem_unlock(SEM_BUS_MUTEX(g_bus_id));
     
     /* Optional: depart immediately when full (--full flag) */
     if (g_depart_when_full && at_capacity) {
@@ -302,6 +709,60 @@ static int should_depart(shm_data_t *shm) {
     return 0;
 }
 
+/* Answer every request waiting for us with `deny` (refuse_requests(): while
+ * the simulation runs they are passed on or parked). With sockets requests
+ * are addressed to a bus, so one that is not boarding has to answer
+ * whatever reached it; on shutdown it is the requests left on the shared
+ * queue for classes no bus had room for. Otherwise those passengers would
+ * wait forever. */
+static void turn_away_pending(shm_data_t *shm, deny_code_t deny) {
+    boarding_msg_t requests[SOCK_BATCH];
+    boarding_msg_t replies[SOCK_BATCH];
+    int received;
+    while ((received = msg_recv_boarding_batch(requests, SOCK_BATCH, MAX_BUS_CAPACITY, MAX_BIKE_CAPACITY,
+                                               IPC_NOWAIT, 0)) > 0) {
+        int valid = 0;
+        for (int i = 0; i < received; i++) {
+            if (!validate_boarding_request(&requests[i])) {
+                continue;
+            }
+            requests[valid] = requests[i];
+            make_reply(&replies[valid], &requests[valid], deny);
+            valid++;
+        }
+        refuse_requests(shm, requests, replies, valid);
+    }
+}
+
+/* Before departing: pass our bay on while our doors are still closing, so
+ * the next bus is boarding before we leave. It goes to a bus open at the
+ * station, else to the one due back soonest, which boards as it arrives. */
+static void hand_over_bay(shm_data_t *shm) {
+    sem_lock(SEM_SHM_MUTEX);
+    sem_lock(SEM_BUS_MUTEX(g_bus_id));
+    shm->buses[g_bus_id].boarding_open = false;  /* Leaving: not a candidate for any bay */
+    sem_unlock(SEM_BUS_MUTEX(g_bus_id));
+    int bay = shm_bay_of(shm, g_bus_id);
+    if (bay < 0) {
+        sem_unlock(SEM_SHM_MUTEX);  /* The watchdog gave it away */
+        return;
+    }
+    int next_bus = shm_next_bay_bus(g_bus_id);
+    shm->bay_bus[bay] = next_bus;
+    int standby = next_bus >= 0 && !SHM_READ(shm->buses[next_bus].at_station);
+    sem_unlock(SEM_SHM_MUTEX);
+    shm_bus_notify();
+    if (next_bus < 0) {
+        log_driver(LOG_INFO, "Bus %d: No other bus to take bay %d, bay empty", g_bus_id, bay);
+    } else if (standby) {
+        log_driver(LOG_INFO, "Bus %d: Bay %d reserved for bus %d, due back first", g_bus_id, bay, next_bus);
+    } else {
+        log_driver(LOG_INFO, "Bus %d: Handing bay %d to bus %d (%s, %d seats; %d waiting)",
+                  g_bus_id, bay, next_bus, shm->buses[next_bus].model.name,
+                  shm->buses[next_bus].model.capacity.seats, stat_sum(&shm->stats, STAT_WAITING));
+    }
+}
+
 int main(int argc, char *argv[]) {
     if (argc > 1) {
         g_bus_id = atoi(argv[1]);
@@ -316,6 +777,16 @@ int main(int argc, char *argv[]) {
         g_depart_when_full = 1;
     }
     
+    /* Boarding batch size (--board_batch=K, main checked the range) */
+    const char *board_batch = getenv("BUS_BOARD_BATCH");
+    if (board_batch && atoi(board_batch) >= 1 && atoi(board_batch) <= BOARDING_BATCH) {
+        g_board_batch = atoi(board_batch);
+    }
+    const char *board_policy = getenv("BUS_BOARD_POLICY");
+    if (board_policy && strcmp(board_policy, "fifo") == 0) {
+        g_board_pack = 0;
+    }
+    
     if (!is_minimal) {
         printf("[DRIVER %d] Starting (PID=%d)\n", g_bus_id, getpid());
         fflush(stdout);
@@ -335,37 +806,56 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "[DRIVER %d] Failed to get shared memory\n", g_bus_id);
         exit(EXIT_FAILURE);
     }
+    ipc_mem_init(MEM_ROLE_DRIVER);
     
+    /* Socket transport: passengers address boarding requests to this bus */
+    if (ipc_endpoint_open(IPC_ENDPOINT_BUS, g_bus_id) == -1) {
+        fprintf(stderr, "[DRIVER %d] Failed to open boarding socket\n", g_bus_id);
+        ipc_detach_all();
+        exit(EXIT_FAILURE);
+    }
+    
+    if (doors_start() == -1) {
+        fprintf(stderr, "[DRIVER %d] Failed to start door workers\n", g_bus_id);
+        ipc_detach_all();
+        exit(EXIT_FAILURE);
+    }
+    
+    g_capacity = shm->buses[g_bus_id].model.capacity;
     sem_lock(SEM_SHM_MUTEX);
+    sem_lock(SEM_BUS_MUTEX(g_bus_id));
     shm->driver_pids[g_bus_id] = getpid();
     shm->buses[g_bus_id].at_station = true;
     shm->buses[g_bus_id].boarding_open = true;
-    shm->buses[g_bus_id].passenger_count = 0;
-    shm->buses[g_bus_id].bike_count = 0;
-    shm->buses[g_bus_id].entering_count = 0;
+    occupancy_reset(&shm->buses[g_bus_id].occupancy);
+    seatmap_clear(&shm->seat_maps[g_bus_id]);
+    seatmap_clear(&shm->rack_maps[g_bus_id]);
     int boarding_interval = log_is_perf_mode() ? 1 : BOARDING_INTERVAL;
     shm->buses[g_bus_id].departure_time = time(NULL) + boarding_interval;
     
-    if (g_bus_id == 0) {
-        shm->active_bus_id = 0;
-    }
+    /* Buses 0..bays-1 start at the bays; take one if the watchdog freed it meanwhile */
+    take_free_bay(shm);
+    shm_bays_changed();
+    int was_active = (shm_bay_of(shm, g_bus_id) >= 0);
+    sem_unlock(SEM_BUS_MUTEX(g_bus_id));
     sem_unlock(SEM_SHM_MUTEX);
-    log_driver(LOG_INFO, "Bus %d driver started (PID=%d)", g_bus_id, getpid());
-    
-    int was_active = (g_bus_id == 0);  /* Only bus 0 starts active */
+    log_driver(LOG_INFO, "Bus %d driver started (PID=%d, %s: %d seats, %d bikes)",
+              g_bus_id, getpid(), shm->buses[g_bus_id].model.name, g_capacity.seats, g_capacity.bikes);
     
     while (g_running) {
+        ipc_mem_tick();
+        /* Taken before looking at any state, so a change after this is not slept through */
+        uint32_t events = shm_bus_events();
         if (check_shutdown(shm)) {
             /* Before shutting down, if this bus still has passengers on board or entering,
              * perform one final departure so they are counted in passengers_transported. */
             int passengers = 0;
             int entering = 0;
             int at_station = 0;
-            sem_lock(SEM_SHM_MUTEX);
-            passengers = shm->buses[g_bus_id].passenger_count;
-            entering = shm->buses[g_bus_id].entering_count;
-            at_station = shm->buses[g_bus_id].at_station;
-            sem_unlock(SEM_SHM_MUTEX);
+            uint32_t occupancy = atomic_load(&shm->buses[g_bus_id].occupancy);
+            passengers = OCC_SEATS(occupancy);
+            entering = OCC_ENTERING(occupancy);
+            at_station = SHM_READ(shm->buses[g_bus_id].at_station);
 
             if (at_station && (passengers > 0 || entering > 0)) {
                 log_driver(LOG_INFO,
@@ -374,91 +864,76 @@ int main(int argc, char *argv[]) {
                 depart_bus(shm);
             }
 
+            turn_away_pending(shm, DENY_BOARDING_CLOSED);
+            release_parked(shm, DENY_BOARDING_CLOSED);
             log_driver(LOG_INFO, "Bus %d: Shutdown detected", g_bus_id);
             break;
         }
-        sem_lock(SEM_SHM_MUTEX);
+        sem_lock(SEM_BUS_MUTEX(g_bus_id));
         int at_station = shm->buses[g_bus_id].at_station;
         int boarding_open = shm->buses[g_bus_id].boarding_open;
-        int am_active = (shm->active_bus_id == g_bus_id);
+        int am_active = (shm_bay_of(shm, g_bus_id) >= 0);
         
         /* Just became active, reset departure time */
+        int opened = 0;
         if (am_active && !was_active && at_station) {
+            opened = boarding_open;
             int boarding_interval = log_is_perf_mode() ? 1 : BOARDING_INTERVAL;
             shm->buses[g_bus_id].departure_time = time(NULL) + boarding_interval;
             log_driver(LOG_INFO, "Bus %d: Became active, departure in %d sec", 
                       g_bus_id, boarding_interval);
         }
         was_active = am_active;
-        sem_unlock(SEM_SHM_MUTEX);
+        time_t departure_time = shm->buses[g_bus_id].departure_time;
+        sem_unlock(SEM_BUS_MUTEX(g_bus_id));
+        if (opened) {
+            release_parked(shm, DENY_NONE);
+        }
         
-        /* Only the active bus receives passengers; others wait */
+        /* Only buses at a bay receive passengers; others sleep until a
+         * bay, boarding or run state changes. With --assign the requests
+         * reaching our socket are booked on us and wait for our turn. */
         if (!at_station || !boarding_open || !am_active) {
-            usleep(log_is_perf_mode() ? 10000 : 100000);
+            if (ipc_get_transport() == IPC_TRANSPORT_SOCK && !shm->assign_seats) {
+                turn_away_pending(shm, DENY_NOT_ACTIVE);
+                shm_bus_wait(events, SOCK_IDLE_WAIT_MS);
+            } else {
+                shm_bus_wait(events, IDLE_WAIT_MS);
+            }
             continue;
         }
         if (log_is_perf_mode() && should_depart(shm)) {
-            sem_lock(SEM_SHM_MUTEX);
-            int next_bus = -1;
-            for (int i = 0; i < MAX_BUSES; i++) {
-                int check_bus = (g_bus_id + 1 + i) % MAX_BUSES;
-                if (shm->buses[check_bus].at_station && check_bus != g_bus_id) {
-                    next_bus = check_bus;
-                    break;
-                }
-            }
-            
-            /* Only switch if we found a bus at station */
-            if (next_bus >= 0) {
-                shm->active_bus_id = next_bus;
-                sem_unlock(SEM_SHM_MUTEX);
-                log_driver(LOG_INFO, "Bus %d: Switching active bus to %d", g_bus_id, next_bus);
-            } else {
-                /* No other bus at station - set to -1 (will be set when next bus returns) */
-                shm->active_bus_id = -1;
-                sem_unlock(SEM_SHM_MUTEX);
-                log_driver(LOG_INFO, "Bus %d: No other bus at station, active_bus_id set to -1", g_bus_id);
-            }
+            hand_over_bay(shm);
             
             /* Depart */
             depart_bus(shm);
             continue;
         }
-        /* Receive boarding request - negative mtype receives lowest type first (VIP=1 before regular=2) */
-        boarding_msg_t request;
-        ssize_t ret = msg_recv_boarding(&request, -MSG_BOARD_REQUEST, 0);
-        if (ret > 0) {
-            /* Validate message before processing */
-            if (!validate_boarding_request(&request)) {
-                log_driver(LOG_WARN, "Bus %d: Discarding invalid boarding request", g_bus_id);
-                continue;
-            }
-            process_boarding_request(shm, &request);
-            /* Passenger unlocks SEM_BOARDING_QUEUE_SLOTS after receiving response */
+        /* Receive up to g_board_batch boarding requests, VIPs first - on the
+         * SysV queue only the classes there is still room for, mq by
+         * priority, sockets sorted. The wait ends at departure time, or after
+         * IDLE_WAIT_MS while there is nobody to depart with. */
+        uint32_t word = atomic_load(&shm->buses[g_bus_id].occupancy);
+        time_t wake_at = departure_time;
+        if (departure_time == 0 || OCC_SEATS(word) == 0) {
+            wake_at = time(NULL) + IDLE_WAIT_MS / 1000;
+        }
+        boarding_msg_t requests[BOARDING_BATCH];
+        int received = msg_recv_boarding_batch(requests, g_board_batch,
+                                               g_capacity.seats - OCC_SEATS(word),
+                                               g_capacity.bikes - OCC_BIKES(word), 0, wake_at);
+        if (received == 0) {
+            /* Full: leave the queue to the next bus and sleep until departure
+             * (SIGUSR1 or a bay change wakes us sooner) */
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            long left_ms = (long)(wake_at - now.tv_sec) * 1000L - now.tv_nsec / 1000000L;
+            shm_bus_wait(events, left_ms > 0 ? (int)left_ms : 0);
+        }
+        if (received > 0) {
+            process_boarding_batch(shm, requests, received);
             if (log_is_perf_mode() && should_depart(shm)) {
-                sem_lock(SEM_SHM_MUTEX);
-                int next_bus = -1;
-                
-                /* Find next available bus at station */
-                for (int i = 0; i < MAX_BUSES; i++) {
-                    int check_bus = (g_bus_id + 1 + i) % MAX_BUSES;
-                    if (shm->buses[check_bus].at_station && check_bus != g_bus_id) {
-                        next_bus = check_bus;
-                        break;
-                    }
-                }
-                
-                /* Only switch if we found a bus at station */
-                if (next_bus >= 0) {
-                    shm->active_bus_id = next_bus;
-                    sem_unlock(SEM_SHM_MUTEX);
-                    log_driver(LOG_INFO, "Bus %d: Switching active bus to %d", g_bus_id, next_bus);
-                } else {
-                    /* No other bus at station - set to -1 (will be set when next bus returns) */
-                    shm->active_bus_id = -1;
-                    sem_unlock(SEM_SHM_MUTEX);
-                    log_driver(LOG_INFO, "Bus %d: No other bus at station, active_bus_id set to -1", g_bus_id);
-                }
+                hand_over_bay(shm);
                 
                 /* Depart */
                 depart_bus(shm);
@@ -466,39 +941,21 @@ int main(int argc, char *argv[]) {
             }
         }
         if (should_depart(shm)) {
-            sem_lock(SEM_SHM_MUTEX);
-            int next_bus = -1;
-            
-            /* Find next available bus at station */
-            for (int i = 0; i < MAX_BUSES; i++) {
-                int check_bus = (g_bus_id + 1 + i) % MAX_BUSES;
-                if (shm->buses[check_bus].at_station && check_bus != g_bus_id) {
-                    next_bus = check_bus;
-                    break;
-                }
-            }
-            
-            /* Only switch if we found a bus at station */
-            if (next_bus >= 0) {
-                shm->active_bus_id = next_bus;
-                sem_unlock(SEM_SHM_MUTEX);
-                log_driver(LOG_INFO, "Bus %d: Switching active bus to %d", g_bus_id, next_bus);
-            } else {
-                /* No other bus at station - set to -1 (will be set when next bus returns) */
-                shm->active_bus_id = -1;
-                sem_unlock(SEM_SHM_MUTEX);
-                log_driver(LOG_INFO, "Bus %d: No other bus at station, active_bus_id set to -1", g_bus_id);
-            }
+            hand_over_bay(shm);
             
             depart_bus(shm);
         }
     }
     log_driver(LOG_INFO, "Bus %d driver shutting down", g_bus_id);
+    doors_stop();
     
     sem_lock(SEM_SHM_MUTEX);
+    sem_lock(SEM_BUS_MUTEX(g_bus_id));
     shm->driver_pids[g_bus_id] = 0;
     shm->buses[g_bus_id].boarding_open = false;
+    sem_unlock(SEM_BUS_MUTEX(g_bus_id));
     sem_unlock(SEM_SHM_MUTEX);
+    shm_bus_notify();
     
     ipc_detach_all();
     if (!is_minimal) {
@@ -0,0 +1,123 @@
+#include "fairq.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FAIRQ_STRIDE  (1u << 20)  /* Pass a request of weight 1 costs */
+
+static const char *const k_class_names[CLASS_COUNT] = {
+    "vip", "regular", "senior", "bike", "family"
+};
+
+void fairq_init(fairq_t *s, const char *policy, const char *weights, long now_ms) {
+    static const uint32_t defaults[CLASS_COUNT] = {
+        CLASS_WEIGHT_VIP, CLASS_WEIGHT_REGULAR, CLASS_WEIGHT_SENIOR,
+        CLASS_WEIGHT_BIKE, CLASS_WEIGHT_FAMILY
+    };
+    memset(s, 0, sizeof(*s));
+    s->fifo = policy != NULL && strcmp(policy, "fifo") == 0;
+    s->aging_ms = CLASS_AGING_MS;
+    memcpy(s->weight, defaults, sizeof(s->weight));
+    unsigned w[CLASS_COUNT];
+    if (weights != NULL &&
+        sscanf(weights, "%u,%u,%u,%u,%u", &w[0], &w[1], &w[2], &w[3], &w[4]) == CLASS_COUNT) {
+        for (int c = 0; c < CLASS_COUNT; c++) {
+            s->weight[c] = w[c] > 0 ? w[c] : 1;
+        }
+    }
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        s->last_ms[c] = now_ms;
+    }
+}
+
+/* Sort key: aged classes (longest unserved first) ahead of everything by pass */
+static int fairq_before(const fairq_t *s, long now_ms, int a, int b) {
+    int aged_a = now_ms - s->last_ms[a] >= s->aging_ms;
+    int aged_b = now_ms - s->last_ms[b] >= s->aging_ms;
+    if (aged_a != aged_b) {
+        return aged_a;
+    }
+    if (aged_a) {
+        return s->last_ms[a] < s->last_ms[b];
+    }
+    return s->pass[a] < s->pass[b];
+}
+
+void fairq_order(const fairq_t *s, long now_ms, int *order) {
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        int c = i;
+        int j = i;
+        /* Insertion sort; equal keys keep class order, so VIPs win ties */
+        while (j > 0 && fairq_before(s, now_ms, c, order[j - 1])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = c;
+    }
+}
+
+void fairq_served(fairq_t *s, int cls, long now_ms) {
+    if (s->pass[cls] < s->vnow) {
+        s->pass[cls] = s->vnow;
+    }
+    s->vnow = s->pass[cls];
+    s->pass[cls] += FAIRQ_STRIDE / s->weight[cls];
+    s->last_ms[cls] = now_ms;
+}
+
+void fairq_idle(fairq_t *s, int cls, long now_ms) {
+    if (s->pass[cls] < s->vnow) {
+        s->pass[cls] = s->vnow;
+    }
+    s->last_ms[cls] = now_ms;
+}
+
+void fairq_arrange(fairq_t *s, const int *cls, int n, long now_ms, int *order) {
+    int left[CLASS_COUNT] = {0};
+    for (int i = 0; i < n; i++) {
+        left[cls[i]]++;
+    }
+    int next = 0;
+    if (s->fifo) {
+        for (int vip = 1; vip >= 0; vip--) {
+            for (int i = 0; i < n; i++) {
+                if ((cls[i] == CLASS_VIP) == vip) {
+                    order[next++] = i;
+                }
+            }
+        }
+        return;
+    }
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (left[c] == 0) {
+            fairq_idle(s, c, now_ms);
+        }
+    }
+    int taken[CLASS_COUNT] = {0};  /* Requests of each class placed so far */
+    while (next < n) {
+        int by_class[CLASS_COUNT];
+        fairq_order(s, now_ms, by_class);
+        int c = 0;
+        for (int k = 0; k < CLASS_COUNT; k++) {
+            if (left[by_class[k]] > 0) {
+                c = by_class[k];
+                break;
+            }
+        }
+        /* The class' next request in arrival order */
+        for (int i = 0, seen = 0; i < n; i++) {
+            if (cls[i] == c && seen++ == taken[c]) {
+                order[next++] = i;
+                break;
+            }
+        }
+        taken[c]++;
+        left[c]--;
+        fairq_served(s, c, now_ms);
+    }
+}
+
+const char *fairq_class_name(int cls) {
+    return cls >= 0 && cls < CLASS_COUNT ? k_class_names[cls] : "?";
+}
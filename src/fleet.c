@@ -0,0 +1,84 @@
+#include "fleet.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FLEET_MAX_RETURN  3600  /* Longest round trip an entry may ask for, seconds */
+
+_Static_assert(BUS_CAPACITY <= MAX_BUS_CAPACITY && MIDI_CAPACITY <= MAX_BUS_CAPACITY &&
+               ARTIC_CAPACITY <= MAX_BUS_CAPACITY, "presets must fit the largest bus");
+_Static_assert(BIKE_CAPACITY <= MAX_BIKE_CAPACITY && MIDI_BIKE_CAPACITY <= MAX_BIKE_CAPACITY &&
+               ARTIC_BIKE_CAPACITY <= MAX_BIKE_CAPACITY, "presets must fit the largest rack");
+
+static const bus_model_t k_presets[] = {
+    { "standard", { BUS_CAPACITY, BIKE_CAPACITY }, MIN_RETURN_TIME, MAX_RETURN_TIME },
+    { "midi", { MIDI_CAPACITY, MIDI_BIKE_CAPACITY }, MIDI_MIN_RETURN_TIME, MIDI_MAX_RETURN_TIME },
+    { "articulated", { ARTIC_CAPACITY, ARTIC_BIKE_CAPACITY }, ARTIC_MIN_RETURN_TIME, ARTIC_MAX_RETURN_TIME },
+};
+
+/* One entry of the spec, `len` characters at `entry` */
+static int parse_model(const char *entry, size_t len, bus_model_t *model, char *err, size_t errlen) {
+    char text[FLEET_NAME_LEN];
+    if (len == 0 || len >= sizeof(text)) {
+        snprintf(err, errlen, "entry '%.*s' is empty or too long", (int)len, entry);
+        return -1;
+    }
+    memcpy(text, entry, len);
+    text[len] = '\0';
+    for (size_t i = 0; i < sizeof(k_presets) / sizeof(k_presets[0]); i++) {
+        if (strcmp(text, k_presets[i].name) == 0) {
+            *model = k_presets[i];
+            return 0;
+        }
+    }
+
+    unsigned seats, bikes, min_return, max_return;
+    char tail;
+    if (sscanf(text, "%u/%u/%u-%u%c", &seats, &bikes, &min_return, &max_return, &tail) != 4) {
+        snprintf(err, errlen, "'%s' is neither standard|midi|articulated nor SEATS/BIKES/MIN-MAX", text);
+        return -1;
+    }
+    if (seats < 2 || seats > MAX_BUS_CAPACITY || bikes > MAX_BIKE_CAPACITY) {
+        snprintf(err, errlen, "'%s': seats must be 2-%d and bike places 0-%d",
+                 text, MAX_BUS_CAPACITY, MAX_BIKE_CAPACITY);
+        return -1;
+    }
+    if (min_return < 1 || min_return > max_return || max_return > FLEET_MAX_RETURN) {
+        snprintf(err, errlen, "'%s': return time must be MIN-MAX with 1 <= MIN <= MAX <= %d",
+                 text, FLEET_MAX_RETURN);
+        return -1;
+    }
+    memcpy(model->name, text, len + 1);
+    model->capacity.seats = (uint16_t)seats;
+    model->capacity.bikes = (uint16_t)bikes;
+    model->min_return = (uint16_t)min_return;
+    model->max_return = (uint16_t)max_return;
+    return 0;
+}
+
+int fleet_parse(const char *spec, bus_model_t *models, char *err, size_t errlen) {
+    for (int i = 0; i < MAX_BUSES; i++) {
+        models[i] = k_presets[0];
+    }
+    if (spec == NULL || *spec == '\0') {
+        return 0;
+    }
+    int bus = 0;
+    const char *entry = spec;
+    while (1) {
+        const char *end = strchr(entry, ',');
+        size_t len = end ? (size_t)(end - entry) : strlen(entry);
+        if (bus >= MAX_BUSES) {
+            snprintf(err, errlen, "more than %d buses", MAX_BUSES);
+            return -1;
+        }
+        if (parse_model(entry, len, &models[bus], err, errlen) != 0) {
+            return -1;
+        }
+        bus++;
+        if (end == NULL) {
+            return 0;
+        }
+        entry = end + 1;
+    }
+}
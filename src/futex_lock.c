@@ -0,0 +1,126 @@
+#include "futex_lock.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#define FUTEX_SPIN_COUNT      100   /* CAS attempts before sleeping */
+#define FUTEX_OWNER_CHECK_MS  50    /* Sleep slice between owner liveness checks */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+/* getpid() is a real syscall in modern glibc; every role exec()s after fork(),
+ * so caching it per process is safe. */
+static uint32_t g_self_id = 0;
+
+static uint32_t self_id(void) {
+    if (g_self_id == 0) {
+        g_self_id = (uint32_t)getpid();
+    }
+    return g_self_id;
+}
+
+int futex_wait(_Atomic uint32_t *addr, uint32_t expected, const struct timespec *timeout) {
+    return (int)syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+int futex_wake(_Atomic uint32_t *addr, int count) {
+    return (int)syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/* Owner is dead if it no longer exists or is a zombie nobody has reaped yet. */
+static int owner_is_dead(pid_t pid) {
+    if (pid <= 0) {
+        return 0;
+    }
+    if (kill(pid, 0) == -1) {
+        return errno == ESRCH;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char state = 0;
+    int fields = fscanf(f, "%*d (%*[^)]) %c", &state);
+    fclose(f);
+    return fields == 1 && state == 'Z';
+}
+
+int futex_mutex_trylock(futex_mutex_t *m) {
+    uint32_t expected = 0;
+    if (atomic_compare_exchange_strong_explicit(&m->word, &expected, self_id(),
+                                                memory_order_acquire, memory_order_relaxed)) {
+        return 0;
+    }
+    return EBUSY;
+}
+
+int futex_mutex_lock(futex_mutex_t *m) {
+    uint32_t self = self_id();
+
+    /* Fast path + brief spin: stay in user space while the holder is running */
+    for (int i = 0; i < FUTEX_SPIN_COUNT; i++) {
+        uint32_t cur = atomic_load_explicit(&m->word, memory_order_relaxed);
+        if (cur == 0 &&
+            atomic_compare_exchange_weak_explicit(&m->word, &cur, self,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
+        cpu_relax();
+    }
+
+    struct timespec slice = { 0, FUTEX_OWNER_CHECK_MS * 1000000L };
+    while (1) {
+        uint32_t cur = atomic_load_explicit(&m->word, memory_order_relaxed);
+        if (cur == 0) {
+            /* Take it with the waiters bit set: others may still be sleeping */
+            if (atomic_compare_exchange_strong_explicit(&m->word, &cur, self | FUTEX_MUTEX_WAITERS,
+                                                        memory_order_acquire, memory_order_relaxed)) {
+                return 0;
+            }
+            continue;
+        }
+        if (!(cur & FUTEX_MUTEX_WAITERS)) {
+            uint32_t marked = cur | FUTEX_MUTEX_WAITERS;
+            if (!atomic_compare_exchange_strong_explicit(&m->word, &cur, marked,
+                                                         memory_order_relaxed, memory_order_relaxed)) {
+                continue;
+            }
+            cur = marked;
+        }
+
+        if (futex_wait(&m->word, cur, &slice) == -1 && errno == ETIMEDOUT) {
+            pid_t owner = (pid_t)(cur & ~FUTEX_MUTEX_WAITERS);
+            if (owner_is_dead(owner) &&
+                atomic_compare_exchange_strong_explicit(&m->word, &cur, self | FUTEX_MUTEX_WAITERS,
+                                                        memory_order_acquire, memory_order_relaxed)) {
+                return EOWNERDEAD;
+            }
+        }
+        /* EAGAIN (word changed), EINTR (e.g. SIGTSTP/SIGCONT) or wakeup: retry */
+    }
+}
+
+void futex_mutex_unlock(futex_mutex_t *m) {
+    uint32_t prev = atomic_exchange_explicit(&m->word, 0, memory_order_release);
+    if (prev & FUTEX_MUTEX_WAITERS) {
+        futex_wake(&m->word, 1);
+    }
+}
+
+int futex_mutex_is_locked(futex_mutex_t *m) {
+    return atomic_load_explicit(&m->word, memory_order_relaxed) != 0;
+}
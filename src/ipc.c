@@ -1,3 +1,4 @@
+#define _GNU_SOURCE  /* semtimedop */
 #include "ipc.h"
 #include "config.h"
 #include "logging.h"
@@ -11,6 +12,38 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <poll.h>
+#include <stddef.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define RING_WAIT_SLICE_MS 200   /* Max sleep on the ring before re-checking shutdown */
+#define MAILBOX_WAIT_SLICE_MS 200 /* Max sleep on a reply mailbox before re-checking shutdown */
+#define MQ_WAIT_SLICE_MS 200     /* Max sleep in mq_timedsend/receive before re-checking shutdown */
+#define SOCK_WAIT_SLICE_MS 200   /* Max sleep on a socket before re-checking shutdown */
+#define DEADLINE_REFIRE_MS 20    /* Deadline timer repeats until disarmed: an expiry just
+                                    before msgrcv() blocks is caught by the next one */
+#define MQ_PRIO_REGULAR 0        /* mq delivers the highest priority first */
+#define MQ_PRIO_VIP     1
+
+_Static_assert(sizeof(ticket_msg_t) <= MAILBOX_PAYLOAD, "ticket reply must fit a mailbox");
+_Static_assert(sizeof(boarding_msg_t) <= MAILBOX_PAYLOAD, "boarding reply must fit a mailbox");
+_Static_assert(sizeof(ticket_msg_t) <= SHM_RING_PAYLOAD, "ticket request must fit a ring slot");
+_Static_assert(REPLY_MAILBOXES <= INT16_MAX, "reply_slot is an int16_t on the wire");
+_Static_assert(MAX_BUSES <= UINT8_MAX && TICKET_OFFICES <= UINT8_MAX, "ids are one byte on the wire");
+_Static_assert(offsetof(ticket_msg_t, request_id) == offsetof(boarding_msg_t, request_id),
+               "replies are matched by request_id at the same offset");
+_Static_assert(offsetof(ticket_msg_t, passenger) == offsetof(boarding_msg_t, passenger),
+               "a batch of either is classed by its passenger at the same offset");
 
 static int g_shmid = -1;
 static int g_semid = -1;
@@ -19,7 +52,27 @@ static int g_msgid_ticket_resp = -1;
 static int g_msgid_boarding = -1;
 static int g_msgid_boarding_resp = -1;
 static int g_msgid_dispatch = -1;
+static mqd_t g_mq_ticket = (mqd_t)-1;
+static mqd_t g_mq_boarding = (mqd_t)-1;
+static int g_sock = -1;             /* Own AF_UNIX endpoint with the socket transport */
+static timer_t g_deadline_timer;    /* SIGALRM at the deadline of a SysV timed receive */
+static int g_deadline_timer_state = 0; /* 0 = not created yet, 1 = ready, -1 = unavailable */
+static int g_instance = -1;         /* Run id from BUS_INSTANCE, read on first use */
+static int g_mem_role = -1;         /* mem_role_t once ipc_mem_init() ran */
+static int g_tlb_fd = -1;           /* perf counter of dTLB load misses, -1 if unavailable */
+static struct rusage g_mem_start;   /* Fault counts at the last flush */
+static uint64_t g_tlb_start = 0;    /* dTLB misses at the last flush */
+static int g_mem_flushed = 0;       /* This process is already in mem[role].processes */
 static shm_data_t *g_shm = NULL;
+static ipc_lock_mode_t g_lock_mode = IPC_LOCK_SYSV;
+static ipc_transport_t g_transport = IPC_TRANSPORT_SYSV;
+static int g_board_mq = 0;           /* Boarding requests on the mqueue (mq, unless --assign) */
+static int g_bus = -1;               /* Driver's bus (ipc_endpoint_open), for its booked requests */
+static int g_mailbox = -1;          /* Own reply mailbox slot, -1 = none */
+static uint32_t g_mailbox_token = 0; /* Token of the request currently in flight */
+static uint32_t g_request_seq = 0;   /* Request ids when there is no mailbox */
+static fairq_t g_fairq;              /* Class scheduler of a serving process, see class_sched() */
+static int g_fairq_ready = 0;
 
 #if defined(__linux__)
 union semun {
@@ -31,6 +84,58 @@ union semun {
 #elif defined(__APPLE__)
 #endif
 
+int ipc_get_instance(void) {
+    if (g_instance < 0) {
+        const char *instance = getenv("BUS_INSTANCE");
+        g_instance = instance ? atoi(instance) : 0;
+        if (g_instance < 0 || g_instance > IPC_INSTANCE_MAX) {
+            g_instance = 0;
+        }
+    }
+    return g_instance;
+}
+
+/* Huge page size from /proc/meminfo (2 MB if it can't be read) */
+static size_t huge_page_size(void) {
+    size_t kb = 2048;
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (f != NULL) {
+        char line[128];
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+    return kb * 1024;
+}
+
+/* SysV key of one resource inside this run's key window */
+static key_t ipc_key(int offset) {
+    return (key_t)(IPC_KEY_BASE + ipc_get_instance() * IPC_KEYS_PER_INSTANCE + offset);
+}
+
+/* mqueue name of this run: the plain name for instance 0, "<name>.<N>" otherwise */
+static const char *mq_name(const char *base, char *buf, size_t len) {
+    if (ipc_get_instance() == 0) {
+        return base;
+    }
+    snprintf(buf, len, "%s.%d", base, ipc_get_instance());
+    return buf;
+}
+
+static void mq_close_all(void) {
+    if (g_mq_ticket != (mqd_t)-1) {
+        mq_close(g_mq_ticket);
+        g_mq_ticket = (mqd_t)-1;
+    }
+    if (g_mq_boarding != (mqd_t)-1) {
+        mq_close(g_mq_boarding);
+        g_mq_boarding = (mqd_t)-1;
+    }
+}
+
 static void ipc_cleanup_partial(void) {
     /* Cleanup any resources created so far on partial failure */
     if (g_shm != NULL && g_shm != (void *)-1) {
@@ -65,10 +170,148 @@ static void ipc_cleanup_partial(void) {
         msgctl(g_msgid_dispatch, IPC_RMID, NULL);
         g_msgid_dispatch = -1;
     }
+    char name[64];
+    mq_close_all();
+    mq_unlink(mq_name(MQ_TICKET_NAME, name, sizeof(name)));
+    mq_unlink(mq_name(MQ_BOARDING_NAME, name, sizeof(name)));
+}
+
+/* Create a request mqueue sized for `msgsize` messages. fs.mqueue.msg_max
+ * caps the depth for unprivileged users (often 10), so fall back to it. */
+static mqd_t mq_create(const char *name, long maxmsg, size_t msgsize) {
+    mq_unlink(name);  /* Leftover from a run that was SIGKILLed */
+    struct mq_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.mq_maxmsg = maxmsg;
+    attr.mq_msgsize = (long)msgsize;
+    mqd_t q = mq_open(name, O_CREAT | O_EXCL | O_RDWR, 0600, &attr);
+    if (q == (mqd_t)-1 && errno == EINVAL) {
+        long limit = 10;
+        FILE *f = fopen("/proc/sys/fs/mqueue/msg_max", "r");
+        if (f != NULL) {
+            if (fscanf(f, "%ld", &limit) != 1) {
+                limit = 10;
+            }
+            fclose(f);
+        }
+        attr.mq_maxmsg = limit < maxmsg ? limit : maxmsg;
+        q = mq_open(name, O_CREAT | O_EXCL | O_RDWR, 0600, &attr);
+    }
+    return q;
+}
+
+/* Per-process counter of user-space dTLB load misses, threads included.
+ * Fails (-1) without PMU access, e.g. in VMs or with perf_event_paranoid > 2. */
+static int tlb_counter_open(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* mlock() populates the whole mapping up front; if RLIMIT_MEMLOCK refuses
+ * it, touch one byte per page so at least the faults happen now */
+static void shm_pin(void) {
+    size_t len = g_shm->segment_size;
+    if (mlock(g_shm, len) == 0) {
+        atomic_fetch_add(&g_shm->pinned, 1);
+        return;
+    }
+    atomic_fetch_add(&g_shm->pin_refused, 1);
+    size_t page = g_shm->huge_pages ? huge_page_size() : (size_t)sysconf(_SC_PAGESIZE);
+    const volatile char *p = (const volatile char *)g_shm;
+    for (size_t off = 0; off < len; off += page) {
+        (void)p[off];
+    }
+}
+
+void ipc_mem_init(mem_role_t role) {
+    if (g_shm == NULL || role < 0 || role >= MEM_ROLE_COUNT) {
+        return;
+    }
+    g_mem_role = role;
+    getrusage(RUSAGE_SELF, &g_mem_start);
+    g_tlb_fd = tlb_counter_open();
+    if (g_shm->pin_segment && role != MEM_ROLE_PASSENGER) {
+        shm_pin();
+    }
+}
+
+/* Adds what was taken since the previous flush, so it can run repeatedly */
+void ipc_mem_flush(void) {
+    if (g_mem_role < 0 || g_shm == NULL) {
+        return;
+    }
+    mem_role_stats_t *mem = &g_shm->mem[g_mem_role];
+    struct rusage now;
+    if (getrusage(RUSAGE_SELF, &now) == 0) {
+        atomic_fetch_add(&mem->minor_faults, now.ru_minflt - g_mem_start.ru_minflt);
+        atomic_fetch_add(&mem->major_faults, now.ru_majflt - g_mem_start.ru_majflt);
+        g_mem_start = now;
+    }
+    if (g_tlb_fd != -1) {
+        uint64_t misses = 0;
+        if (read(g_tlb_fd, &misses, sizeof(misses)) == (ssize_t)sizeof(misses)) {
+            atomic_fetch_add(&mem->dtlb_misses, (long)(misses - g_tlb_start));
+            g_tlb_start = misses;
+            if (!g_mem_flushed) {
+                atomic_fetch_add(&mem->tlb_processes, 1);
+            }
+        }
+    }
+    if (!g_mem_flushed) {
+        atomic_fetch_add(&mem->processes, 1);
+        g_mem_flushed = 1;
+    }
+}
+
+void ipc_mem_tick(void) {
+    static time_t last;
+    time_t now = time(NULL);
+    if (g_mem_role >= 0 && now != last) {
+        last = now;
+        ipc_mem_flush();
+    }
+}
+
+static void ipc_mem_close(void) {
+    ipc_mem_flush();
+    if (g_tlb_fd != -1) {
+        close(g_tlb_fd);
+        g_tlb_fd = -1;
+    }
+    g_mem_role = -1;
 }
 
 int ipc_create_all(void) {
-    g_shmid = shmget(SHM_KEY, sizeof(shm_data_t), IPC_CREAT | 0600);
+    const char *huge = getenv("BUS_SHM_HUGE");
+    int pin_segment = huge && strcmp(huge, "1") == 0;
+    size_t segment_size = sizeof(shm_data_t);
+    int huge_pages = 0;
+    g_shmid = -1;
+    if (pin_segment) {
+        size_t page = huge_page_size();
+        size_t rounded = (segment_size + page - 1) / page * page;
+        g_shmid = shmget(ipc_key(SHM_KEY_OFFSET), rounded, IPC_CREAT | SHM_HUGETLB | 0600);
+        if (g_shmid != -1) {
+            segment_size = rounded;
+            huge_pages = 1;
+        } else {
+            /* No reserved huge pages (vm.nr_hugepages) or no permission */
+            fprintf(stderr, "ipc_create_all: huge pages unavailable (%s), using normal pages\n",
+                    strerror(errno));
+        }
+    }
+    if (g_shmid == -1) {
+        g_shmid = shmget(ipc_key(SHM_KEY_OFFSET), segment_size, IPC_CREAT | 0600);
+    }
     if (g_shmid == -1) {
         perror("ipc_create_all: shmget failed");
         return -1;
@@ -82,8 +325,35 @@ int ipc_create_all(void) {
         return -1;
     }
 
+    /* Zeroing touches every page, so the creator's mapping is fully faulted in */
     memset(g_shm, 0, sizeof(shm_data_t));
-    g_semid = semget(SEM_KEY, SEM_COUNT, IPC_CREAT | 0600);
+    g_shm->segment_size = segment_size;
+    g_shm->huge_pages = huge_pages;
+    g_shm->pin_segment = pin_segment;
+
+    /* Lock backend is fixed for the whole run; children read it from shm */
+    const char *lock_mode = getenv("BUS_LOCK_MODE");
+    g_lock_mode = (lock_mode && strcmp(lock_mode, "futex") == 0) ? IPC_LOCK_FUTEX : IPC_LOCK_SYSV;
+    g_shm->lock_mode = g_lock_mode;
+
+    const char *transport = getenv("BUS_TRANSPORT");
+    g_transport = IPC_TRANSPORT_SYSV;
+    if (transport && strcmp(transport, "ring") == 0) {
+        g_transport = IPC_TRANSPORT_RING;
+    } else if (transport && strcmp(transport, "mq") == 0) {
+        g_transport = IPC_TRANSPORT_MQ;
+    } else if (transport && strcmp(transport, "sock") == 0) {
+        g_transport = IPC_TRANSPORT_SOCK;
+    }
+    g_shm->transport = g_transport;
+    /* Booked requests need a queue per bus: mtypes on the SysV queue, which
+     * the mq transport then uses for boarding as the ring does */
+    const char *assign = getenv("BUS_ASSIGN");
+    g_shm->assign_seats = (assign && strcmp(assign, "1") == 0);
+    g_board_mq = (g_transport == IPC_TRANSPORT_MQ && !g_shm->assign_seats);
+    shm_ring_init(&g_shm->ticket_ring);
+
+    g_semid = semget(ipc_key(SEM_KEY_OFFSET), SEM_COUNT, IPC_CREAT | 0600);
     if (g_semid == -1) {
         perror("ipc_create_all: semget failed");
         ipc_cleanup_partial();
@@ -107,16 +377,6 @@ int ipc_create_all(void) {
         ipc_cleanup_partial();
         return -1;
     }
-    if (semctl(g_semid, SEM_ENTRANCE_PASSENGER, SETVAL, arg) == -1) {
-        perror("ipc_create_all: semctl SEM_ENTRANCE_PASSENGER failed");
-        ipc_cleanup_partial();
-        return -1;
-    }
-    if (semctl(g_semid, SEM_ENTRANCE_BIKE, SETVAL, arg) == -1) {
-        perror("ipc_create_all: semctl SEM_ENTRANCE_BIKE failed");
-        ipc_cleanup_partial();
-        return -1;
-    }
     if (semctl(g_semid, SEM_BOARDING_MUTEX, SETVAL, arg) == -1) {
         perror("ipc_create_all: semctl SEM_BOARDING_MUTEX failed");
         ipc_cleanup_partial();
@@ -141,6 +401,24 @@ int ipc_create_all(void) {
         }
     }
 
+    for (int i = SEM_ENTRANCE_BASE; i < SEM_BUS_MUTEX_BASE; i++) {
+        if (semctl(g_semid, i, SETVAL, arg) == -1) {
+            fprintf(stderr, "ipc_create_all: semctl bus entrance %d failed\n", i);
+            perror("semctl");
+            ipc_cleanup_partial();
+            return -1;
+        }
+    }
+
+    for (int i = SEM_BUS_MUTEX_BASE; i < SEM_COUNT; i++) {
+        if (semctl(g_semid, i, SETVAL, arg) == -1) {
+            fprintf(stderr, "ipc_create_all: semctl bus/office mutex %d failed\n", i);
+            perror("semctl");
+            ipc_cleanup_partial();
+            return -1;
+        }
+    }
+
     arg.val = MAX_TICKET_QUEUE_REQUESTS;
     if (semctl(g_semid, SEM_TICKET_QUEUE_SLOTS, SETVAL, arg) == -1) {
         perror("ipc_create_all: semctl SEM_TICKET_QUEUE_SLOTS failed");
@@ -154,7 +432,7 @@ int ipc_create_all(void) {
         return -1;
     }
 
-    g_msgid_ticket = msgget(MSG_TICKET_KEY, IPC_CREAT | 0600);
+    g_msgid_ticket = msgget(ipc_key(MSG_TICKET_KEY_OFFSET), IPC_CREAT | 0600);
     if (g_msgid_ticket == -1) {
         perror("ipc_create_all: msgget ticket failed");
         ipc_cleanup_partial();
@@ -162,14 +440,14 @@ int ipc_create_all(void) {
     }
 
     /* Separate queue for ticket responses - guarantees responses always have room */
-    g_msgid_ticket_resp = msgget(MSG_TICKET_RESP_KEY, IPC_CREAT | 0600);
+    g_msgid_ticket_resp = msgget(ipc_key(MSG_TICKET_RESP_KEY_OFFSET), IPC_CREAT | 0600);
     if (g_msgid_ticket_resp == -1) {
         perror("ipc_create_all: msgget ticket_resp failed");
         ipc_cleanup_partial();
         return -1;
     }
 
-    g_msgid_boarding = msgget(MSG_BOARDING_KEY, IPC_CREAT | 0600);
+    g_msgid_boarding = msgget(ipc_key(MSG_BOARDING_KEY_OFFSET), IPC_CREAT | 0600);
     if (g_msgid_boarding == -1) {
         perror("ipc_create_all: msgget boarding failed");
         ipc_cleanup_partial();
@@ -177,25 +455,41 @@ int ipc_create_all(void) {
     }
 
     /* Separate queue for boarding responses - guarantees responses always have room */
-    g_msgid_boarding_resp = msgget(MSG_BOARDING_RESP_KEY, IPC_CREAT | 0600);
+    g_msgid_boarding_resp = msgget(ipc_key(MSG_BOARDING_RESP_KEY_OFFSET), IPC_CREAT | 0600);
     if (g_msgid_boarding_resp == -1) {
         perror("ipc_create_all: msgget boarding_resp failed");
         ipc_cleanup_partial();
         return -1;
     }
 
-    g_msgid_dispatch = msgget(MSG_DISPATCH_KEY, IPC_CREAT | 0600);
+    g_msgid_dispatch = msgget(ipc_key(MSG_DISPATCH_KEY_OFFSET), IPC_CREAT | 0600);
     if (g_msgid_dispatch == -1) {
         perror("ipc_create_all: msgget dispatch failed");
         ipc_cleanup_partial();
         return -1;
     }
 
+    if (g_transport == IPC_TRANSPORT_MQ) {
+        char name[64];
+        g_mq_ticket = mq_create(mq_name(MQ_TICKET_NAME, name, sizeof(name)), MAX_TICKET_QUEUE_REQUESTS, sizeof(ticket_msg_t));
+        if (g_mq_ticket == (mqd_t)-1) {
+            perror("ipc_create_all: mq_open ticket failed");
+            ipc_cleanup_partial();
+            return -1;
+        }
+        g_mq_boarding = mq_create(mq_name(MQ_BOARDING_NAME, name, sizeof(name)), MAX_BOARDING_QUEUE_REQUESTS, sizeof(boarding_msg_t));
+        if (g_mq_boarding == (mqd_t)-1) {
+            perror("ipc_create_all: mq_open boarding failed");
+            ipc_cleanup_partial();
+            return -1;
+        }
+    }
+
     return 0;
 }
 
 int ipc_attach_all(void) {
-    g_shmid = shmget(SHM_KEY, sizeof(shm_data_t), 0600);
+    g_shmid = shmget(ipc_key(SHM_KEY_OFFSET), sizeof(shm_data_t), 0600);
     if (g_shmid == -1) {
         perror("ipc_attach_all: shmget failed");
         return -1;
@@ -207,47 +501,71 @@ int ipc_attach_all(void) {
         g_shm = NULL;
         return -1;
     }
+    g_lock_mode = (ipc_lock_mode_t)g_shm->lock_mode;
+    g_transport = (ipc_transport_t)g_shm->transport;
+    g_board_mq = (g_transport == IPC_TRANSPORT_MQ && !g_shm->assign_seats);
 
-    g_semid = semget(SEM_KEY, SEM_COUNT, 0600);
+    g_semid = semget(ipc_key(SEM_KEY_OFFSET), SEM_COUNT, 0600);
     if (g_semid == -1) {
         perror("ipc_attach_all: semget failed");
         return -1;
     }
 
-    g_msgid_ticket = msgget(MSG_TICKET_KEY, 0600);
+    g_msgid_ticket = msgget(ipc_key(MSG_TICKET_KEY_OFFSET), 0600);
     if (g_msgid_ticket == -1) {
         perror("ipc_attach_all: msgget ticket failed");
         return -1;
     }
 
-    g_msgid_ticket_resp = msgget(MSG_TICKET_RESP_KEY, 0600);
+    g_msgid_ticket_resp = msgget(ipc_key(MSG_TICKET_RESP_KEY_OFFSET), 0600);
     if (g_msgid_ticket_resp == -1) {
         perror("ipc_attach_all: msgget ticket_resp failed");
         return -1;
     }
 
-    g_msgid_boarding = msgget(MSG_BOARDING_KEY, 0600);
+    g_msgid_boarding = msgget(ipc_key(MSG_BOARDING_KEY_OFFSET), 0600);
     if (g_msgid_boarding == -1) {
         perror("ipc_attach_all: msgget boarding failed");
         return -1;
     }
 
-    g_msgid_boarding_resp = msgget(MSG_BOARDING_RESP_KEY, 0600);
+    g_msgid_boarding_resp = msgget(ipc_key(MSG_BOARDING_RESP_KEY_OFFSET), 0600);
     if (g_msgid_boarding_resp == -1) {
         perror("ipc_attach_all: msgget boarding_resp failed");
         return -1;
     }
 
-    g_msgid_dispatch = msgget(MSG_DISPATCH_KEY, 0600);
+    g_msgid_dispatch = msgget(ipc_key(MSG_DISPATCH_KEY_OFFSET), 0600);
     if (g_msgid_dispatch == -1) {
         perror("ipc_attach_all: msgget dispatch failed");
         return -1;
     }
 
+    if (g_transport == IPC_TRANSPORT_MQ) {
+        char name[64];
+        g_mq_ticket = mq_open(mq_name(MQ_TICKET_NAME, name, sizeof(name)), O_RDWR);
+        if (g_mq_ticket == (mqd_t)-1) {
+            perror("ipc_attach_all: mq_open ticket failed");
+            return -1;
+        }
+        g_mq_boarding = mq_open(mq_name(MQ_BOARDING_NAME, name, sizeof(name)), O_RDWR);
+        if (g_mq_boarding == (mqd_t)-1) {
+            perror("ipc_attach_all: mq_open boarding failed");
+            return -1;
+        }
+    }
+
     return 0;
 }
 
 void ipc_detach_all(void) {
+    ipc_mem_close();
+    ipc_mailbox_close();
+    mq_close_all();
+    if (g_sock != -1) {
+        close(g_sock);
+        g_sock = -1;
+    }
     if (g_shm != NULL && g_shm != (void *)-1) {
         if (shmdt(g_shm) == -1) {
             perror("ipc_detach_all: shmdt failed");
@@ -266,13 +584,13 @@ void ipc_cleanup_all(void) {
     int msgid_boarding_resp = g_msgid_boarding_resp;
     int msgid_dispatch = g_msgid_dispatch;
 
-    if (shmid == -1) shmid = shmget(SHM_KEY, 0, 0);
-    if (semid == -1) semid = semget(SEM_KEY, 0, 0);
-    if (msgid_ticket == -1) msgid_ticket = msgget(MSG_TICKET_KEY, 0);
-    if (msgid_ticket_resp == -1) msgid_ticket_resp = msgget(MSG_TICKET_RESP_KEY, 0);
-    if (msgid_boarding == -1) msgid_boarding = msgget(MSG_BOARDING_KEY, 0);
-    if (msgid_boarding_resp == -1) msgid_boarding_resp = msgget(MSG_BOARDING_RESP_KEY, 0);
-    if (msgid_dispatch == -1) msgid_dispatch = msgget(MSG_DISPATCH_KEY, 0);
+    if (shmid == -1) shmid = shmget(ipc_key(SHM_KEY_OFFSET), 0, 0);
+    if (semid == -1) semid = semget(ipc_key(SEM_KEY_OFFSET), 0, 0);
+    if (msgid_ticket == -1) msgid_ticket = msgget(ipc_key(MSG_TICKET_KEY_OFFSET), 0);
+    if (msgid_ticket_resp == -1) msgid_ticket_resp = msgget(ipc_key(MSG_TICKET_RESP_KEY_OFFSET), 0);
+    if (msgid_boarding == -1) msgid_boarding = msgget(ipc_key(MSG_BOARDING_KEY_OFFSET), 0);
+    if (msgid_boarding_resp == -1) msgid_boarding_resp = msgget(ipc_key(MSG_BOARDING_RESP_KEY_OFFSET), 0);
+    if (msgid_dispatch == -1) msgid_dispatch = msgget(ipc_key(MSG_DISPATCH_KEY_OFFSET), 0);
 
     if (shmid != -1) {
         shmctl(shmid, IPC_RMID, NULL);
@@ -308,13 +626,29 @@ void ipc_cleanup_all(void) {
         msgctl(msgid_dispatch, IPC_RMID, NULL);
         g_msgid_dispatch = -1;
     }
+
+    /* Unlinked names vanish at once; open descriptors keep working until
+     * their owners notice the run ended */
+    char name[64];
+    mq_close_all();
+    mq_unlink(mq_name(MQ_TICKET_NAME, name, sizeof(name)));
+    mq_unlink(mq_name(MQ_BOARDING_NAME, name, sizeof(name)));
 }
 
 int ipc_resources_exist(void) {
-    int shmid = shmget(SHM_KEY, 0, 0);
+    int shmid = shmget(ipc_key(SHM_KEY_OFFSET), 0, 0);
     return (shmid != -1);
 }
 
+int ipc_resources_in_use(void) {
+    struct shmid_ds buf;
+    int shmid = shmget(ipc_key(SHM_KEY_OFFSET), 0, 0);
+    if (shmid == -1 || shmctl(shmid, IPC_STAT, &buf) == -1) {
+        return 0;
+    }
+    return buf.shm_nattch > 0;
+}
+
 shm_data_t* ipc_get_shm(void) {
     return g_shm;
 }
@@ -327,7 +661,74 @@ int ipc_get_semid(void) {
     return g_semid;
 }
 
+ipc_lock_mode_t ipc_get_lock_mode(void) {
+    return g_lock_mode;
+}
+
+/* Whether this semaphore index is a shm state lock served by an in-shm futex */
+static int is_futex_backed(int sem_num) {
+    return g_lock_mode == IPC_LOCK_FUTEX &&
+           (sem_num == SEM_SHM_MUTEX || (sem_num >= SEM_BUS_MUTEX_BASE && sem_num < SEM_COUNT));
+}
+
+/* In-shm futex lock backing this semaphore index (NULL once shm is detached) */
+static futex_mutex_t *shm_lock_for(int sem_num) {
+    if (g_shm == NULL) {
+        return NULL;
+    }
+    if (sem_num >= SEM_OFFICE_MUTEX_BASE) {
+        return &g_shm->offices[sem_num - SEM_OFFICE_MUTEX_BASE].lock;
+    }
+    if (sem_num >= SEM_BUS_MUTEX_BASE) {
+        return &g_shm->buses[sem_num - SEM_BUS_MUTEX_BASE].lock;
+    }
+    return &g_shm->shm_mutex;
+}
+
+/* Seqlock published by this lock's critical sections (NULL: none) */
+static _Atomic uint32_t *seq_for(int sem_num) {
+    if (g_shm == NULL) {
+        return NULL;
+    }
+    if (sem_num == SEM_SHM_MUTEX) {
+        return &g_shm->station_seq;
+    }
+    if (sem_num >= SEM_BUS_MUTEX_BASE && sem_num < SEM_OFFICE_MUTEX_BASE) {
+        return &g_shm->buses[sem_num - SEM_BUS_MUTEX_BASE].seq;
+    }
+    return NULL;
+}
+
+/* Every station/bus critical section is a seqlock write section, so
+ * shm_read_status() readers never see a half-done update */
+static void seq_enter(int sem_num) {
+    _Atomic uint32_t *seq = seq_for(sem_num);
+    if (seq != NULL) {
+        seqlock_write_begin(seq);
+    }
+}
+
+static void seq_leave(int sem_num) {
+    _Atomic uint32_t *seq = seq_for(sem_num);
+    if (seq != NULL) {
+        seqlock_write_end(seq);
+    }
+}
+
 int sem_lock(int sem_num) {
+    if (is_futex_backed(sem_num)) {
+        futex_mutex_t *m = shm_lock_for(sem_num);
+        if (m == NULL) {
+            return -1;  /* Shared memory already detached */
+        }
+        if (futex_mutex_lock(m) == EOWNERDEAD) {
+            /* Previous owner died mid-critical-section; counters are plain ints, keep going */
+            log_master(LOG_WARN, "sem_lock: recovered lock %d from dead owner", sem_num);
+        }
+        seq_enter(sem_num);
+        return 0;
+    }
+
     if (g_semid == -1) {
         return -1;  /* Semaphore set not initialized or already removed */
     }
@@ -339,6 +740,7 @@ int sem_lock(int sem_num) {
 
     while (1) {
         if (semop(g_semid, &op, 1) == 0) {
+            seq_enter(sem_num);
             return 0;  /* Success */
         }
         
@@ -360,6 +762,15 @@ int sem_lock(int sem_num) {
 /* Non-blocking lock: returns 0 on success, -1 if would block (EAGAIN) or error.
  * Use in tests when another process (e.g. driver with SIGSTOP) may hold the mutex. */
 int sem_trylock(int sem_num) {
+    if (is_futex_backed(sem_num)) {
+        futex_mutex_t *m = shm_lock_for(sem_num);
+        if (m == NULL || futex_mutex_trylock(m) != 0) {
+            return -1;
+        }
+        seq_enter(sem_num);
+        return 0;
+    }
+
     if (g_semid == -1) {
         return -1;
     }
@@ -368,6 +779,7 @@ int sem_trylock(int sem_num) {
     op.sem_op = -1;
     op.sem_flg = IPC_NOWAIT;
     if (semop(g_semid, &op, 1) == 0) {
+        seq_enter(sem_num);
         return 0;
     }
     if (errno == EAGAIN || errno == EINTR || errno == EIDRM || errno == EINVAL) {
@@ -378,6 +790,15 @@ int sem_trylock(int sem_num) {
 }
 
 void sem_unlock(int sem_num) {
+    seq_leave(sem_num);
+    if (is_futex_backed(sem_num)) {
+        futex_mutex_t *m = shm_lock_for(sem_num);
+        if (m != NULL) {
+            futex_mutex_unlock(m);
+        }
+        return;
+    }
+
     if (g_semid == -1) {
         return;  /* Semaphore set not initialized or already removed */
     }
@@ -395,7 +816,70 @@ void sem_unlock(int sem_num) {
     }
 }
 
+int sem_ops(const struct sembuf *ops, int nops, const struct timespec *timeout) {
+    if (nops <= 0 || nops > SEM_OPS_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (g_semid == -1) {
+        errno = EIDRM;
+        return -1;  /* Semaphore set not initialized or already removed */
+    }
+    
+    struct sembuf sysv[SEM_OPS_MAX];
+    int nsysv = 0;
+    for (int i = 0; i < nops; i++) {
+        if (is_futex_backed(ops[i].sem_num)) {
+            if (ops[i].sem_op > 0) {
+                sem_unlock(ops[i].sem_num);
+            }
+            continue;
+        }
+        if (ops[i].sem_op > 0) {
+            seq_leave(ops[i].sem_num);
+        }
+        sysv[nsysv++] = ops[i];
+    }
+    
+    if (nsysv > 0) {
+        while (semtimedop(g_semid, sysv, nsysv, timeout) == -1) {
+            if (errno == EINTR) {
+                continue;  /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+            }
+            if (errno != EAGAIN && errno != EIDRM && errno != EINVAL && errno != ERANGE) {
+                perror("sem_ops: semtimedop failed");
+                exit(EXIT_FAILURE);
+            }
+            /* Nothing was applied: the releases are still held */
+            for (int i = 0; i < nsysv; i++) {
+                if (sysv[i].sem_op > 0) {
+                    seq_enter(sysv[i].sem_num);
+                }
+            }
+            return -1;
+        }
+        for (int i = 0; i < nsysv; i++) {
+            if (sysv[i].sem_op < 0) {
+                seq_enter(sysv[i].sem_num);
+            }
+        }
+    }
+    
+    for (int i = 0; i < nops; i++) {
+        if (is_futex_backed(ops[i].sem_num) && ops[i].sem_op < 0 &&
+            sem_lock(ops[i].sem_num) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int sem_getval(int sem_num) {
+    if (is_futex_backed(sem_num)) {
+        futex_mutex_t *m = shm_lock_for(sem_num);
+        return (m != NULL && !futex_mutex_is_locked(m)) ? 1 : 0;
+    }
+
     if (g_semid == -1) {
         return 0;  /* Semaphore set not initialized or already removed */
     }
@@ -425,112 +909,1027 @@ void sem_setval(int sem_num, int value) {
     }
 }
 
-int ipc_get_msgid_ticket(void) {
-    return g_msgid_ticket;
+/* Whole shm state in hierarchy order: station, buses, offices */
+void shm_lock_all(void) {
+    sem_lock(SEM_SHM_MUTEX);
+    for (int i = SEM_BUS_MUTEX_BASE; i < SEM_COUNT; i++) {
+        sem_lock(i);
+    }
 }
 
-int ipc_get_msgid_boarding(void) {
-    return g_msgid_boarding;
+int shm_trylock_all(void) {
+    if (sem_trylock(SEM_SHM_MUTEX) == -1) {
+        return -1;
+    }
+    for (int i = SEM_BUS_MUTEX_BASE; i < SEM_COUNT; i++) {
+        if (sem_trylock(i) == -1) {
+            while (--i >= SEM_BUS_MUTEX_BASE) {
+                sem_unlock(i);
+            }
+            sem_unlock(SEM_SHM_MUTEX);
+            return -1;
+        }
+    }
+    return 0;
 }
 
-int ipc_get_msgid_dispatch(void) {
-    return g_msgid_dispatch;
+void shm_unlock_all(void) {
+    for (int i = SEM_COUNT - 1; i >= SEM_BUS_MUTEX_BASE; i--) {
+        sem_unlock(i);
+    }
+    sem_unlock(SEM_SHM_MUTEX);
 }
 
-/* 
- * Separate queues for requests and responses guarantee responses always have room.
- * Requests: limited by semaphores
- * Responses: go to dedicated queue, never compete with requests
- */
+void shm_read_status(status_snapshot_t *out) {
+    shm_data_t *shm = g_shm;
+    memset(out, 0, sizeof(*out));
+    if (shm == NULL) {
+        return;
+    }
 
-int msg_send_ticket(ticket_msg_t *msg) {
-    while (1) {
-        if (msgsnd(g_msgid_ticket, msg, sizeof(ticket_msg_t) - sizeof(long), 0) == 0) {
-            return 0;
-        }
-        if (errno == EINTR) {
-            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
-            continue;
-        }
-        if (errno != EIDRM) {
-            perror("msg_send_ticket: msgsnd failed");
-        }
-        return -1;
+    uint32_t seq;
+    do {
+        seq = seqlock_read_begin(&shm->station_seq);
+        out->simulation_running = shm->simulation_running;
+        out->station_open = shm->station_open;
+        out->boarding_allowed = shm->boarding_allowed;
+        out->early_departure_flag = shm->early_departure_flag;
+        out->spawning_stopped = shm->spawning_stopped;
+        out->station_closed = shm->station_closed;
+        out->test_fill_queue = shm->test_fill_queue;
+        out->passengers_transported = shm->passengers_transported;
+        out->bays = shm->bays;
+        memcpy(out->bay_bus, shm->bay_bus, sizeof(out->bay_bus));
+    } while (seqlock_read_retry(&shm->station_seq, seq));
+
+    for (int i = 0; i < MAX_BUSES; i++) {
+        bus_state_t *bus = &shm->buses[i];
+        bus_status_t *copy = &out->buses[i];
+        do {
+            seq = seqlock_read_begin(&bus->seq);
+            copy->at_station = bus->at_station;
+            copy->boarding_open = bus->boarding_open;
+            uint32_t occupancy = atomic_load(&bus->occupancy);
+            copy->passenger_count = OCC_SEATS(occupancy);
+            copy->bike_count = OCC_BIKES(occupancy);
+            copy->entering_count = OCC_ENTERING(occupancy);
+            copy->departure_time = bus->departure_time;
+        } while (seqlock_read_retry(&bus->seq, seq));
     }
 }
 
-/* Send ticket response to separate response queue */
-int msg_send_ticket_resp(ticket_msg_t *msg) {
-    while (1) {
-        if (msgsnd(g_msgid_ticket_resp, msg, sizeof(ticket_msg_t) - sizeof(long), 0) == 0) {
-            return 0;
-        }
-        if (errno == EINTR) {
-            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+uint32_t shm_bus_events(void) {
+    return g_shm == NULL ? 0 : atomic_load(&g_shm->bus_events);
+}
+
+uint32_t shm_board_events(void) {
+    return g_shm == NULL ? 0 : atomic_load(&g_shm->board_events);
+}
+
+/* Waiting passengers worth waking: one per seat left on the buses boarding
+ * at the bays, every one of them once they all have to go */
+static int board_wakeups(void) {
+    if (!SHM_READ(g_shm->simulation_running) || !SHM_READ(g_shm->boarding_allowed)) {
+        return INT_MAX;
+    }
+    int seats = 0;
+    for (int b = 0; b < g_shm->bays; b++) {
+        int bus = SHM_READ(g_shm->bay_bus[b]);
+        if (bus < 0) {
             continue;
         }
-        if (errno != EIDRM) {
-            perror("msg_send_ticket_resp: msgsnd failed");
+        bus_state_t *state = &g_shm->buses[bus];
+        uint32_t word = atomic_load(&state->occupancy);
+        if (!SHM_READ(state->at_station) || !SHM_READ(state->boarding_open) ||
+            (word & (OCC_CLOSED | OCC_CLOSING))) {
+            continue;
         }
-        return -1;
+        int left = state->model.capacity.seats - (int)OCC_SEATS(word);
+        seats += left > 0 ? left : 0;
     }
+    return seats;
 }
 
-ssize_t msg_recv_ticket(ticket_msg_t *msg, long mtype, int flags) {
-    ssize_t ret;
-    while (1) {
-        ret = msgrcv(g_msgid_ticket, msg, sizeof(ticket_msg_t) - sizeof(long), mtype, flags);
-        if (ret >= 0) {
-            return ret;
-        }
-        if (errno == EINTR) {
-            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+void shm_bus_notify(void) {
+    if (g_shm == NULL) {
+        return;
+    }
+    atomic_fetch_add(&g_shm->bus_events, 1);
+    futex_wake(&g_shm->bus_events, INT_MAX);  /* Idle drivers: at most MAX_BUSES */
+    atomic_fetch_add(&g_shm->board_events, 1);
+    int wake = board_wakeups();
+    if (wake > 0) {
+        futex_wake(&g_shm->board_events, wake);
+    }
+}
+
+static long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+/* Set up from BUS_SCHED / BUS_SCHED_WEIGHTS on first use */
+static fairq_t *class_sched(void) {
+    if (!g_fairq_ready) {
+        fairq_init(&g_fairq, getenv("BUS_SCHED"), getenv("BUS_SCHED_WEIGHTS"), monotonic_ms());
+        g_fairq_ready = 1;
+    }
+    return &g_fairq;
+}
+
+/* Reorder a batch of `n` (<= SOCK_BATCH) ticket or boarding requests,
+ * each `size` bytes, into class-scheduler order */
+static void class_arrange(void *msgs, size_t size, int n) {
+    if (n < 2) {
+        return;
+    }
+    int cls[SOCK_BATCH];
+    int order[SOCK_BATCH];
+    char copy[SOCK_BATCH * (sizeof(boarding_msg_t) > sizeof(ticket_msg_t) ?
+                            sizeof(boarding_msg_t) : sizeof(ticket_msg_t))];
+    for (int i = 0; i < n; i++) {
+        const char *msg = (const char *)msgs + (size_t)i * size;
+        cls[i] = passenger_class((const wire_passenger_t *)(msg + offsetof(ticket_msg_t, passenger)));
+    }
+    fairq_arrange(class_sched(), cls, n, monotonic_ms(), order);
+    memcpy(copy, msgs, (size_t)n * size);
+    for (int i = 0; i < n; i++) {
+        memcpy((char *)msgs + (size_t)i * size, copy + (size_t)order[i] * size, size);
+    }
+}
+
+/* Whether `seats` suit a queue of `waiting` better than `than`: the
+ * smallest bus that takes everyone, else the largest */
+static int better_fit(int seats, int than, int waiting) {
+    if ((seats >= waiting) != (than >= waiting)) {
+        return seats >= waiting;
+    }
+    return seats >= waiting ? seats < than : seats > than;
+}
+
+int shm_next_bay_bus(int after) {
+    shm_data_t *shm = g_shm;
+    if (shm == NULL) {
+        return -1;
+    }
+    int waiting = stat_sum(&shm->stats, STAT_WAITING);
+    int pick = -1;
+    int standby = -1;
+    for (int i = 0; i < MAX_BUSES; i++) {
+        int bus = (after + 1 + i) % MAX_BUSES;
+        if (bus == after || shm->driver_pids[bus] <= 0 || shm_bay_of(shm, bus) >= 0) {
             continue;
         }
-        if (errno != ENOMSG && errno != EIDRM) {
-            perror("msg_recv_ticket: msgrcv failed");
+        /* Other buses' locks may rank below the caller's: peek at their fields */
+        if (SHM_READ(shm->buses[bus].at_station)) {
+            if (SHM_READ(shm->buses[bus].boarding_open) &&
+                (pick < 0 || better_fit(shm->buses[bus].model.capacity.seats,
+                                        shm->buses[pick].model.capacity.seats, waiting))) {
+                pick = bus;
+            }
+        } else if (standby < 0 ||
+                   SHM_READ(shm->buses[bus].return_time) < SHM_READ(shm->buses[standby].return_time)) {
+            standby = bus;
         }
-        return ret;
     }
+    return pick >= 0 ? pick : standby;
 }
 
-/* Receive ticket response from separate response queue */
-ssize_t msg_recv_ticket_resp(ticket_msg_t *msg, long mtype, int flags) {
-    ssize_t ret;
-    while (1) {
-        ret = msgrcv(g_msgid_ticket_resp, msg, sizeof(ticket_msg_t) - sizeof(long), mtype, flags);
-        if (ret >= 0) {
-            return ret;
-        }
-        if (errno == EINTR) {
-            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+/* Booking order of a bus: boarding at a bay (0), due back to one (1), the
+ * rest (2); within a tier by departure, else return time */
+static int book_tier(shm_data_t *shm, int bus, time_t *when) {
+    bus_state_t *b = &shm->buses[bus];
+    int at_station = SHM_READ(b->at_station);
+    int bay = shm_bay_of(shm, bus);
+    *when = bay >= 0 && at_station ? SHM_READ(b->departure_time) :
+            at_station ? 0 : SHM_READ(b->return_time);
+    return bay >= 0 ? !at_station : 2;
+}
+
+/* Entry of `pid` booked on `bus` (-1: any bus), or NULL */
+static booking_t *booking_find(shm_data_t *shm, pid_t pid, int bus) {
+    for (int i = 0; i < BOOKINGS_MAX; i++) {
+        booking_t *e = &shm->bookings[i];
+        if (atomic_load(&e->pid) != pid) {
             continue;
         }
-        if (errno != ENOMSG && errno != EIDRM) {
-            perror("msg_recv_ticket_resp: msgrcv failed");
+        int at = atomic_load(&e->bus);
+        if (at >= 0 && (bus < 0 || at == bus)) {
+            return e;
         }
-        return ret;
     }
+    return NULL;
 }
 
-int msg_send_boarding(boarding_msg_t *msg) {
-    while (1) {
-        if (msgsnd(g_msgid_boarding, msg, sizeof(boarding_msg_t) - sizeof(long), 0) == 0) {
-            return 0;
+static booking_t *booking_claim(shm_data_t *shm, pid_t pid) {
+    for (int i = 0; i < BOOKINGS_MAX; i++) {
+        booking_t *e = &shm->bookings[i];
+        pid_t free_pid = 0;
+        if (atomic_load(&e->pid) == 0 && atomic_compare_exchange_strong(&e->pid, &free_pid, pid)) {
+            return e;
         }
-        if (errno == EINTR) {
-            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
-            continue;
+    }
+    return NULL;
+}
+
+/* Take the entry off the table and, if it was still ours to end, give
+ * its seats back to the bus' ledger */
+static void booking_end(shm_data_t *shm, booking_t *e, pid_t pid) {
+    int bus = atomic_load(&e->bus);
+    int seats = e->seats;
+    int bike = e->bike;
+    if (atomic_compare_exchange_strong(&e->pid, &pid, 0) && bus >= 0) {
+        occupancy_unbook(&shm->buses[bus].booked, seats, bike);
+    }
+}
+
+int shm_book_seat(const wire_passenger_t *p) {
+    shm_data_t *shm = g_shm;
+    if (shm == NULL) {
+        return -1;
+    }
+    booking_t *held = booking_find(shm, p->pid, -1);
+    if (held != NULL) {
+        int bus = atomic_load(&held->bus);
+        if (bus >= 0 && SHM_READ(shm->driver_pids[bus]) > 0) {
+            return bus;
+        }
+    }
+    booking_t *entry = booking_claim(shm, p->pid);
+    if (entry == NULL) {
+        return -1;
+    }
+    entry->seats = p->seat_count;
+    entry->bike = (p->flags & PASSENGER_BIKE) != 0;
+    atomic_store(&entry->bus, -1);
+    int order[MAX_BUSES];
+    int tier[MAX_BUSES];
+    time_t when[MAX_BUSES];
+    int n = 0;
+    for (int bus = 0; bus < MAX_BUSES; bus++) {
+        if (SHM_READ(shm->driver_pids[bus]) <= 0) {
+            continue;
+        }
+        time_t at;
+        int t = book_tier(shm, bus, &at);
+        int i = n++;
+        for (; i > 0 && (tier[i - 1] > t || (tier[i - 1] == t && when[i - 1] > at)); i--) {
+            order[i] = order[i - 1];
+            tier[i] = tier[i - 1];
+            when[i] = when[i - 1];
+        }
+        order[i] = bus;
+        tier[i] = t;
+        when[i] = at;
+    }
+    int bike = (p->flags & PASSENGER_BIKE) != 0;
+    for (int i = 0; i < n; i++) {
+        bus_state_t *b = &shm->buses[order[i]];
+        if (occupancy_book(&b->booked, &b->occupancy, b->model.capacity, p->seat_count, bike)) {
+            atomic_store(&entry->bus, order[i]);
+            return order[i];
+        }
+    }
+    atomic_store(&entry->pid, 0);
+    return -1;
+}
+
+void shm_unbook_seat(int bus, const wire_passenger_t *p) {
+    if (g_shm == NULL || bus < 0 || bus >= MAX_BUSES) {
+        return;
+    }
+    /* Not found: the watchdog or a dead driver's reset got there first */
+    booking_t *e = booking_find(g_shm, p->pid, bus);
+    if (e != NULL) {
+        booking_end(g_shm, e, p->pid);
+    }
+}
+
+int shm_reclaim_bookings(void) {
+    if (g_shm == NULL) {
+        return 0;
+    }
+    int reclaimed = 0;
+    for (int i = 0; i < BOOKINGS_MAX; i++) {
+        booking_t *e = &g_shm->bookings[i];
+        pid_t pid = atomic_load(&e->pid);
+        /* bus < 0: still being booked, the booker ends it either way */
+        if (pid <= 0 || atomic_load(&e->bus) < 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+            continue;
+        }
+        booking_end(g_shm, e, pid);
+        reclaimed++;
+    }
+    return reclaimed;
+}
+
+void shm_drop_bookings(int bus) {
+    if (g_shm == NULL) {
+        return;
+    }
+    for (int i = 0; i < BOOKINGS_MAX; i++) {
+        booking_t *e = &g_shm->bookings[i];
+        pid_t pid = atomic_load(&e->pid);
+        if (pid > 0 && atomic_load(&e->bus) == bus) {
+            atomic_compare_exchange_strong(&e->pid, &pid, 0);
+        }
+    }
+}
+
+void shm_bays_changed(void) {
+    shm_data_t *shm = g_shm;
+    if (shm == NULL) {
+        return;
+    }
+    int boarding = 0;
+    for (int b = 0; b < shm->bays; b++) {
+        int bus = shm->bay_bus[b];
+        boarding += (bus >= 0 && SHM_READ(shm->buses[bus].at_station));
+    }
+    if (boarding == 0 && shm->no_bus_since_ms == 0) {
+        shm->no_bus_since_ms = monotonic_ms();
+    } else if (boarding > 0 && shm->no_bus_since_ms != 0) {
+        shm->no_bus_ms += monotonic_ms() - shm->no_bus_since_ms;
+        shm->no_bus_since_ms = 0;
+    }
+}
+
+long shm_no_bus_ms(void) {
+    shm_data_t *shm = g_shm;
+    if (shm == NULL) {
+        return 0;
+    }
+    long since = shm->no_bus_since_ms;
+    return shm->no_bus_ms + (since != 0 ? monotonic_ms() - since : 0);
+}
+
+static void events_wait(_Atomic uint32_t *events, uint32_t seen, int timeout_ms) {
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    futex_wait(events, seen, &timeout);
+}
+
+void shm_bus_wait(uint32_t seen, int timeout_ms) {
+    if (g_shm != NULL) {
+        events_wait(&g_shm->bus_events, seen, timeout_ms);
+    }
+}
+
+void shm_board_wait(uint32_t seen, int timeout_ms) {
+    if (g_shm != NULL) {
+        events_wait(&g_shm->board_events, seen, timeout_ms);
+    }
+}
+
+ipc_transport_t ipc_get_transport(void) {
+    return g_transport;
+}
+
+const char *ipc_transport_name(void) {
+    switch (g_transport) {
+        case IPC_TRANSPORT_RING: return "ring";
+        case IPC_TRANSPORT_MQ:   return "mq";
+        case IPC_TRANSPORT_SOCK: return "sock";
+        default:                 return "sysv";
+    }
+}
+
+int ipc_queue_slots_enabled(int slots_sem) {
+    if (g_transport == IPC_TRANSPORT_RING && slots_sem == SEM_TICKET_QUEUE_SLOTS) {
+        return 0;
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK) {
+        return 0;
+    }
+    return 1;
+}
+
+int ipc_get_msgid_ticket(void) {
+    return g_msgid_ticket;
+}
+
+int ipc_get_msgid_boarding(void) {
+    return g_msgid_boarding;
+}
+
+int ipc_get_msgid_dispatch(void) {
+    return g_msgid_dispatch;
+}
+
+int ipc_mailbox_open(void) {
+    if (g_shm == NULL || g_transport == IPC_TRANSPORT_SOCK) {
+        return -1;  /* Socket transport: replies come back over our own socket */
+    }
+    if (g_mailbox == -1) {
+        pid_t self = getpid();
+        g_mailbox = mailbox_claim(g_shm->reply_mailboxes, REPLY_MAILBOXES, self % REPLY_MAILBOXES, self);
+    }
+    return g_mailbox;
+}
+
+void ipc_mailbox_close(void) {
+    if (g_mailbox != -1 && g_shm != NULL) {
+        mailbox_release(&g_shm->reply_mailboxes[g_mailbox]);
+    }
+    g_mailbox = -1;
+}
+
+/* Stamp a request with a fresh id and reply address (our mailbox, or none;
+ * with sockets the reply goes to our own endpoint, found by pid) */
+static void stamp_reply(int16_t *slot, uint32_t *request_id) {
+    if (g_mailbox != -1 && g_shm != NULL) {
+        g_mailbox_token = mailbox_arm(&g_shm->reply_mailboxes[g_mailbox]);
+        *slot = (int16_t)g_mailbox;
+        *request_id = g_mailbox_token;
+    } else {
+        *slot = -1;
+        *request_id = ++g_request_seq;
+    }
+}
+
+/* Deliver a reply into the requester's mailbox. Returns 1 if the request
+ * had no mailbox (caller uses the response queue), otherwise 0; a stale
+ * token means the requester gave up and the reply is dropped. */
+static int mailbox_deliver(int slot, uint32_t token, const void *msg, size_t len, int provisional) {
+    if (slot < 0 || slot >= REPLY_MAILBOXES || g_shm == NULL) {
+        return 1;
+    }
+    mailbox_t *box = &g_shm->reply_mailboxes[slot];
+    if ((provisional ? mailbox_post_provisional(box, token, msg, len)
+                     : mailbox_post(box, token, msg, len)) == -1) {
+        log_master(LOG_WARN, "Dropped stale reply for mailbox %d", slot);
+    }
+    return 0;
+}
+
+/* Wait on our own mailbox. Like a blocking msgrcv() on the response queue
+ * this only gives up once the queue (i.e. the whole IPC set) is removed. */
+static ssize_t mailbox_receive(int resp_msgid, void *msg, size_t len) {
+    struct timespec slice = { 0, MAILBOX_WAIT_SLICE_MS * 1000000L };
+    while (1) {
+        if (g_shm == NULL) {
+            errno = EIDRM;
+            return -1;
+        }
+        if (mailbox_wait(&g_shm->reply_mailboxes[g_mailbox], g_mailbox_token, msg, len, &slice) >= 0) {
+            return (ssize_t)(len - sizeof(long));
+        }
+        if (errno == EIDRM) {
+            return -1;
+        }
+        struct msqid_ds buf;
+        if (msgctl(resp_msgid, IPC_STAT, &buf) == -1) {
+            errno = EIDRM;
+            return -1;
+        }
+    }
+}
+
+/* 
+ * Separate queues for requests and responses guarantee responses always have room.
+ * Requests: limited by semaphores
+ * Responses: go to dedicated queue, never compete with requests
+ */
+
+/* Ring transport: producers block only while the ring is full */
+static int ring_send(shm_ring_t *ring, const void *msg, size_t len) {
+    struct timespec slice = { 0, RING_WAIT_SLICE_MS * 1000000L };
+    while (shm_ring_try_enqueue(ring, msg, len) == -1) {
+        if (errno != EAGAIN) {
+            perror("ring_send: enqueue failed");
+            return -1;
+        }
+        if (!g_shm->simulation_running) {
+            errno = EIDRM;  /* Same meaning as a removed SysV queue */
+            return -1;
+        }
+        shm_ring_wait_space(ring, &slice);
+    }
+    return 0;
+}
+
+/* Ring transport: returns the mtext size like msgrcv(); consumers block only
+ * while the ring is empty and get EINTR back after an idle slice. */
+static ssize_t ring_recv(shm_ring_t *ring, void *msg, size_t len, int flags) {
+    if (shm_ring_try_dequeue(ring, msg, len) == 0) {
+        return (ssize_t)(len - sizeof(long));
+    }
+    if (flags & IPC_NOWAIT) {
+        errno = ENOMSG;
+        return -1;
+    }
+    struct timespec slice = { 0, RING_WAIT_SLICE_MS * 1000000L };
+    shm_ring_wait_items(ring, &slice);
+    if (shm_ring_try_dequeue(ring, msg, len) == 0) {
+        return (ssize_t)(len - sizeof(long));
+    }
+    errno = g_shm->simulation_running ? EINTR : EIDRM;
+    return -1;
+}
+
+/* mq transport: mq_timed* take an absolute CLOCK_REALTIME deadline */
+static struct timespec mq_deadline_in(long ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/* Unlinking a queue does not wake anyone blocked on it, so both directions
+ * wait in slices and give up once the run is over (EIDRM, like SysV). */
+static int mq_send_msg(mqd_t q, const void *msg, size_t len, unsigned int prio) {
+    while (1) {
+        struct timespec until = mq_deadline_in(MQ_WAIT_SLICE_MS);
+        if (mq_timedsend(q, msg, len, prio, &until) == 0) {
+            return 0;
+        }
+        if (errno != EINTR && errno != ETIMEDOUT) {
+            perror("mq_send_msg: mq_timedsend failed");
+            return -1;
+        }
+        if (g_shm == NULL || !g_shm->simulation_running) {
+            errno = EIDRM;
+            return -1;
+        }
+    }
+}
+
+/* Returns the mtext size like msgrcv(). Highest priority first; an idle
+ * slice ends in -1/EINTR, reaching `deadline` (if any) in -1/ETIMEDOUT. */
+static ssize_t mq_recv_msg(mqd_t q, void *msg, size_t len, int flags,
+                           const struct timespec *deadline) {
+    struct timespec until = mq_deadline_in((flags & IPC_NOWAIT) ? 0 : MQ_WAIT_SLICE_MS);
+    int capped = 0;
+    if (deadline != NULL && !(flags & IPC_NOWAIT) &&
+        (deadline->tv_sec < until.tv_sec ||
+         (deadline->tv_sec == until.tv_sec && deadline->tv_nsec < until.tv_nsec))) {
+        until = *deadline;
+        capped = 1;
+    }
+    ssize_t n = mq_timedreceive(q, msg, len, NULL, &until);
+    if (n >= 0) {
+        return n - (ssize_t)sizeof(long);
+    }
+    if (errno != ETIMEDOUT && errno != EINTR) {
+        perror("mq_recv_msg: mq_timedreceive failed");
+        return -1;
+    }
+    if (g_shm == NULL || !g_shm->simulation_running) {
+        errno = EIDRM;
+    } else if (flags & IPC_NOWAIT) {
+        errno = ENOMSG;
+    } else {
+        errno = capped ? ETIMEDOUT : EINTR;
+    }
+    return -1;
+}
+
+/* Socket transport: abstract-namespace AF_UNIX datagram addresses, so there
+ * is nothing to unlink and an endpoint disappears with its process */
+static socklen_t sock_addr(struct sockaddr_un *addr, ipc_endpoint_t kind, int id) {
+    static const char *const kinds[] = { "office", "bus", "passenger" };
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "%s.%d.%s.%d",
+                     SOCK_NAME_PREFIX, ipc_get_instance(), kinds[kind], id);
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + (size_t)n);
+}
+
+int ipc_endpoint_open(ipc_endpoint_t kind, int id) {
+    if (kind == IPC_ENDPOINT_BUS) {
+        g_bus = id;
+    }
+    if (g_transport != IPC_TRANSPORT_SOCK || g_sock != -1) {
+        return 0;
+    }
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("ipc_endpoint_open: socket failed");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    socklen_t len = sock_addr(&addr, kind, id);
+    if (bind(fd, (struct sockaddr *)&addr, len) == -1) {
+        perror("ipc_endpoint_open: bind failed");
+        close(fd);
+        return -1;
+    }
+    /* Blocking send/recv give up after a slice so callers can re-check shutdown */
+    struct timeval slice = { 0, SOCK_WAIT_SLICE_MS * 1000L };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &slice, sizeof(slice));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &slice, sizeof(slice));
+    g_sock = fd;
+    return 0;
+}
+
+/* One datagram to an endpoint. -1 with EAGAIN: its receive queue is full
+ * (the backpressure); ECONNREFUSED: nobody has that endpoint bound. */
+static int sock_send_to(ipc_endpoint_t kind, int id, const void *msg, size_t len, int flags) {
+    struct sockaddr_un addr;
+    socklen_t alen = sock_addr(&addr, kind, id);
+    while (1) {
+        if (sendto(g_sock, msg, len, flags, (struct sockaddr *)&addr, alen) == (ssize_t)len) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+static int sock_run_over(void) {
+    return g_shm == NULL || !g_shm->simulation_running;
+}
+
+/* Any office with room takes the request, so a stopped or killed office is
+ * simply skipped; with all of them full wait (a slice) on our usual one. */
+static int sock_send_ticket(const ticket_msg_t *msg) {
+    int first = (int)(getpid() % TICKET_OFFICES);
+    while (1) {
+        for (int i = 0; i < TICKET_OFFICES; i++) {
+            int office = (first + i) % TICKET_OFFICES;
+            if (sock_send_to(IPC_ENDPOINT_OFFICE, office, msg, sizeof(*msg), MSG_DONTWAIT) == 0) {
+                return 0;
+            }
+            if (errno != EAGAIN && errno != ECONNREFUSED && errno != ENOENT) {
+                perror("sock_send_ticket: sendto failed");
+                return -1;
+            }
+        }
+        if (sock_run_over()) {
+            errno = EIDRM;
+            return -1;
+        }
+        if (sock_send_to(IPC_ENDPOINT_OFFICE, first, msg, sizeof(*msg), 0) == 0) {
+            return 0;
+        }
+        if (errno == ECONNREFUSED || errno == ENOENT) {
+            usleep(SOCK_WAIT_SLICE_MS * 1000);
+        }
+    }
+}
+
+/* Drain up to `max` datagrams of `len` bytes with one recvmmsg(). A blocking
+ * call waits in poll() first, at most a slice or until `deadline` (0: none):
+ * -1/EINTR after an idle slice, -1/ETIMEDOUT at the deadline. */
+static int sock_recv_batch(void *msgs, size_t len, int max, int flags, time_t deadline) {
+    struct mmsghdr hdrs[SOCK_BATCH];
+    struct iovec iov[SOCK_BATCH];
+    if (max > SOCK_BATCH) {
+        max = SOCK_BATCH;
+    }
+    memset(hdrs, 0, sizeof(hdrs));
+    for (int i = 0; i < max; i++) {
+        iov[i].iov_base = (char *)msgs + (size_t)i * len;
+        iov[i].iov_len = len;
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+    
+    int timed_out = 0;
+    while (1) {
+        long wait_ms = SOCK_WAIT_SLICE_MS;
+        int capped = 0;
+        if (deadline != 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            long left = (long)(deadline - now.tv_sec) * 1000L - now.tv_nsec / 1000000L;
+            if (left < wait_ms) {
+                wait_ms = left > 0 ? left : 0;
+                capped = 1;
+            }
+        }
+        /* One syscall per batch: block for the first datagram (up to the
+         * SO_RCVTIMEO slice) and take whatever else is queued behind it */
+        int blocking = !(flags & IPC_NOWAIT) && !capped && !timed_out;
+        int n = recvmmsg(g_sock, hdrs, (unsigned int)max,
+                         blocking ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+        if (n > 0) {
+            int kept = 0;
+            for (int i = 0; i < n; i++) {
+                if (hdrs[i].msg_len != len) {
+                    continue;  /* Not one of ours */
+                }
+                if (kept != i) {
+                    memcpy((char *)msgs + (size_t)kept * len, iov[i].iov_base, len);
+                }
+                kept++;
+            }
+            return kept;
+        }
+        if (n == -1 && errno != EAGAIN && errno != EINTR) {
+            perror("sock_recv_batch: recvmmsg failed");
+            return -1;
+        }
+        if (sock_run_over()) {
+            errno = EIDRM;
+            return -1;
+        }
+        if (flags & IPC_NOWAIT) {
+            errno = ENOMSG;
+            return -1;
+        }
+        if (blocking) {
+            errno = EINTR;  /* Slice over or signal: let the caller re-check its state */
+            return -1;
+        }
+        if (timed_out) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        
+        /* Departure is closer than a slice: wait exactly that long */
+        struct pollfd pfd = { .fd = g_sock, .events = POLLIN, .revents = 0 };
+        int ready = poll(&pfd, 1, (int)wait_ms);
+        if (ready == 0) {
+            timed_out = 1;  /* One last look, then report the deadline */
+        } else if (ready == -1 && errno != EINTR) {
+            perror("sock_recv_batch: poll failed");
+            return -1;
+        }
+    }
+}
+
+/* Replies go straight to each passenger's endpoint (by pid = mtype), the
+ * whole batch in one sendmmsg(). A passenger that is gone loses its reply. */
+static int sock_send_replies(const void *msgs, size_t len, int count) {
+    struct mmsghdr hdrs[SOCK_BATCH];
+    struct iovec iov[SOCK_BATCH];
+    struct sockaddr_un addrs[SOCK_BATCH];
+    int failed = 0;
+    
+    while (count > 0) {
+        int n = count < SOCK_BATCH ? count : SOCK_BATCH;
+        memset(hdrs, 0, sizeof(hdrs));
+        for (int i = 0; i < n; i++) {
+            const char *msg = (const char *)msgs + (size_t)i * len;
+            long pid;
+            memcpy(&pid, msg, sizeof(pid));
+            iov[i].iov_base = (void *)msg;
+            iov[i].iov_len = len;
+            hdrs[i].msg_hdr.msg_name = &addrs[i];
+            hdrs[i].msg_hdr.msg_namelen = sock_addr(&addrs[i], IPC_ENDPOINT_PASSENGER, (int)pid);
+            hdrs[i].msg_hdr.msg_iov = &iov[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int sent = 0;
+        while (sent < n) {
+            int r = sendmmsg(g_sock, hdrs + sent, (unsigned int)(n - sent), MSG_DONTWAIT);
+            if (r > 0) {
+                sent += r;
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            /* The first remaining reply failed; a full queue gets one blocking
+             * try (a slice), a missing passenger is skipped */
+            if (errno != EAGAIN || sendmsg(g_sock, &hdrs[sent].msg_hdr, 0) == -1) {
+                failed++;
+            }
+            sent++;
+        }
+        msgs = (const char *)msgs + (size_t)n * len;
+        count -= n;
+    }
+    return failed == 0 ? 0 : -1;
+}
+
+/* Our reply: one recv() per slice; replies to abandoned requests are skipped.
+ * Like the mailbox, gives up once the response queue (the IPC set) is gone. */
+static ssize_t sock_receive_reply(int resp_msgid, void *msg, size_t len) {
+    while (1) {
+        ssize_t n = recv(g_sock, msg, len, 0);
+        if (n == (ssize_t)len) {
+            uint32_t request_id;
+            memcpy(&request_id, (const char *)msg + offsetof(ticket_msg_t, request_id), sizeof(request_id));
+            if (request_id == g_request_seq) {
+                return (ssize_t)(len - sizeof(long));
+            }
+            continue;
+        }
+        if (n == -1 && errno != EAGAIN && errno != EINTR) {
+            perror("sock_receive_reply: recv failed");
+            return -1;
+        }
+        struct msqid_ds buf;
+        if (msgctl(resp_msgid, IPC_STAT, &buf) == -1) {
+            errno = EIDRM;
+            return -1;
+        }
+    }
+}
+
+/* Count of queued SysV requests of class type `mtype` (see ticket_queued);
+ * types with no counter (booked) are left alone */
+static void queued_add(_Atomic int *counts, long size, long mtype, int delta) {
+    if (g_shm != NULL && mtype > 0 && mtype < size) {
+        atomic_fetch_add_explicit(&counts[mtype], delta, memory_order_relaxed);
+    }
+}
+
+#define TICKET_QUEUED(mtype, delta) \
+    queued_add(g_shm->ticket_queued, MSG_TICKET_REQUEST_VIP + 1, (mtype), (delta))
+#define BOARD_QUEUED(mtype, delta) \
+    queued_add(g_shm->board_queued, MSG_BOARD_REQUEST_BOOKED, (mtype), (delta))
+
+/* Whether msgrcv() with selector `mtype` may find a counted request: types
+ * up to -mtype for a range, any for 0 (booked ones are not counted) */
+static int board_queued_any(long mtype) {
+    if (g_shm == NULL || mtype == 0) {
+        return 1;
+    }
+    long lo = mtype < 0 ? 1 : mtype;
+    long hi = mtype < 0 ? -mtype : mtype;
+    for (long t = lo; t <= hi && t < MSG_BOARD_REQUEST_BOOKED; t++) {
+        if (atomic_load_explicit(&g_shm->board_queued[t], memory_order_relaxed) > 0) {
+            return 1;
+        }
+    }
+    return hi >= MSG_BOARD_REQUEST_BOOKED;
+}
+
+static int ticket_queued_any(long mtype) {
+    return g_shm == NULL || mtype <= 0 || mtype > MSG_TICKET_REQUEST_VIP ||
+           atomic_load_explicit(&g_shm->ticket_queued[mtype], memory_order_relaxed) > 0;
+}
+
+int msg_send_ticket(ticket_msg_t *msg) {
+    stamp_reply(&msg->reply_slot, &msg->request_id);
+    if (g_transport == IPC_TRANSPORT_RING && g_shm != NULL) {
+        return ring_send(&g_shm->ticket_ring, msg, sizeof(ticket_msg_t));
+    }
+    if (g_transport == IPC_TRANSPORT_MQ) {
+        return mq_send_msg(g_mq_ticket, msg, sizeof(ticket_msg_t), MQ_PRIO_REGULAR);
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_send_ticket(msg);
+    }
+    TICKET_QUEUED(msg->mtype, 1);
+    while (1) {
+        if (msgsnd(g_msgid_ticket, msg, sizeof(ticket_msg_t) - sizeof(long), 0) == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+            continue;
+        }
+        if (errno != EIDRM) {
+            perror("msg_send_ticket: msgsnd failed");
+        }
+        TICKET_QUEUED(msg->mtype, -1);
+        return -1;
+    }
+}
+
+/* Send ticket response to separate response queue */
+int msg_send_ticket_resp(ticket_msg_t *msg) {
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_send_replies(msg, sizeof(ticket_msg_t), 1);
+    }
+    if (mailbox_deliver(msg->reply_slot, msg->request_id, msg, sizeof(ticket_msg_t), 0) == 0) {
+        return 0;
+    }
+    while (1) {
+        if (msgsnd(g_msgid_ticket_resp, msg, sizeof(ticket_msg_t) - sizeof(long), 0) == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+            continue;
+        }
+        if (errno != EIDRM) {
+            perror("msg_send_ticket_resp: msgsnd failed");
+        }
+        return -1;
+    }
+}
+
+ssize_t msg_recv_ticket(ticket_msg_t *msg, long mtype, int flags) {
+    if (g_transport == IPC_TRANSPORT_RING && g_shm != NULL) {
+        return ring_recv(&g_shm->ticket_ring, msg, sizeof(ticket_msg_t), flags);  /* Only requests in the ring */
+    }
+    if (g_transport == IPC_TRANSPORT_MQ) {
+        return mq_recv_msg(g_mq_ticket, msg, sizeof(ticket_msg_t), flags, NULL);  /* Only requests in the mq */
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_recv_batch(msg, sizeof(ticket_msg_t), 1, flags, 0) == -1 ? -1 :
+               (ssize_t)(sizeof(ticket_msg_t) - sizeof(long));
+    }
+    ssize_t ret;
+    while (1) {
+        ret = msgrcv(g_msgid_ticket, msg, sizeof(ticket_msg_t) - sizeof(long), mtype, flags);
+        if (ret >= 0) {
+            TICKET_QUEUED(msg->mtype, -1);
+            return ret;
+        }
+        if (errno == EINTR) {
+            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+            continue;
+        }
+        if (errno != ENOMSG && errno != EIDRM) {
+            perror("msg_recv_ticket: msgrcv failed");
+        }
+        return ret;
+    }
+}
+
+/* Receive ticket response from separate response queue */
+ssize_t msg_recv_ticket_resp(ticket_msg_t *msg, long mtype, int flags) {
+    if (g_mailbox != -1 && !(flags & IPC_NOWAIT)) {
+        return mailbox_receive(g_msgid_ticket_resp, msg, sizeof(ticket_msg_t));
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1 && !(flags & IPC_NOWAIT)) {
+        return sock_receive_reply(g_msgid_ticket_resp, msg, sizeof(ticket_msg_t));
+    }
+    ssize_t ret;
+    while (1) {
+        ret = msgrcv(g_msgid_ticket_resp, msg, sizeof(ticket_msg_t) - sizeof(long), mtype, flags);
+        if (ret >= 0) {
+            return ret;
+        }
+        if (errno == EINTR) {
+            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+            continue;
+        }
+        if (errno != ENOMSG && errno != EIDRM) {
+            perror("msg_recv_ticket_resp: msgrcv failed");
+        }
+        return ret;
+    }
+}
+
+int msg_send_boarding(boarding_msg_t *msg) {
+    stamp_reply(&msg->reply_slot, &msg->request_id);
+    if (g_board_mq) {
+        unsigned int prio = (msg->passenger.flags & PASSENGER_VIP) ? MQ_PRIO_VIP : MQ_PRIO_REGULAR;
+        return mq_send_msg(g_mq_boarding, msg, sizeof(boarding_msg_t), prio);
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        /* Addressed to the bus the passenger saw as active; a full or missing
+         * bus returns EAGAIN/ECONNREFUSED and the passenger tries again later */
+        if (sock_send_to(IPC_ENDPOINT_BUS, msg->bus_id, msg, sizeof(boarding_msg_t), MSG_DONTWAIT) == 0 ||
+            (errno == EAGAIN &&
+             sock_send_to(IPC_ENDPOINT_BUS, msg->bus_id, msg, sizeof(boarding_msg_t), 0) == 0)) {
+            return 0;
+        }
+        return -1;
+    }
+    BOARD_QUEUED(msg->mtype, 1);
+    while (1) {
+        if (msgsnd(g_msgid_boarding, msg, sizeof(boarding_msg_t) - sizeof(long), 0) == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            /* Signal received (e.g., SIGTSTP/SIGCONT) - retry */
+            continue;
         }
         if (errno != EIDRM && errno != EINVAL) {
             perror("msg_send_boarding: msgsnd failed");
         }
+        BOARD_QUEUED(msg->mtype, -1);
+        return -1;
+    }
+}
+
+/* Put a request a driver took back on the boarding ingress, reply address
+ * and all, without waiting - it takes a queue slot like a new request:
+ * the POSIX boarding queue with mq boarding, with sockets bus msg->bus_id's
+ * socket, else the shared SysV boarding queue. -1 with EAGAIN when full. */
+int msg_requeue_boarding(boarding_msg_t *msg) {
+    if (g_board_mq) {
+        struct mq_attr attr;
+        if (mq_getattr(g_mq_boarding, &attr) == 0 && attr.mq_curmsgs >= attr.mq_maxmsg) {
+            errno = EAGAIN;
+            return -1;
+        }
+        unsigned int prio = (msg->passenger.flags & PASSENGER_VIP) ? MQ_PRIO_VIP : MQ_PRIO_REGULAR;
+        return mq_send_msg(g_mq_boarding, msg, sizeof(boarding_msg_t), prio);
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_send_to(IPC_ENDPOINT_BUS, msg->bus_id, msg, sizeof(boarding_msg_t), MSG_DONTWAIT);
+    }
+    BOARD_QUEUED(msg->mtype, 1);
+    if (msgsnd(g_msgid_boarding, msg, sizeof(boarding_msg_t) - sizeof(long), IPC_NOWAIT) == -1) {
+        BOARD_QUEUED(msg->mtype, -1);
         return -1;
     }
+    return 0;
 }
 
-/* Send boarding response to separate response queue - always has room */
 int msg_send_boarding_resp(boarding_msg_t *msg) {
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_send_replies(msg, sizeof(boarding_msg_t), 1);
+    }
+    if (mailbox_deliver(msg->reply_slot, msg->request_id, msg, sizeof(boarding_msg_t),
+                        msg->reply == MSG_BOARD_WAIT) == 0) {
+        return 0;
+    }
     while (1) {
         if (msgsnd(g_msgid_boarding_resp, msg, sizeof(boarding_msg_t) - sizeof(long), 0) == 0) {
             return 0;
@@ -547,10 +1946,19 @@ int msg_send_boarding_resp(boarding_msg_t *msg) {
 }
 
 ssize_t msg_recv_boarding(boarding_msg_t *msg, long mtype, int flags) {
+    if (g_board_mq) {
+        /* Priorities replace the mtype selection: VIP requests come out first */
+        return mq_recv_msg(g_mq_boarding, msg, sizeof(boarding_msg_t), flags, NULL);
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_recv_batch(msg, sizeof(boarding_msg_t), 1, flags, 0) == -1 ? -1 :
+               (ssize_t)(sizeof(boarding_msg_t) - sizeof(long));
+    }
     ssize_t ret;
     while (1) {
         ret = msgrcv(g_msgid_boarding, msg, sizeof(boarding_msg_t) - sizeof(long), mtype, flags);
         if (ret >= 0) {
+            BOARD_QUEUED(msg->mtype, -1);
             return ret;
         }
         if (errno == EINTR) {
@@ -564,8 +1972,370 @@ ssize_t msg_recv_boarding(boarding_msg_t *msg, long mtype, int flags) {
     }
 }
 
+/* Only there to interrupt msgrcv(): installed without SA_RESTART */
+static void deadline_alarm(int sig) {
+    (void)sig;
+}
+
+/* Arm a CLOCK_REALTIME timer that raises SIGALRM at `deadline` and then
+ * every DEADLINE_REFIRE_MS until disarmed. -1 if no timer can be had. */
+static int deadline_timer_arm(time_t deadline) {
+    if (g_deadline_timer_state == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sigemptyset(&sa.sa_mask);
+        sa.sa_handler = deadline_alarm;
+        sa.sa_flags = 0;
+
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_SIGNAL;
+        sev.sigev_signo = SIGALRM;
+
+        g_deadline_timer_state = -1;
+        if (sigaction(SIGALRM, &sa, NULL) == -1) {
+            perror("deadline_timer_arm: sigaction SIGALRM");
+        } else if (timer_create(CLOCK_REALTIME, &sev, &g_deadline_timer) == -1) {
+            perror("deadline_timer_arm: timer_create");
+        } else {
+            g_deadline_timer_state = 1;
+        }
+    }
+    if (g_deadline_timer_state != 1) {
+        return -1;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline;
+    its.it_interval.tv_nsec = DEADLINE_REFIRE_MS * 1000000L;
+    return timer_settime(g_deadline_timer, TIMER_ABSTIME, &its, NULL);
+}
+
+static void deadline_timer_disarm(void) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    timer_settime(g_deadline_timer, 0, &its, NULL);
+}
+
+ssize_t msg_recv_boarding_until(boarding_msg_t *msg, long mtype, int flags, time_t deadline) {
+    if (g_board_mq) {
+        struct timespec until = { deadline, 0 };
+        return mq_recv_msg(g_mq_boarding, msg, sizeof(boarding_msg_t), 0, &until);
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_recv_batch(msg, sizeof(boarding_msg_t), 1, 0, deadline) == -1 ? -1 :
+               (ssize_t)(sizeof(boarding_msg_t) - sizeof(long));
+    }
+    
+    /* Under load a request is already queued: take it without touching the timer */
+    size_t len = sizeof(boarding_msg_t) - sizeof(long);
+    ssize_t ret = msgrcv(g_msgid_boarding, msg, len, mtype, flags | IPC_NOWAIT);
+    if (ret >= 0) {
+        BOARD_QUEUED(msg->mtype, -1);
+    }
+    if (ret >= 0 || errno != ENOMSG) {
+        return ret;
+    }
+    if (time(NULL) >= deadline) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if (deadline_timer_arm(deadline) == -1) {
+        return msg_recv_boarding(msg, mtype, flags);
+    }
+    ret = msgrcv(g_msgid_boarding, msg, len, mtype, flags);
+    int saved_errno = errno;
+    deadline_timer_disarm();
+    if (ret >= 0) {
+        BOARD_QUEUED(msg->mtype, -1);
+    }
+    if (ret == -1 && saved_errno == EINTR && time(NULL) >= deadline) {
+        saved_errno = ETIMEDOUT;
+    }
+    /* Any other signal comes back as EINTR, so the driver sees SIGUSR1 at once */
+    if (ret == -1 && saved_errno != EINTR && saved_errno != ETIMEDOUT &&
+        saved_errno != EIDRM && saved_errno != EINVAL) {
+        perror("msg_recv_boarding_until: msgrcv failed");
+    }
+    errno = saved_errno;
+    return ret;
+}
+
+/* SysV queue: the next request of the first class in scheduler order that
+ * has one; with none queued, whichever comes first. Classes counted empty
+ * are not probed. */
+static int ticket_recv_classes(ticket_msg_t *msg, int flags) {
+    fairq_t *q = class_sched();
+    long now = monotonic_ms();
+    int order[CLASS_COUNT];
+    fairq_order(q, now, order);
+    for (int k = 0; k < CLASS_COUNT; k++) {
+        long mtype = ticket_request_type(order[k]);
+        if (ticket_queued_any(mtype) && msg_recv_ticket(msg, mtype, IPC_NOWAIT) != -1) {
+            fairq_served(q, order[k], now);
+            return 1;
+        }
+        fairq_idle(q, order[k], now);
+    }
+    if ((flags & IPC_NOWAIT) || msg_recv_ticket(msg, 0, flags) == -1) {
+        return -1;
+    }
+    fairq_served(q, passenger_class(&msg->passenger), monotonic_ms());
+    return 1;
+}
+
+int msg_recv_ticket_batch(ticket_msg_t *msgs, int max, long mtype, int flags) {
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        int n = sock_recv_batch(msgs, sizeof(ticket_msg_t), max, flags, 0);
+        class_arrange(msgs, sizeof(ticket_msg_t), n);
+        return n;
+    }
+    if (g_transport == IPC_TRANSPORT_SYSV && !class_sched()->fifo) {
+        return ticket_recv_classes(msgs, flags);
+    }
+    return msg_recv_ticket(msgs, mtype, flags) == -1 ? -1 : 1;
+}
+
+int msg_send_ticket_resp_batch(ticket_msg_t *msgs, int count) {
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_send_replies(msgs, sizeof(ticket_msg_t), count);
+    }
+    int rc = 0;
+    for (int i = 0; i < count; i++) {
+        if (msg_send_ticket_resp(&msgs[i]) == -1) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+/* msgrcv() selectors, oldest first, for exactly the requests that fit
+ * `seats` free seats and `bikes` free bike places; returns how many (0 if
+ * nothing fits). The types rise with the room they need, so with two
+ * seats one range does: everything with a rack, all but cyclists without.
+ * With the last seat it is walk-ons, plus one-seat cyclists while a rack
+ * is free - those sit above the families, so they take a second selector;
+ * the first one covers the walk-ons. */
+static int boarding_classes(int seats, int bikes, long mtype[2]) {
+    if (seats <= 0) {
+        return 0;
+    }
+    if (seats >= 2) {
+        /* The queue holds nothing but boarding requests */
+        mtype[0] = bikes > 0 ? 0 : -MSG_BOARD_REQUEST_FAMILY;
+        return 1;
+    }
+    mtype[0] = -MSG_BOARD_REQUEST_SENIOR;  /* VIP and other walk-ons */
+    mtype[1] = MSG_BOARD_REQUEST_BIKE;
+    return bikes > 0 ? 2 : 1;
+}
+
+/* Oldest request the selectors of boarding_classes() give, without waiting */
+static ssize_t boarding_recv_fitting(boarding_msg_t *msg, int seats, int bikes) {
+    long mtype[2];
+    int count = boarding_classes(seats, bikes, mtype);
+    for (int i = 0; i < count; i++) {
+        if (board_queued_any(mtype[i]) && msg_recv_boarding(msg, mtype[i], IPC_NOWAIT) != -1) {
+            return 0;
+        }
+    }
+    errno = ENOMSG;
+    return -1;
+}
+
+/* Wait for a request that fits, until `deadline` (0: no limit, or just
+ * `flags` - IPC_NOWAIT). Only the first selector is waited on: a lone
+ * cyclist for the last seat does not wake us, the next batch takes it. */
+static ssize_t boarding_wait_fitting(boarding_msg_t *msg, int seats, int bikes,
+                                     int flags, time_t deadline) {
+    long mtype[2];
+    int count = boarding_classes(seats, bikes, mtype);
+    if (count == 0) {
+        errno = ENOMSG;
+        return -1;
+    }
+    if (count > 1 && board_queued_any(mtype[1]) && msg_recv_boarding(msg, mtype[1], IPC_NOWAIT) != -1) {
+        return 0;
+    }
+    return (flags & IPC_NOWAIT) || deadline == 0 ? msg_recv_boarding(msg, mtype[0], flags)
+                                                 : msg_recv_boarding_until(msg, mtype[0], 0, deadline);
+}
+
+/* Room a class' boarding queue needs (boarding_class): VIP carries only
+ * walk-ons, a VIP with a bike or a child queues with that class */
+static int boarding_class_fits(int cls, int seats, int bikes) {
+    switch (cls) {
+        case CLASS_VIP:
+        case CLASS_REGULAR:
+        case CLASS_SENIOR: return seats >= 1;
+        case CLASS_FAMILY: return seats >= 2;
+        case CLASS_BIKE:   return seats >= 1 && bikes > 0;  /* At least its one-seat type */
+        default:           return 0;
+    }
+}
+
+/* A queued request of class `cls` that fits, without waiting; types
+ * counted empty are not probed. Cyclists come under two types by the
+ * seats they need. */
+static ssize_t boarding_recv_class(boarding_msg_t *msg, int cls, int seats) {
+    long mtype = boarding_request_type(cls);
+    if (board_queued_any(mtype) && msg_recv_boarding(msg, mtype, IPC_NOWAIT) != -1) {
+        return 0;
+    }
+    if (cls == CLASS_BIKE && seats >= 2 && board_queued_any(MSG_BOARD_REQUEST_BIKE_FAMILY)) {
+        return msg_recv_boarding(msg, MSG_BOARD_REQUEST_BIKE_FAMILY, IPC_NOWAIT);
+    }
+    return -1;
+}
+
+static void boarding_room_take(const boarding_msg_t *msg, int *seats, int *bikes) {
+    *seats -= msg->passenger.seat_count;
+    *bikes -= (msg->passenger.flags & PASSENGER_BIKE) != 0;
+}
+
+/* SysV queue with --sched=fifo: VIP walk-ons already waiting first; then
+ * the oldest requests of the classes that still fit, until the bus would
+ * be full. Whatever does not fit stays queued for the next bus. */
+static int boarding_recv_classes(boarding_msg_t *msgs, int max, int seats, int bikes,
+                                 int flags, time_t deadline) {
+    int n = 0;
+    while (n < max && boarding_class_fits(CLASS_VIP, seats, bikes) &&
+           board_queued_any(MSG_BOARD_REQUEST_VIP) &&
+           msg_recv_boarding(&msgs[n], MSG_BOARD_REQUEST_VIP, IPC_NOWAIT) != -1) {
+        boarding_room_take(&msgs[n++], &seats, &bikes);
+    }
+    if (n == 0) {
+        if (seats <= 0) {
+            return 0;
+        }
+        if (boarding_wait_fitting(msgs, seats, bikes, flags, deadline) == -1) {
+            return -1;
+        }
+        boarding_room_take(&msgs[n++], &seats, &bikes);
+    }
+    while (n < max && boarding_recv_fitting(&msgs[n], seats, bikes) != -1) {
+        boarding_room_take(&msgs[n++], &seats, &bikes);
+    }
+    return n;
+}
+
+/* SysV queue, weighted: each request from the first class in scheduler
+ * order that still fits and has one queued, until the bus would be full;
+ * with nothing queued that fits, wait for the first that does. */
+static int boarding_recv_fair(boarding_msg_t *msgs, int max, int seats, int bikes,
+                              int flags, time_t deadline) {
+    fairq_t *q = class_sched();
+    unsigned empty = 0;  /* Classes seen with nothing queued */
+    int n = 0;
+    while (n < max) {
+        long now = monotonic_ms();
+        int order[CLASS_COUNT];
+        fairq_order(q, now, order);
+        int got = -1;
+        for (int k = 0; k < CLASS_COUNT && got < 0; k++) {
+            int c = order[k];
+            if (((empty >> c) & 1) || !boarding_class_fits(c, seats, bikes)) {
+                continue;
+            }
+            if (boarding_recv_class(&msgs[n], c, seats) != -1) {
+                got = c;
+            } else {
+                empty |= 1u << c;
+                fairq_idle(q, c, now);
+            }
+        }
+        if (got < 0) {
+            if (n > 0 || seats <= 0) {
+                break;
+            }
+            if (boarding_wait_fitting(msgs, seats, bikes, flags, deadline) == -1) {
+                return -1;
+            }
+            got = boarding_class(&msgs[0].passenger);
+            now = monotonic_ms();
+            empty = 0;  /* More may have come while we slept */
+        }
+        fairq_served(q, got, now);
+        boarding_room_take(&msgs[n++], &seats, &bikes);
+    }
+    return n;
+}
+
+/* SysV queue with --assign: the requests booked on our bus, in class
+ * order. They all fit (occupancy_book), and with the bus full there are
+ * none left for this trip. */
+static int boarding_recv_booked(boarding_msg_t *msgs, int max, int seats, int flags, time_t deadline) {
+    if (seats <= 0) {
+        return 0;
+    }
+    long mtype = MSG_BOARD_REQUEST_BOOKED + g_bus;
+    ssize_t ret = (flags & IPC_NOWAIT) || deadline == 0 ? msg_recv_boarding(msgs, mtype, flags)
+                                                        : msg_recv_boarding_until(msgs, mtype, 0, deadline);
+    if (ret == -1) {
+        return -1;
+    }
+    int n = 1;
+    while (n < max && msg_recv_boarding(&msgs[n], mtype, IPC_NOWAIT) != -1) {
+        n++;
+    }
+    class_arrange(msgs, sizeof(boarding_msg_t), n);
+    return n;
+}
+
+int msg_recv_boarding_batch(boarding_msg_t *msgs, int max, int seats, int bikes,
+                            int flags, time_t deadline) {
+    if (g_transport != IPC_TRANSPORT_SOCK || g_sock == -1) {
+        if (g_shm != NULL && g_shm->assign_seats && g_bus >= 0) {
+            return boarding_recv_booked(msgs, max, seats, flags, deadline);
+        }
+        if (!g_board_mq) {
+            return class_sched()->fifo ? boarding_recv_classes(msgs, max, seats, bikes, flags, deadline)
+                                       : boarding_recv_fair(msgs, max, seats, bikes, flags, deadline);
+        }
+        if (seats <= 0) {
+            return 0;  /* Full: leave the queue to the other buses */
+        }
+        ssize_t ret = (flags & IPC_NOWAIT) || deadline == 0 ? msg_recv_boarding(msgs, 0, flags)
+                                                            : msg_recv_boarding_until(msgs, 0, 0, deadline);
+        if (ret == -1) {
+            return -1;
+        }
+        /* Then whatever else is already queued (VIPs first by priority),
+         * put in class order */
+        int n = 1;
+        while (n < max && msg_recv_boarding(&msgs[n], 0, IPC_NOWAIT) != -1) {
+            n++;
+        }
+        class_arrange(msgs, sizeof(boarding_msg_t), n);
+        return n;
+    }
+    /* Datagrams arrive in order: class order (VIPs first, then FIFO with --sched=fifo) */
+    int n = sock_recv_batch(msgs, sizeof(boarding_msg_t), max, flags, deadline);
+    class_arrange(msgs, sizeof(boarding_msg_t), n);
+    return n;
+}
+
+int msg_send_boarding_resp_batch(boarding_msg_t *msgs, int count) {
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1) {
+        return sock_send_replies(msgs, sizeof(boarding_msg_t), count);
+    }
+    int rc = 0;
+    for (int i = 0; i < count; i++) {
+        if (msg_send_boarding_resp(&msgs[i]) == -1) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
 /* Receive boarding response from separate response queue */
 ssize_t msg_recv_boarding_resp(boarding_msg_t *msg, long mtype, int flags) {
+    if (g_mailbox != -1 && !(flags & IPC_NOWAIT)) {
+        return mailbox_receive(g_msgid_boarding_resp, msg, sizeof(boarding_msg_t));
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK && g_sock != -1 && !(flags & IPC_NOWAIT)) {
+        return sock_receive_reply(g_msgid_boarding_resp, msg, sizeof(boarding_msg_t));
+    }
     ssize_t ret;
     while (1) {
         ret = msgrcv(g_msgid_boarding_resp, msg, sizeof(boarding_msg_t) - sizeof(long), mtype, flags);
@@ -583,6 +2353,54 @@ ssize_t msg_recv_boarding_resp(boarding_msg_t *msg, long mtype, int flags) {
     }
 }
 
+const char *boarding_deny_text(const boarding_msg_t *msg, char *buf, size_t len) {
+    switch ((deny_code_t)msg->deny) {
+        case DENY_NONE:
+            snprintf(buf, len, "Approved");
+            break;
+        case DENY_NO_TICKET:
+            snprintf(buf, len, "No valid ticket");
+            break;
+        case DENY_BOARDING_BLOCKED:
+            snprintf(buf, len, "Boarding blocked by dispatcher");
+            break;
+        case DENY_NOT_AT_STATION:
+            snprintf(buf, len, "Bus not at station");
+            break;
+        case DENY_BOARDING_CLOSED:
+            snprintf(buf, len, "Bus boarding not open");
+            break;
+        case DENY_NO_SEATS:
+            snprintf(buf, len, "Not enough seats (%d needed, %d available)",
+                     msg->deny_arg[0], msg->deny_arg[1]);
+            break;
+        case DENY_BIKE_CAPACITY:
+            snprintf(buf, len, "Bus at bicycle capacity (%d/%d)",
+                     msg->deny_arg[0], msg->deny_arg[1]);
+            break;
+        case DENY_NOT_ACTIVE:
+            snprintf(buf, len, "Bus not the active bus");
+            break;
+        default:
+            snprintf(buf, len, "Unknown reason %d", msg->deny);
+            break;
+    }
+    return buf;
+}
+
+const char *boarding_places_text(const boarding_msg_t *msg, char *buf, size_t len) {
+    int n;
+    if (msg->seat[1] != 0) {
+        n = snprintf(buf, len, "seats %d+%d", msg->seat[0], msg->seat[1]);
+    } else {
+        n = snprintf(buf, len, "seat %d", msg->seat[0]);
+    }
+    if (msg->rack != 0 && n >= 0 && (size_t)n < len) {
+        snprintf(buf + n, len - (size_t)n, ", rack %d", msg->rack);
+    }
+    return buf;
+}
+
 int msg_send_dispatch(dispatch_msg_t *msg) {
     while (1) {
         if (msgsnd(g_msgid_dispatch, msg, sizeof(dispatch_msg_t) - sizeof(long), 0) == 0) {
@@ -617,22 +2435,43 @@ ssize_t msg_recv_dispatch(dispatch_msg_t *msg, long mtype, int flags) {
     }
 }
 
+/* Pending ticket requests in whichever transport is active (-1 if unknown) */
+int msg_ticket_queue_depth(void) {
+    if (g_transport == IPC_TRANSPORT_RING && g_shm != NULL) {
+        return shm_ring_depth(&g_shm->ticket_ring);
+    }
+    if (g_transport == IPC_TRANSPORT_MQ) {
+        struct mq_attr attr;
+        return mq_getattr(g_mq_ticket, &attr) == 0 ? (int)attr.mq_curmsgs : -1;
+    }
+    if (g_transport == IPC_TRANSPORT_SOCK) {
+        return -1;  /* Spread over the offices' socket buffers */
+    }
+    struct msqid_ds buf;
+    if (g_msgid_ticket == -1 || msgctl(g_msgid_ticket, IPC_STAT, &buf) == -1) {
+        return -1;
+    }
+    return (int)buf.msg_qnum;
+}
+
 /* Safeguard: check message queue depths and warn if getting high */
 void ipc_check_queue_health(void) {
     struct msqid_ds buf;
     
     /* Check ticket request queue */
-    if (g_msgid_ticket != -1) {
-        if (msgctl(g_msgid_ticket, IPC_STAT, &buf) == 0) {
-            if ((int)buf.msg_qnum > MAX_TICKET_QUEUE_REQUESTS) {
-                log_dispatcher(LOG_WARN, "Safeguard: Ticket queue depth high (%lu messages)", 
-                              (unsigned long)buf.msg_qnum);
-            }
-        }
+    int ticket_depth = msg_ticket_queue_depth();
+    if (ticket_depth > MAX_TICKET_QUEUE_REQUESTS) {
+        log_dispatcher(LOG_WARN, "Safeguard: Ticket queue depth high (%d messages)", ticket_depth);
     }
     
     /* Check boarding request queue */
-    if (g_msgid_boarding != -1) {
+    struct mq_attr attr;
+    if (g_board_mq && mq_getattr(g_mq_boarding, &attr) == 0) {
+        if (attr.mq_curmsgs > MAX_BOARDING_QUEUE_REQUESTS) {
+            log_dispatcher(LOG_WARN, "Safeguard: Boarding queue depth high (%ld messages)", 
+                          (long)attr.mq_curmsgs);
+        }
+    } else if (g_msgid_boarding != -1) {
         if (msgctl(g_msgid_boarding, IPC_STAT, &buf) == 0) {
             if ((int)buf.msg_qnum > MAX_BOARDING_QUEUE_REQUESTS) {
                 log_dispatcher(LOG_WARN, "Safeguard: Boarding queue depth high (%lu messages)", 
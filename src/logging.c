@@ -84,8 +84,23 @@ static const char* level_to_string(log_level_t level) {
 #define FLOCK_RETRY_US  2000   /* 2ms between retries */
 #define FLOCK_RETRIES   25     /* ~50ms max wait then give up */
 
+const char *log_get_dir(void) {
+    static char dir[64];
+    if (dir[0] == '\0') {
+        int instance = ipc_get_instance();
+        if (instance == 0) {
+            snprintf(dir, sizeof(dir), "%s", LOG_DIR);
+        } else {
+            snprintf(dir, sizeof(dir), "%s/run-%d", LOG_DIR, instance);
+        }
+    }
+    return dir;
+}
+
 static void write_log_entry(const char *filename, const char *entry) {
-    FILE *f = fopen(filename, "a");
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", log_get_dir(), filename);
+    FILE *f = fopen(path, "a");
     if (f == NULL) {
         perror("write_log_entry: fopen failed");
         return;
@@ -113,11 +128,14 @@ static void write_log_entry(const char *filename, const char *entry) {
 }
 
 int log_init(void) {
-    if (mkdir(LOG_DIR, 0755) == -1) {
-        if (errno != EEXIST) {
-            perror("log_init: mkdir failed");
-            return -1;
-        }
+    /* LOG_DIR first, then this run's own directory inside it */
+    if (mkdir(LOG_DIR, 0755) == -1 && errno != EEXIST) {
+        perror("log_init: mkdir failed");
+        return -1;
+    }
+    if (mkdir(log_get_dir(), 0755) == -1 && errno != EEXIST) {
+        perror("log_init: mkdir failed");
+        return -1;
     }
 
     init_log_mode_from_env_once();
@@ -125,6 +143,17 @@ int log_init(void) {
     return 0;
 }
 
+void log_clear(void) {
+    static const char *const files[] = {
+        LOG_MASTER, LOG_DISPATCHER, LOG_TICKET_OFFICE, LOG_DRIVER, LOG_PASSENGER, LOG_STATS
+    };
+    char path[128];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", log_get_dir(), files[i]);
+        unlink(path);
+    }
+}
+
 void log_event(const char *filename, log_level_t level, const char *format, ...) {
     init_log_mode_from_env_once();
 #ifndef DEBUG
@@ -0,0 +1,128 @@
+#include "mailbox.h"
+#include "futex_lock.h"
+
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+
+#define MB_STATUS(s)      ((s) & 7u)
+#define MB_GEN(s)         ((s) >> 3)
+#define MB_MAKE(gen, st)  (((gen) << 3) | (st))
+
+static int try_take(mailbox_t *box, int steal, pid_t owner) {
+    uint32_t s = atomic_load(&box->state);
+    if (MB_STATUS(s) != MAILBOX_FREE) {
+        /* Owner SIGKILLed without releasing: recycle on the second pass,
+         * unless a responder is writing into the slot right now */
+        if (!steal || MB_STATUS(s) == MAILBOX_BUSY ||
+            box->owner <= 0 || kill(box->owner, 0) == 0 || errno != ESRCH) {
+            return 0;
+        }
+    }
+    if (!atomic_compare_exchange_strong(&box->state, &s, MB_MAKE(MB_GEN(s) + 1, MAILBOX_WAITING))) {
+        return 0;
+    }
+    box->owner = owner;
+    return 1;
+}
+
+int mailbox_claim(mailbox_t *table, int count, int hint, pid_t owner) {
+    if (count <= 0) {
+        return -1;
+    }
+    for (int steal = 0; steal <= 1; steal++) {
+        for (int i = 0; i < count; i++) {
+            int slot = (hint + i) % count;
+            if (try_take(&table[slot], steal, owner)) {
+                return slot;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Next generation of the slot in `status`. A responder holding it BUSY
+ * (late reply to an abandoned token) stores its final state when done, so
+ * wait for that instead of having it overwrite ours; it copies one payload */
+static uint32_t advance(mailbox_t *box, uint32_t status) {
+    uint32_t s = atomic_load(&box->state);
+    while (1) {
+        if (MB_STATUS(s) == MAILBOX_BUSY) {
+            sched_yield();
+            s = atomic_load(&box->state);
+            continue;
+        }
+        uint32_t next = MB_MAKE(MB_GEN(s) + 1, status);
+        if (atomic_compare_exchange_strong(&box->state, &s, next)) {
+            return next;
+        }
+    }
+}
+
+void mailbox_release(mailbox_t *box) {
+    box->owner = 0;
+    advance(box, MAILBOX_FREE);
+}
+
+uint32_t mailbox_arm(mailbox_t *box) {
+    return advance(box, MAILBOX_WAITING);
+}
+
+/* A final reply also replaces a provisional one the waiter has not read */
+static int post(mailbox_t *box, uint32_t token, const void *data, size_t len, uint32_t status) {
+    if (len > MAILBOX_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    uint32_t expected = token;
+    uint32_t busy = MB_MAKE(MB_GEN(token), MAILBOX_BUSY);
+    uint32_t provisional = MB_MAKE(MB_GEN(token), MAILBOX_PROVISIONAL);
+    while (!atomic_compare_exchange_strong(&box->state, &expected, busy)) {
+        if (status != MAILBOX_READY || expected != provisional) {
+            errno = ESTALE;
+            return -1;
+        }
+    }
+    memcpy(box->data, data, len);
+    atomic_store_explicit(&box->state, MB_MAKE(MB_GEN(token), status), memory_order_release);
+    futex_wake(&box->state, 1);
+    return 0;
+}
+
+int mailbox_post(mailbox_t *box, uint32_t token, const void *data, size_t len) {
+    return post(box, token, data, len, MAILBOX_READY);
+}
+
+int mailbox_post_provisional(mailbox_t *box, uint32_t token, const void *data, size_t len) {
+    return post(box, token, data, len, MAILBOX_PROVISIONAL);
+}
+
+int mailbox_wait(mailbox_t *box, uint32_t token, void *data, size_t len,
+                 const struct timespec *timeout) {
+    uint32_t ready = MB_MAKE(MB_GEN(token), MAILBOX_READY);
+    uint32_t provisional = MB_MAKE(MB_GEN(token), MAILBOX_PROVISIONAL);
+    while (1) {
+        uint32_t s = atomic_load_explicit(&box->state, memory_order_acquire);
+        if (s == ready) {
+            memcpy(data, box->data, len < MAILBOX_PAYLOAD ? len : MAILBOX_PAYLOAD);
+            return 0;
+        }
+        /* Hand the slot back for the final reply; if that CAS fails the
+         * final one replaced it while we copied, so read again */
+        if (s == provisional) {
+            memcpy(data, box->data, len < MAILBOX_PAYLOAD ? len : MAILBOX_PAYLOAD);
+            if (atomic_compare_exchange_strong(&box->state, &s, token)) {
+                return 1;
+            }
+            continue;
+        }
+        if (MB_GEN(s) != MB_GEN(token)) {
+            errno = EIDRM;  /* Slot was recycled under us */
+            return -1;
+        }
+        if (futex_wait(&box->state, s, timeout) == -1 && errno != EAGAIN) {
+            return -1;
+        }
+    }
+}
@@ -244,14 +244,14 @@ static int check_simulation_progress(void) {
         return 0;
     }
     
-    sem_lock(SEM_SHM_MUTEX);
-    int transported = shm->passengers_transported;
-    int created = shm->total_passengers_created;
-    int running = shm->simulation_running;
-    int stop_spawning = shm->spawning_stopped;
-    int waiting = shm->passengers_waiting;
-    int in_office = shm->passengers_in_office;
-    sem_unlock(SEM_SHM_MUTEX);
+    status_snapshot_t status;
+    shm_read_status(&status);
+    int transported = status.passengers_transported;
+    int created = stat_sum(&shm->stats, STAT_CREATED);
+    int running = status.simulation_running;
+    int stop_spawning = status.spawning_stopped;
+    int waiting = stat_sum(&shm->stats, STAT_WAITING);
+    int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
     
     /* Check log mode - only print to stdout if not minimal */
     const char *log_mode = getenv("BUS_LOG_MODE");
@@ -273,6 +273,14 @@ static int check_simulation_progress(void) {
     return running;
 }
 
+/* Sleep for n seconds, resuming after EINTR from SIGCHLD etc. - children
+ * exiting must not cut the grace period of the ones still shutting down */
+static void sleep_seconds(int n) {
+    struct timespec left = { n, 0 };
+    while (nanosleep(&left, &left) == -1 && errno == EINTR) {
+    }
+}
+
 static void terminate_children(void) {
     printf("[MAIN] Terminating all child processes...\n");
     for (int i = 0; i < g_passenger_count; i++) {
@@ -294,7 +302,7 @@ static void terminate_children(void) {
         kill(g_dispatcher_pid, SIGTERM);
     }
     printf("[MAIN] Waiting for children to exit gracefully...\n");
-    sleep(2);
+    sleep_seconds(2);
     reap_children();
     /* SIGKILL all that might still be alive */
     for (int i = 0; i < g_passenger_count; i++) {
@@ -381,16 +389,22 @@ static void wait_all_children(void) {
     }
 }
 
-/* Sleep for n seconds using wall-clock time (resistant to EINTR from SIGCHLD etc.) */
-static void sleep_seconds(int n) {
-    time_t end = time(NULL) + n;
-    while (time(NULL) < end) {
-        sleep(1);  /* may return early on signal; we loop until wall clock reaches end */
-    }
-}
-
 static void print_queue_stats(int msgid, const char *label) {
     struct msqid_ds buf;
+    if (ipc_get_transport() == IPC_TRANSPORT_RING) {
+        /* Ticket requests bypass the kernel queue; report the shm ring instead */
+        printf("%s: ring depth=%d/%d\n", label, msg_ticket_queue_depth(), SHM_RING_SLOTS);
+        return;
+    }
+    if (ipc_get_transport() == IPC_TRANSPORT_MQ) {
+        printf("%s: mq depth=%d\n", label, msg_ticket_queue_depth());
+        return;
+    }
+    if (ipc_get_transport() == IPC_TRANSPORT_SOCK) {
+        /* Requests sit in per-office socket buffers the kernel does not expose */
+        printf("%s: sock (per-office sockets, depth not visible)\n", label);
+        return;
+    }
     if (msgid < 0) {
         printf("%s: msgid=<invalid>\n", label);
         return;
@@ -413,11 +427,11 @@ static void run_test(int test_num) {
     case 1:
         /* TEST 1: Kill active driver, verify watchdog reassigns */
         printf("\n[TEST 1] Killing active driver after 5 seconds...\n");
-        printf("[TEST 1] Expected: Watchdog detects dead driver, reassigns active_bus_id\n\n");
+        printf("[TEST 1] Expected: Watchdog detects dead driver, reassigns its bay\n\n");
         sleep_seconds(5);
         if (shm) {
             sem_lock(SEM_SHM_MUTEX);
-            int active = shm->active_bus_id;
+            int active = shm->bay_bus[0];
             pid_t driver_pid = (active >= 0 && active < MAX_BUSES) ? shm->driver_pids[active] : 0;
             sem_unlock(SEM_SHM_MUTEX);
             if (driver_pid > 0) {
@@ -476,17 +490,17 @@ static void run_test(int test_num) {
         printf("[TEST 5] Expected: created == transported + waiting + in_office + on_bus + left_early\n\n");
         sleep_seconds(15);
         if (shm) {
-            sem_lock(SEM_SHM_MUTEX);
-            int created = shm->total_passengers_created;
+            shm_lock_all();
+            int created = stat_sum(&shm->stats, STAT_CREATED);
             int transported = shm->passengers_transported;
-            int waiting = shm->passengers_waiting;
-            int in_office = shm->passengers_in_office;
-            int left_early = shm->passengers_left_early;
+            int waiting = stat_sum(&shm->stats, STAT_WAITING);
+            int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+            int left_early = stat_sum(&shm->stats, STAT_LEFT_EARLY);
             int on_bus = 0;
             for (int i = 0; i < MAX_BUSES; i++) {
-                on_bus += shm->buses[i].passenger_count;
+                on_bus += occupancy_on_board(&shm->buses[i].occupancy);
             }
-            sem_unlock(SEM_SHM_MUTEX);
+            shm_unlock_all();
             
             int sum = transported + waiting + in_office + on_bus + left_early;
             printf("[TEST 5] STATS CHECK:\n");
@@ -517,11 +531,11 @@ static void run_test(int test_num) {
             printf("[TEST 6] Monitoring for 10 seconds with blocked ticket queue...\n\n");
             for (int i = 0; i < 10; i++) {
                 sleep_seconds(1);
-                sem_lock(SEM_SHM_MUTEX);
-                int in_office = shm->passengers_in_office;
-                int waiting = shm->passengers_waiting;
-                int tickets_sold = shm->tickets_sold_people;
-                sem_unlock(SEM_SHM_MUTEX);
+                shm_lock_all();
+                int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+                int waiting = stat_sum(&shm->stats, STAT_WAITING);
+                int tickets_sold = shm_tickets_sold_people(shm);
+                shm_unlock_all();
                 
                 int queue_sem = sem_getval(SEM_TICKET_QUEUE_SLOTS);
                 printf("[TEST 6] t=%2d: in_office=%d, waiting=%d, tickets_sold=%d, queue_sem=%d\n",
@@ -538,17 +552,17 @@ static void run_test(int test_num) {
             int drained = 0;
             for (int t = 0; t < drain_timeout; t++) {
                 sleep_seconds(1);
-                sem_lock(SEM_SHM_MUTEX);
-                int created = shm->total_passengers_created;
-                int in_office = shm->passengers_in_office;
-                int waiting = shm->passengers_waiting;
+                shm_lock_all();
+                int created = stat_sum(&shm->stats, STAT_CREATED);
+                int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+                int waiting = stat_sum(&shm->stats, STAT_WAITING);
                 int transported = shm->passengers_transported;
-                int left_early = shm->passengers_left_early;
+                int left_early = stat_sum(&shm->stats, STAT_LEFT_EARLY);
                 int on_bus = 0;
                 for (int j = 0; j < MAX_BUSES; j++) {
-                    on_bus += shm->buses[j].passenger_count;
+                    on_bus += occupancy_on_board(&shm->buses[j].occupancy);
                 }
-                sem_unlock(SEM_SHM_MUTEX);
+                shm_unlock_all();
                 
                 int sum = transported + waiting + in_office + on_bus + left_early;
                 if (t % 5 == 0 || in_office == 0) {
@@ -584,15 +598,15 @@ static void run_test(int test_num) {
             printf("[TEST 7] Monitoring for 10 seconds with blocked boarding queue...\n\n");
             for (int i = 0; i < 10; i++) {
                 sleep_seconds(1);
-                sem_lock(SEM_SHM_MUTEX);
-                int waiting = shm->passengers_waiting;
-                int boarded = shm->boarded_people;
+                shm_lock_all();
+                int waiting = stat_sum(&shm->stats, STAT_WAITING);
+                int boarded = shm_boarded_people(shm);
                 int transported = shm->passengers_transported;
                 int on_bus = 0;
                 for (int j = 0; j < MAX_BUSES; j++) {
-                    on_bus += shm->buses[j].passenger_count;
+                    on_bus += occupancy_on_board(&shm->buses[j].occupancy);
                 }
-                sem_unlock(SEM_SHM_MUTEX);
+                shm_unlock_all();
                 
                 int queue_sem = sem_getval(SEM_BOARDING_QUEUE_SLOTS);
                 printf("[TEST 7] t=%2d: waiting=%d, on_bus=%d, boarded=%d, transported=%d, queue_sem=%d\n",
@@ -609,17 +623,17 @@ static void run_test(int test_num) {
             int drained = 0;
             for (int t = 0; t < drain_timeout; t++) {
                 sleep_seconds(1);
-                sem_lock(SEM_SHM_MUTEX);
-                int created = shm->total_passengers_created;
-                int in_office = shm->passengers_in_office;
-                int waiting = shm->passengers_waiting;
+                shm_lock_all();
+                int created = stat_sum(&shm->stats, STAT_CREATED);
+                int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+                int waiting = stat_sum(&shm->stats, STAT_WAITING);
                 int transported = shm->passengers_transported;
-                int left_early = shm->passengers_left_early;
+                int left_early = stat_sum(&shm->stats, STAT_LEFT_EARLY);
                 int on_bus = 0;
                 for (int j = 0; j < MAX_BUSES; j++) {
-                    on_bus += shm->buses[j].passenger_count;
+                    on_bus += occupancy_on_board(&shm->buses[j].occupancy);
                 }
-                sem_unlock(SEM_SHM_MUTEX);
+                shm_unlock_all();
                 
                 int sum = transported + waiting + in_office + on_bus + left_early;
                 if (t % 5 == 0 || waiting == 0) {
@@ -653,13 +667,13 @@ static void run_test(int test_num) {
             printf("[TEST 8] Monitoring for 15 seconds with both queues blocked...\n\n");
             for (int i = 0; i < 15; i++) {
                 sleep_seconds(1);
-                sem_lock(SEM_SHM_MUTEX);
-                int in_office = shm->passengers_in_office;
-                int waiting = shm->passengers_waiting;
-                int boarded = shm->boarded_people;
+                shm_lock_all();
+                int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+                int waiting = stat_sum(&shm->stats, STAT_WAITING);
+                int boarded = shm_boarded_people(shm);
                 int transported = shm->passengers_transported;
-                int created = shm->total_passengers_created;
-                sem_unlock(SEM_SHM_MUTEX);
+                int created = stat_sum(&shm->stats, STAT_CREATED);
+                shm_unlock_all();
                 
                 int ticket_sem = sem_getval(SEM_TICKET_QUEUE_SLOTS);
                 int boarding_sem = sem_getval(SEM_BOARDING_QUEUE_SLOTS);
@@ -679,17 +693,17 @@ static void run_test(int test_num) {
                 int drained = 0;
                 for (int t = 0; t < drain_timeout; t++) {
                     sleep_seconds(1);
-                    sem_lock(SEM_SHM_MUTEX);
-                    int created = shm->total_passengers_created;
-                    int in_office = shm->passengers_in_office;
-                    int waiting = shm->passengers_waiting;
+                    shm_lock_all();
+                    int created = stat_sum(&shm->stats, STAT_CREATED);
+                    int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+                    int waiting = stat_sum(&shm->stats, STAT_WAITING);
                     int transported = shm->passengers_transported;
-                    int left_early = shm->passengers_left_early;
+                    int left_early = stat_sum(&shm->stats, STAT_LEFT_EARLY);
                     int on_bus = 0;
                     for (int j = 0; j < MAX_BUSES; j++) {
-                        on_bus += shm->buses[j].passenger_count;
+                        on_bus += occupancy_on_board(&shm->buses[j].occupancy);
                     }
-                    sem_unlock(SEM_SHM_MUTEX);
+                    shm_unlock_all();
                     
                     int sum = transported + waiting + in_office + on_bus + left_early;
                     if (t % 5 == 0 || (in_office == 0 && waiting == 0)) {
@@ -708,17 +722,17 @@ static void run_test(int test_num) {
             }
             
             /* Final stats check */
-            sem_lock(SEM_SHM_MUTEX);
-            int created = shm->total_passengers_created;
+            shm_lock_all();
+            int created = stat_sum(&shm->stats, STAT_CREATED);
             int transported = shm->passengers_transported;
-            int waiting = shm->passengers_waiting;
-            int in_office = shm->passengers_in_office;
-            int left_early = shm->passengers_left_early;
+            int waiting = stat_sum(&shm->stats, STAT_WAITING);
+            int in_office = stat_sum(&shm->stats, STAT_IN_OFFICE);
+            int left_early = stat_sum(&shm->stats, STAT_LEFT_EARLY);
             int on_bus = 0;
             for (int j = 0; j < MAX_BUSES; j++) {
-                on_bus += shm->buses[j].passenger_count;
+                on_bus += occupancy_on_board(&shm->buses[j].occupancy);
             }
-            sem_unlock(SEM_SHM_MUTEX);
+            shm_unlock_all();
             
             int sum = transported + waiting + in_office + on_bus + left_early;
             printf("\n[TEST 8] FINAL STATS CHECK:\n");
@@ -777,19 +791,19 @@ static void run_test(int test_num) {
             kill(g_driver_pids[0], SIGSTOP);
 
             /* Monitor boarding queue / waiting. Use sem_trylock so we don't block if
-             * the stopped driver holds SEM_SHM_MUTEX (SIGSTOP freezes it mid-critical-section). */
+             * the stopped driver holds a state lock (SIGSTOP freezes it mid-critical-section). */
             for (int i = 0; i < 10; i++) {
                 sleep_seconds(1);
                 if (shm) {
-                    if (sem_trylock(SEM_SHM_MUTEX) == 0) {
-                        int waiting = shm->passengers_waiting;
-                        int boarded = shm->boarded_people;
+                    if (shm_trylock_all() == 0) {
+                        int waiting = stat_sum(&shm->stats, STAT_WAITING);
+                        int boarded = shm_boarded_people(shm);
                         int transported = shm->passengers_transported;
                         int on_bus = 0;
                         for (int j = 0; j < MAX_BUSES; j++) {
-                            on_bus += shm->buses[j].passenger_count;
+                            on_bus += occupancy_on_board(&shm->buses[j].occupancy);
                         }
-                        sem_unlock(SEM_SHM_MUTEX);
+                        shm_unlock_all();
                         int queue_sem = sem_getval(SEM_BOARDING_QUEUE_SLOTS);
                         printf("[TEST 10] t=%2d: waiting=%d, boarded=%d, transported=%d, on_bus=%d, queue_sem=%d\n",
                                i + 1, waiting, boarded, transported, on_bus, queue_sem);
@@ -932,6 +946,129 @@ static void apply_cli_options(int argc, char *argv[]) {
             setenv("BUS_FULL_DEPART", "1", 1);
             continue;
         }
+        if (strncmp(arg, "--lock=", 7) == 0) {
+            /* shm state lock backend: sysv (semop) or futex (user-space fast path in shm) */
+            const char *mode = arg + 7;
+            if (strcmp(mode, "futex") == 0 || strcmp(mode, "sysv") == 0) {
+                setenv("BUS_LOCK_MODE", mode, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Unknown lock mode '%s' (expected sysv|futex)\n", mode);
+            }
+            continue;
+        }
+        if (strncmp(arg, "--transport=", 12) == 0) {
+            /* Request transport: sysv (message queues), ring (lock-free shm ring
+             * for tickets), mq (POSIX message queues with VIP priority) or sock
+             * (Unix datagram sockets, requests handled in batches) */
+            const char *transport = arg + 12;
+            if (strcmp(transport, "sysv") == 0 || strcmp(transport, "ring") == 0 ||
+                strcmp(transport, "mq") == 0 || strcmp(transport, "sock") == 0) {
+                setenv("BUS_TRANSPORT", transport, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Unknown transport '%s' (expected sysv|ring|mq|sock)\n", transport);
+            }
+            continue;
+        }
+        if (strncmp(arg, "--board_batch=", 14) == 0) {
+            /* Boarding requests a driver takes and decides together; 1 = one at a time */
+            const char *batch = arg + 14;
+            char *end = NULL;
+            long k = strtol(batch, &end, 10);
+            if (end != batch && *end == '\0' && k >= 1 && k <= BOARDING_BATCH) {
+                setenv("BUS_BOARD_BATCH", batch, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Invalid boarding batch '%s' (expected 1-%d)\n",
+                        batch, BOARDING_BATCH);
+            }
+            continue;
+        }
+        if (strncmp(arg, "--board_policy=", 15) == 0) {
+            /* pack: fill seats and bike racks best from the batch; fifo: arrival order */
+            const char *policy = arg + 15;
+            if (strcmp(policy, "pack") == 0 || strcmp(policy, "fifo") == 0) {
+                setenv("BUS_BOARD_POLICY", policy, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Unknown boarding policy '%s' (expected pack|fifo)\n", policy);
+            }
+            continue;
+        }
+        if (strncmp(arg, "--sched=", 8) == 0) {
+            /* wfq: serve passenger classes by weight with aging; fifo: arrival order, VIPs first */
+            const char *sched = arg + 8;
+            if (strcmp(sched, "wfq") == 0 || strcmp(sched, "fifo") == 0) {
+                setenv("BUS_SCHED", sched, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Unknown scheduling '%s' (expected wfq|fifo)\n", sched);
+            }
+            continue;
+        }
+        if (strncmp(arg, "--sched_weights=", 16) == 0) {
+            /* Class weights for --sched=wfq: VIP, regular, senior, bike, family */
+            const char *weights = arg + 16;
+            unsigned w[CLASS_COUNT];
+            char tail;
+            if (sscanf(weights, "%u,%u,%u,%u,%u%c", &w[0], &w[1], &w[2], &w[3], &w[4], &tail) == CLASS_COUNT &&
+                w[0] > 0 && w[1] > 0 && w[2] > 0 && w[3] > 0 && w[4] > 0) {
+                setenv("BUS_SCHED_WEIGHTS", weights, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Invalid class weights '%s' (expected V,R,S,B,F, each >= 1)\n", weights);
+            }
+            continue;
+        }
+        if (strncmp(arg, "--bays=", 7) == 0) {
+            /* Boarding bays: how many buses at the station board at once */
+            const char *bays = arg + 7;
+            char *end = NULL;
+            long n = strtol(bays, &end, 10);
+            if (end != bays && *end == '\0' && n >= 1 && n <= MAX_BUSES) {
+                setenv("BUS_BAYS", bays, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Invalid bay count '%s' (expected 1-%d)\n",
+                        bays, MAX_BUSES);
+            }
+            continue;
+        }
+        if (strncmp(arg, "--fleet=", 8) == 0) {
+            /* Vehicle of each bus from bus 0: preset or SEATS/BIKES/MIN-MAX */
+            const char *fleet = arg + 8;
+            bus_model_t models[MAX_BUSES];
+            char err[96];
+            if (fleet_parse(fleet, models, err, sizeof(err)) == 0) {
+                setenv("BUS_FLEET", fleet, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Invalid fleet '%s': %s\n", fleet, err);
+            }
+            continue;
+        }
+        if (strcmp(arg, "--assign") == 0) {
+            /* Seat booked on a bus with the ticket, per-bus boarding queues */
+            setenv("BUS_ASSIGN", "1", 1);
+            continue;
+        }
+        if (strcmp(arg, "--hugepages") == 0) {
+            /* Shared memory on huge pages (if reserved), pre-faulted and mlock()ed */
+            setenv("BUS_SHM_HUGE", "1", 1);
+            continue;
+        }
+        if (strncmp(arg, "--instance=", 11) == 0) {
+            /* Run id: own IPC keys, mqueue/socket names and logs/run-<id>, so
+             * several simulations can share a host; auto = this process' PID */
+            const char *instance = arg + 11;
+            char *end = NULL;
+            long id = strtol(instance, &end, 10);
+            char buf[16];
+            if (strcmp(instance, "auto") == 0) {
+                snprintf(buf, sizeof(buf), "%d", (int)getpid());
+                setenv("BUS_INSTANCE", buf, 1);
+            } else if (end != instance && *end == '\0' && id >= 0 && id <= IPC_INSTANCE_MAX) {
+                snprintf(buf, sizeof(buf), "%ld", id);
+                setenv("BUS_INSTANCE", buf, 1);
+            } else {
+                fprintf(stderr, "[MAIN] Invalid instance '%s' (expected 0-%d or auto)\n",
+                        instance, IPC_INSTANCE_MAX);
+            }
+            continue;
+        }
         if (strcmp(arg, "--max_p") == 0) {
             /* Cap passenger count at MAX_PASSENGERS (from config.h) */
             g_max_passengers = MAX_PASSENGERS;
@@ -954,6 +1091,21 @@ static void apply_cli_options(int argc, char *argv[]) {
             printf("             [--perf]  (disable simulated sleeps for performance testing)\n");
             printf("             [--full]  (depart when bus is full, don't wait for scheduled time)\n");
             printf("             [--max_p] (cap passengers at MAX_PASSENGERS from config; used with tests)\n");
+            printf("             [--lock=sysv|futex] (shared-memory mutex backend, default sysv)\n");
+            printf("             [--transport=sysv|ring|mq|sock] (request queues, default sysv)\n");
+            printf("             [--board_batch=K] (boarding requests a driver decides at once, 1-%d, default %d)\n",
+                   BOARDING_BATCH, BOARDING_BATCH);
+            printf("             [--board_policy=pack|fifo] (fill seats and bike racks from the batch, or arrival order; default pack)\n");
+            printf("             [--sched=wfq|fifo] (serve passenger classes by weight with aging, or arrival order; default wfq)\n");
+            printf("             [--sched_weights=V,R,S,B,F] (class weights for wfq: VIP, regular, senior, bike, family; default %d,%d,%d,%d,%d)\n",
+                   CLASS_WEIGHT_VIP, CLASS_WEIGHT_REGULAR, CLASS_WEIGHT_SENIOR, CLASS_WEIGHT_BIKE, CLASS_WEIGHT_FAMILY);
+            printf("             [--bays=N] (buses boarding at once, 1-%d, default %d)\n",
+                   MAX_BUSES, BOARDING_BAYS);
+            printf("             [--fleet=V,V,...] (vehicle of each bus from bus 0: standard|midi|articulated or\n");
+            printf("                               SEATS/BIKES/MIN-MAX return seconds; default all standard)\n");
+            printf("             [--assign] (book a seat on a bus with the ticket and queue for that bus only)\n");
+            printf("             [--hugepages] (shm on huge pages, pre-faulted and locked in RAM)\n");
+            printf("             [--instance=N|auto] (run id for IPC keys and logs/run-N, default 0)\n");
             printf("\nTest modes:\n");
             printf("  --test1  Kill active driver, verify watchdog reassigns\n");
             printf("  --test2  Close station (SIGUSR2), verify drain\n");
@@ -979,8 +1131,17 @@ int main(int argc, char *argv[]) {
     apply_cli_options(argc, argv);
 
     printf("Configuration:\n");
-    printf("  Buses: %d (capacity: %d passengers, %d bikes)\n", 
-           MAX_BUSES, BUS_CAPACITY, BIKE_CAPACITY);
+    bus_model_t models[MAX_BUSES];
+    char fleet_err[96];
+    if (fleet_parse(getenv("BUS_FLEET"), models, fleet_err, sizeof(fleet_err)) != 0) {
+        fleet_parse(NULL, models, fleet_err, sizeof(fleet_err));  /* As the dispatcher does */
+    }
+    printf("  Buses: %d\n", MAX_BUSES);
+    for (int i = 0; i < MAX_BUSES; i++) {
+        printf("    Bus %d: %s (capacity: %d passengers, %d bikes, return %d-%ds)\n", i,
+               models[i].name, models[i].capacity.seats, models[i].capacity.bikes,
+               models[i].min_return, models[i].max_return);
+    }
     printf("  Ticket offices: %d\n", TICKET_OFFICES);
     if (g_max_passengers > 0) {
         printf("  Passengers: max %d (--max_p, MAX_PASSENGERS from config)\n", g_max_passengers);
@@ -989,6 +1150,7 @@ int main(int argc, char *argv[]) {
     }
     printf("  Boarding interval: %d seconds\n", BOARDING_INTERVAL);
     printf("  VIP percentage: %d%%\n", VIP_PERCENT);
+    printf("  Instance: %d (logs in '%s/')\n", ipc_get_instance(), log_get_dir());
     printf("========================================\n\n");
     
     /* Seed random number generator */
@@ -1001,20 +1163,21 @@ int main(int argc, char *argv[]) {
     memset(g_ticket_office_pids, 0, sizeof(g_ticket_office_pids));
     memset(g_driver_pids, 0, sizeof(g_driver_pids));
     
+    /* Another live simulation with the same instance id would share our IPC */
+    if (ipc_resources_in_use()) {
+        fprintf(stderr, "[MAIN] Instance %d is already running; pick another with --instance=N|auto\n",
+                ipc_get_instance());
+        return EXIT_FAILURE;
+    }
+    
     /* Create logs directory */
-    if (mkdir(LOG_DIR, 0755) == -1 && errno != EEXIST) {
-        perror("mkdir logs");
+    if (log_init() != 0) {
         /* Continue anyway */
     }
     
     /* Clear old log files */
     printf("[MAIN] Clearing old log files...\n");
-    unlink(LOG_MASTER);
-    unlink(LOG_DISPATCHER);
-    unlink(LOG_TICKET_OFFICE);
-    unlink(LOG_DRIVER);
-    unlink(LOG_PASSENGER);
-    unlink(LOG_STATS);
+    log_clear();
     
 
     printf("[MAIN] Starting dispatcher...\n");
@@ -1199,18 +1362,18 @@ int main(int argc, char *argv[]) {
             if (g_dispatcher_pid > 0) {
                 shm_data_t *shm_d = ipc_get_shm();
                 if (shm_d) {
-                    sem_lock(SEM_SHM_MUTEX);
-                    int stop = shm_d->spawning_stopped;
-                    int created = shm_d->total_passengers_created;
-                    int waiting = shm_d->passengers_waiting;
-                    int in_office = shm_d->passengers_in_office;
-                    int transported = shm_d->passengers_transported;
-                    int left_early = shm_d->passengers_left_early;
+                    status_snapshot_t status;
+                    shm_read_status(&status);
+                    int stop = status.spawning_stopped;
+                    int created = stat_sum(&shm_d->stats, STAT_CREATED);
+                    int waiting = stat_sum(&shm_d->stats, STAT_WAITING);
+                    int in_office = stat_sum(&shm_d->stats, STAT_IN_OFFICE);
+                    int transported = status.passengers_transported;
+                    int left_early = stat_sum(&shm_d->stats, STAT_LEFT_EARLY);
                     int on_bus = 0;
                     for (int j = 0; j < MAX_BUSES; j++) {
-                        on_bus += shm_d->buses[j].passenger_count;
+                        on_bus += status.buses[j].passenger_count - status.buses[j].entering_count;
                     }
-                    sem_unlock(SEM_SHM_MUTEX);
                     int sum = transported + waiting + in_office + on_bus + left_early;
                     if (stop && created > 0 && waiting == 0 && in_office == 0 && sum == created) {
                         printf("[MAIN] Drain complete (%d passengers); signaling dispatcher to shutdown.\n", created);
@@ -1230,7 +1393,7 @@ int main(int argc, char *argv[]) {
     if (g_dispatcher_pid > 0) {
         printf("[MAIN] Signaling dispatcher to shutdown...\n");
         kill(g_dispatcher_pid, SIGTERM);
-        sleep(2);
+        sleep_seconds(2);
     }
     
     /* Terminate remaining children */
@@ -1245,7 +1408,7 @@ int main(int argc, char *argv[]) {
     printf(COLOR_GREEN "\n========================================\n");
     printf("   SIMULATION FINISHED\n");
     printf("========================================\n" COLOR_RESET);
-    printf("Check log files in '%s/' for details:\n", LOG_DIR);
+    printf("Check log files in '%s/' for details:\n", log_get_dir());
     printf("  - master.log\n");
     printf("  - dispatcher.log\n");
     printf("  - ticket_office.log\n");
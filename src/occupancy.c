@@ -0,0 +1,173 @@
+#include "occupancy.h"
+#include "futex_lock.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define OCC_ONE_BIKE      (1u << OCC_FIELD_BITS)
+#define OCC_ONE_ENTERING  (1u << (2 * OCC_FIELD_BITS))
+
+/* Admission rule for one request: adds it to `w` if it fits */
+static occ_result_t occupancy_admit(uint32_t *w, occ_capacity_t cap, int seats, int bike) {
+    if (*w & (OCC_CLOSED | OCC_CLOSING)) {
+        return OCC_IS_CLOSED;
+    }
+    if (OCC_SEATS(*w) + seats > cap.seats) {
+        return OCC_FULL;
+    }
+    if (bike && OCC_BIKES(*w) >= cap.bikes) {
+        return OCC_NO_BIKE_SPACE;
+    }
+    *w += (uint32_t)seats * (1 + OCC_ONE_ENTERING) + (bike ? OCC_ONE_BIKE : 0);
+    return OCC_RESERVED;
+}
+
+int occupancy_reserve_many(occupancy_t *occ, occ_capacity_t cap, const occ_request_t *req,
+                           int n, occ_result_t *result, uint32_t *word) {
+    uint32_t cur = atomic_load(occ);
+    while (1) {
+        uint32_t next = cur;
+        int admitted = 0;
+        for (int i = 0; i < n; i++) {
+            result[i] = occupancy_admit(&next, cap, req[i].seats, req[i].bike);
+            admitted += (result[i] == OCC_RESERVED);
+        }
+        *word = next;
+        if (admitted == 0 || atomic_compare_exchange_weak(occ, &cur, next)) {
+            return admitted;
+        }
+    }
+}
+
+/* Worth of a request when packing: its seats, a bike place breaks ties */
+#define PACK_VALUE(r)  ((r)->seats * (MAX_BIKE_CAPACITY + 1) + (r)->bike)
+
+_Static_assert(MAX_BUS_CAPACITY * (MAX_BIKE_CAPACITY + 1) + MAX_BIKE_CAPACITY <= UINT16_MAX,
+               "a full bus must fit the packing table");
+
+void occupancy_pack(uint32_t word, occ_capacity_t cap, const occ_request_t *req, int n, int *order) {
+    int seats = cap.seats - OCC_SEATS(word);
+    int bikes = cap.bikes - OCC_BIKES(word);
+    uint8_t placed[BOARDING_BATCH] = {0};
+    int next = 0;
+    
+    for (int i = 0; i < n; i++) {
+        if (!req[i].first) {
+            continue;
+        }
+        order[next++] = i;
+        placed[i] = 1;
+        if (req[i].seats <= seats && req[i].bike <= bikes) {
+            seats -= req[i].seats;
+            bikes -= req[i].bike;
+        }
+    }
+    
+    /* best[i][s][b]: most worth the unplaced requests from i on can put
+     * into s seats and b bike places */
+    uint16_t best[BOARDING_BATCH + 1][MAX_BUS_CAPACITY + 1][MAX_BIKE_CAPACITY + 1];
+    memset(best[n], 0, sizeof(best[n]));
+    for (int i = n - 1; i >= 0; i--) {
+        for (int s = 0; s <= seats; s++) {
+            for (int b = 0; b <= bikes; b++) {
+                int value = best[i + 1][s][b];
+                if (!placed[i] && req[i].seats <= s && req[i].bike <= b) {
+                    int with = PACK_VALUE(&req[i]) + best[i + 1][s - req[i].seats][b - req[i].bike];
+                    if (with > value) {
+                        value = with;
+                    }
+                }
+                best[i][s][b] = (uint16_t)value;
+            }
+        }
+    }
+    /* Walk forward taking a request whenever an optimum includes it, so
+     * of equal fills the earlier arrivals win */
+    for (int i = 0; i < n; i++) {
+        if (!placed[i] && req[i].seats <= seats && req[i].bike <= bikes &&
+            PACK_VALUE(&req[i]) + best[i + 1][seats - req[i].seats][bikes - req[i].bike] == best[i][seats][bikes]) {
+            order[next++] = i;
+            placed[i] = 1;
+            seats -= req[i].seats;
+            bikes -= req[i].bike;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (!placed[i]) {
+            order[next++] = i;
+        }
+    }
+}
+
+void occupancy_entered(occupancy_t *occ, int seats) {
+    uint32_t old = atomic_fetch_sub(occ, (uint32_t)seats * OCC_ONE_ENTERING);
+    if ((old & OCC_CLOSING) && OCC_ENTERING(old) == seats) {
+        futex_wake(occ, INT_MAX);  /* Driver is waiting to close the doors */
+    }
+}
+
+int occupancy_close(occupancy_t *occ, uint32_t *word) {
+    uint32_t cur = atomic_load(occ);
+    while (1) {
+        *word = cur;
+        if (OCC_ENTERING(cur) > 0) {
+            return 0;
+        }
+        uint32_t closed = (cur | OCC_CLOSED) & ~OCC_CLOSING;
+        if (atomic_compare_exchange_weak(occ, &cur, closed)) {
+            *word = closed;
+            return 1;
+        }
+    }
+}
+
+int occupancy_close_wait(occupancy_t *occ, const struct timespec *timeout, uint32_t *word) {
+    if (occupancy_close(occ, word)) {
+        return 1;
+    }
+    uint32_t cur = atomic_fetch_or(occ, OCC_CLOSING) | OCC_CLOSING;
+    if (OCC_ENTERING(cur) > 0) {
+        futex_wait(occ, cur, timeout);
+    }
+    return occupancy_close(occ, word);
+}
+
+void occupancy_reset(occupancy_t *occ) {
+    atomic_store(occ, 0);
+}
+
+int occupancy_book(occupancy_t *booked, occupancy_t *occ, occ_capacity_t cap,
+                   int seats, int bike) {
+    uint32_t cur = atomic_load(booked);
+    while (1) {
+        uint32_t on_bus = atomic_load(occ);
+        if (OCC_SEATS(cur) + OCC_SEATS(on_bus) + seats > cap.seats ||
+            (bike && OCC_BIKES(cur) + OCC_BIKES(on_bus) >= cap.bikes)) {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak(booked, &cur, cur + (uint32_t)seats + (bike ? OCC_ONE_BIKE : 0))) {
+            return 1;
+        }
+    }
+}
+
+void occupancy_unbook(occupancy_t *booked, int seats, int bike) {
+    uint32_t cur = atomic_load(booked);
+    while (1) {
+        /* Never below zero: the ledger of a dead bus is cleared under its passengers */
+        int left_seats = OCC_SEATS(cur) > seats ? OCC_SEATS(cur) - seats : 0;
+        int left_bikes = OCC_BIKES(cur) - (bike && OCC_BIKES(cur) > 0);
+        uint32_t next = (uint32_t)left_seats | (uint32_t)left_bikes << OCC_FIELD_BITS;
+        if (atomic_compare_exchange_weak(booked, &cur, next)) {
+            return;
+        }
+    }
+}
+
+int occupancy_take_seats(occupancy_t *occ) {
+    uint32_t cur = atomic_load(occ);
+    uint32_t keep = ~(OCC_FIELD_MASK | (OCC_FIELD_MASK << OCC_FIELD_BITS));
+    while (!atomic_compare_exchange_weak(occ, &cur, (cur & keep) | (uint32_t)OCC_ENTERING(cur))) {
+    }
+    return OCC_SEATS(cur) - OCC_ENTERING(cur);
+}
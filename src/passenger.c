@@ -11,6 +11,7 @@
 #include <time.h>
 #include <pthread.h>
 #include <sys/msg.h>
+#include <sys/sem.h>
 
 
 
@@ -21,11 +22,20 @@ static passenger_info_t g_info;
 static pthread_t g_child_thread;
 static volatile int g_child_boarded = 0;
 static volatile int g_adult_boarded = 0;
+static int g_child_seat = 0;             /* Set with g_adult_boarded */
+static int g_board_unknown = 0;          /* Request sent, no answer: the IPC went first */
 static pthread_mutex_t g_board_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t g_board_cond = PTHREAD_COND_INITIALIZER;
 
 
 
+/* CLOCK_MONOTONIC in ms, for the wait times */
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 static void handle_shutdown(int sig) {
     (void)sig;
     g_running = 0;
@@ -60,8 +70,8 @@ static void* child_thread_func(void *arg) {
     
     if (g_adult_boarded) {
         g_child_boarded = 1;
-        log_passenger(LOG_INFO, "PID %d: Child (age=%d) boarded with adult on bus %d",
-                     g_info.pid, child_age, g_info.assigned_bus);
+        log_passenger(LOG_INFO, "PID %d: Child (age=%d) boarded with adult on bus %d, seat %d",
+                     g_info.pid, child_age, g_info.assigned_bus, g_child_seat);
     } else {
         log_passenger(LOG_WARN, "PID %d: Child (age=%d) could not board - adult did not board",
                      g_info.pid, child_age);
@@ -142,15 +152,14 @@ static void init_passenger(void) {
     
     /* No assigned bus yet */
     g_info.assigned_bus = -1;
+    g_info.booked = false;
 }
 
 
 
 static int purchase_ticket(shm_data_t *shm) {
     /* Mark as in office */
-    sem_lock(SEM_SHM_MUTEX);
-    shm->passengers_in_office++;
-    sem_unlock(SEM_SHM_MUTEX);
+    stat_add(&shm->stats, STAT_IN_OFFICE, g_info.seat_count);
     
     log_passenger(LOG_INFO, "PID %d (Age=%d%s): Queuing at ticket office",
                  g_info.pid, g_info.age,
@@ -159,16 +168,17 @@ static int purchase_ticket(shm_data_t *shm) {
     /* Prepare ticket request */
     ticket_msg_t request;
     memset(&request, 0, sizeof(request));
-    request.mtype = MSG_TICKET_REQUEST;
-    request.passenger = g_info;
+    request.passenger = passenger_to_wire(&g_info);
+    request.mtype = ticket_request_type(passenger_class(&request.passenger));
     request.approved = false;
+    long queued_ms = now_ms();
     
-    /* Limit outstanding ticket requests to avoid msg queue deadlock */
-    if (sem_lock(SEM_TICKET_QUEUE_SLOTS) == -1) {
+    /* Limit outstanding ticket requests to avoid msg queue deadlock
+     * (the ring transport is bounded by its own capacity instead) */
+    int use_slots = ipc_queue_slots_enabled(SEM_TICKET_QUEUE_SLOTS);
+    if (use_slots && sem_lock(SEM_TICKET_QUEUE_SLOTS) == -1) {
         /* IPC removed - simulation ending */
-        sem_lock(SEM_SHM_MUTEX);
-        shm->passengers_in_office--;
-        sem_unlock(SEM_SHM_MUTEX);
+        stat_add(&shm->stats, STAT_IN_OFFICE, -g_info.seat_count);
         return 0;
     }
 
@@ -176,35 +186,40 @@ static int purchase_ticket(shm_data_t *shm) {
     if (msg_send_ticket(&request) == -1) {
         log_passenger(LOG_ERROR, "PID %d: Failed to send ticket request", g_info.pid);
         
-        sem_unlock(SEM_TICKET_QUEUE_SLOTS);
+        if (use_slots) {
+            sem_unlock(SEM_TICKET_QUEUE_SLOTS);
+        }
 
-        sem_lock(SEM_SHM_MUTEX);
-        shm->passengers_in_office--;
-        sem_unlock(SEM_SHM_MUTEX);
+        stat_add(&shm->stats, STAT_IN_OFFICE, -g_info.seat_count);
         return 0;
     }
     
-    /* Wait for response from dedicated response queue (mtype = our PID) */
+    /* Wait for response in our mailbox (or response queue, mtype = our PID) */
     ticket_msg_t response;
     ssize_t ret = msg_recv_ticket_resp(&response, g_info.pid, 0);
     
     if (ret == -1) {
         if (errno == EINTR || errno == EIDRM || errno == EINVAL) {
-            sem_lock(SEM_SHM_MUTEX);
-            shm->passengers_in_office--;
-            sem_unlock(SEM_SHM_MUTEX);
+            stat_add(&shm->stats, STAT_IN_OFFICE, -g_info.seat_count);
             return 0;
         }
         log_passenger(LOG_ERROR, "PID %d: Failed to receive ticket response", g_info.pid);
         
-        sem_lock(SEM_SHM_MUTEX);
-        shm->passengers_in_office--;
-        sem_unlock(SEM_SHM_MUTEX);
+        stat_add(&shm->stats, STAT_IN_OFFICE, -g_info.seat_count);
         return 0;
     }
+
+    /* Served (ticket or denial): we leave the office. The office never
+     * touches the station counters, so this one is ours to update. */
+    stat_add(&shm->stats, STAT_IN_OFFICE, -g_info.seat_count);
+    wait_hist_add(&shm->ticket_wait[passenger_class(&request.passenger)], now_ms() - queued_ms);
     
     if (response.approved) {
         g_info.has_ticket = true;
+        if (response.bus_id >= 0) {
+            g_info.assigned_bus = response.bus_id;  /* --assign: seat booked on it */
+            g_info.booked = true;
+        }
         log_passenger(LOG_INFO, "PID %d (Age=%d%s): Ticket purchased (covers %d seat%s)",
                      g_info.pid, g_info.age,
                      g_info.has_child_with ? ", with child" : "",
@@ -221,9 +236,7 @@ static int purchase_ticket(shm_data_t *shm) {
 
 static int enter_station(shm_data_t *shm) {
     /* Check if station is open */
-    sem_lock(SEM_SHM_MUTEX);
-    int station_open = shm->station_open;
-    sem_unlock(SEM_SHM_MUTEX);
+    int station_open = SHM_READ(shm->station_open);
     
     if (!station_open) {
         /* Station closed means end of simulation */
@@ -237,16 +250,11 @@ static int enter_station(shm_data_t *shm) {
         return 0;
     }
     
-    if (sem_lock(SEM_SHM_MUTEX) == -1) {
-        sem_unlock(SEM_STATION_ENTRY);
-        return 0;
-    }
-    station_open = shm->station_open;
+    station_open = SHM_READ(shm->station_open);
     
     if (station_open) {
         /* Count all people entering (adult + child if present) */
-        shm->passengers_waiting += g_info.seat_count;
-        sem_unlock(SEM_SHM_MUTEX);
+        stat_add(&shm->stats, STAT_WAITING, g_info.seat_count);
         
         sem_unlock(SEM_STATION_ENTRY);
         
@@ -261,7 +269,6 @@ static int enter_station(shm_data_t *shm) {
         }
         return 1;
     } else {
-        sem_unlock(SEM_SHM_MUTEX);
         sem_unlock(SEM_STATION_ENTRY);
         return 0;
     }
@@ -269,12 +276,72 @@ static int enter_station(shm_data_t *shm) {
 
 
 
-static int attempt_boarding(shm_data_t *shm) {
-    /* Find active bus */
-    sem_lock(SEM_SHM_MUTEX);
-    int active_bus = shm->active_bus_id;
-    int boarding_allowed = shm->boarding_allowed;
-    sem_unlock(SEM_SHM_MUTEX);
+/* Bus to ask for a seat: power of two choices over the bays - of two
+ * random boarding buses take the one with fewer seats taken, so load
+ * spreads without scanning every bay. With the shared request queues any
+ * boarding driver may take the request anyway; with sockets this is where
+ * it goes. -1 if no bay has a bus at the station (one may be due back). */
+static int choose_bay_bus(shm_data_t *shm) {
+    int buses[MAX_BUSES];
+    int n = 0;
+    for (int b = 0; b < shm->bays; b++) {
+        int bus = SHM_READ(shm->bay_bus[b]);
+        if (bus >= 0 && SHM_READ(shm->buses[bus].at_station)) {
+            buses[n++] = bus;
+        }
+    }
+    if (n <= 1) {
+        return n == 1 ? buses[0] : -1;
+    }
+    int i = rand() % n;
+    int j = (i + 1 + rand() % (n - 1)) % n;  /* A different bay */
+    return occupancy_seats(&shm->buses[buses[j]].occupancy) <
+           occupancy_seats(&shm->buses[buses[i]].occupancy) ? buses[j] : buses[i];
+}
+
+/* --assign: the bus our seat is booked on, whether or not it is at a bay
+ * yet - we queue for it there. VIPs, and those the office found no seat
+ * for, book here; a booking on a bus whose driver died is void. -1 while
+ * every bus is booked out. */
+static int booked_bus(shm_data_t *shm) {
+    if (g_info.booked && SHM_READ(shm->driver_pids[g_info.assigned_bus]) <= 0) {
+        log_passenger(LOG_WARN, "PID %d: Bus %d is gone, booking again", g_info.pid, g_info.assigned_bus);
+        g_info.booked = false;  /* The watchdog cleared its ledger */
+    }
+    if (!g_info.booked) {
+        wire_passenger_t wire = passenger_to_wire(&g_info);
+        int bus = shm_book_seat(&wire);
+        if (bus < 0) {
+            return -1;
+        }
+        g_info.assigned_bus = bus;
+        g_info.booked = true;
+        log_passenger(LOG_INFO, "PID %d: Booked on bus %d", g_info.pid, bus);
+    }
+    return g_info.assigned_bus;
+}
+
+/* Leaving without boarding: give a booked seat back */
+static void cancel_booking(void) {
+    if (g_info.booked) {
+        wire_passenger_t wire = passenger_to_wire(&g_info);
+        shm_unbook_seat(g_info.assigned_bus, &wire);
+        g_info.booked = false;
+    }
+}
+
+/* Take (-1) or give back (+1) our boarding queue slot. It is held from the
+ * request to its final reply; SEM_UNDO returns it if we are killed in
+ * between, so it comes back whatever happens to the driver */
+static int board_slot(int op) {
+    struct sembuf slot = { .sem_num = SEM_BOARDING_QUEUE_SLOTS, .sem_op = (short)op, .sem_flg = SEM_UNDO };
+    return sem_ops(&slot, 1, NULL);
+}
+
+static int attempt_boarding(shm_data_t *shm, int attempts) {
+    /* Pick a bus at one of the bays, or with --assign the one booked on */
+    int active_bus = shm->assign_seats ? booked_bus(shm) : choose_bay_bus(shm);
+    int boarding_allowed = SHM_READ(shm->boarding_allowed);
     
     if (active_bus < 0 || !boarding_allowed) {
         log_passenger(LOG_INFO, "PID %d: No bus available for boarding, waiting...", 
@@ -286,33 +353,53 @@ static int attempt_boarding(shm_data_t *shm) {
                  g_info.pid, active_bus, g_info.seat_count,
                  g_info.seat_count > 1 ? "s" : "");
     
-    /* Prepare boarding request - VIP passengers use priority message type */
+    /* Prepare boarding request - typed by the passenger's class */
     boarding_msg_t request;
     memset(&request, 0, sizeof(request));
-    request.mtype = g_info.is_vip ? MSG_BOARD_REQUEST_VIP : MSG_BOARD_REQUEST;
-    request.passenger = g_info;
-    request.bus_id = active_bus;
+    request.passenger = passenger_to_wire(&g_info);
+    request.mtype = boarding_msg_type(&request.passenger, active_bus);
+    request.bus_id = (uint8_t)active_bus;
     request.approved = false;
+    request.attempts = (uint8_t)(attempts < UINT8_MAX ? attempts : UINT8_MAX);
     
     /* Limit outstanding boarding requests to avoid msg queue deadlock */
-    if (sem_lock(SEM_BOARDING_QUEUE_SLOTS) == -1) {
+    int use_slots = ipc_queue_slots_enabled(SEM_BOARDING_QUEUE_SLOTS);
+    if (use_slots && board_slot(-1) == -1) {
         /* IPC removed - simulation ending */
         return -1;
     }
 
     /* Send request to driver */
     if (msg_send_boarding(&request) == -1) {
-        log_passenger(LOG_ERROR, "PID %d: Failed to send boarding request", g_info.pid);
-        sem_unlock(SEM_BOARDING_QUEUE_SLOTS);
+        /* Socket transport: that bus is busy or gone - just try again */
+        if (errno != EAGAIN && errno != ECONNREFUSED) {
+            log_passenger(LOG_ERROR, "PID %d: Failed to send boarding request", g_info.pid);
+        }
+        if (use_slots) {
+            board_slot(1);
+        }
         return -1;
     }
     
-    /* Wait for response from dedicated response queue (mtype = our PID) */
+    /* Wait for response in our mailbox (or response queue, mtype = our PID).
+     * MSG_BOARD_WAIT: no bus can seat us now, we are parked and the final
+     * answer comes once a bus opens boarding - no need to ask again. */
     boarding_msg_t response;
-    ssize_t ret = msg_recv_boarding_resp(&response, g_info.pid, 0);
+    ssize_t ret;
+    while ((ret = msg_recv_boarding_resp(&response, g_info.pid, 0)) != -1 &&
+           response.reply == MSG_BOARD_WAIT) {
+        char reason[64];
+        log_passenger(LOG_INFO, "PID %d: Parked by bus %d (%s), waiting for the next bus",
+                     g_info.pid, response.bus_id,
+                     boarding_deny_text(&response, reason, sizeof(reason)));
+    }
+    if (use_slots) {
+        board_slot(1);
+    }
     
     if (ret == -1) {
-        sem_unlock(SEM_BOARDING_QUEUE_SLOTS);
+        /* The driver may have seated us (and counted us) before it went */
+        g_board_unknown = 1;
         if (errno == EINTR || errno == EIDRM || errno == EINVAL) {
             return -1;
         }
@@ -320,32 +407,35 @@ static int attempt_boarding(shm_data_t *shm) {
         return -1;
     }
     
-    /* Response received, unlock semaphore (request processed) */
-    sem_unlock(SEM_BOARDING_QUEUE_SLOTS);
-    
     if (response.approved) {
+        /* The driver moved us from waiting to its bus as it seated us */
         g_info.assigned_bus = response.bus_id;
+        g_info.booked = false;  /* The driver took our booking off its ledger */
         
         /* Signal child thread that we boarded */
         pthread_mutex_lock(&g_board_mutex);
+        g_child_seat = response.seat[1];
         g_adult_boarded = 1;
         pthread_cond_signal(&g_board_cond);
         pthread_mutex_unlock(&g_board_mutex);
         
+        char places[48];
+        boarding_places_text(&response, places, sizeof(places));
         if (g_info.has_child_with) {
-            log_passenger(LOG_INFO, "PID %d (Adult age=%d, Child age=%d): BOARDED bus %d together",
-                         g_info.pid, g_info.age, g_info.child_age, response.bus_id);
+            log_passenger(LOG_INFO, "PID %d (Adult age=%d, Child age=%d): BOARDED bus %d together, %s",
+                         g_info.pid, g_info.age, g_info.child_age, response.bus_id, places);
         } else {
-            log_passenger(LOG_INFO, "PID %d (Age=%d): BOARDED bus %d",
-                         g_info.pid, g_info.age, response.bus_id);
+            log_passenger(LOG_INFO, "PID %d (Age=%d): BOARDED bus %d, %s",
+                         g_info.pid, g_info.age, response.bus_id, places);
         }
         return 1;
     } else {
+        char reason[64];
         log_passenger(LOG_WARN, "PID %d: Boarding denied - %s",
-                     g_info.pid, response.reason);
+                     g_info.pid, boarding_deny_text(&response, reason, sizeof(reason)));
         
-        if (strstr(response.reason, "capacity") != NULL ||
-            strstr(response.reason, "not at station") != NULL) {
+        if (response.deny == DENY_BIKE_CAPACITY || response.deny == DENY_NOT_AT_STATION ||
+            response.deny == DENY_NOT_ACTIVE) {
             return -1;  /* Wait for next bus */
         }
         return 0;
@@ -392,12 +482,21 @@ int main(void) {
         fprintf(stderr, "[PASSENGER %d] Failed to get shared memory\n", g_info.pid);
         exit(EXIT_FAILURE);
     }
+    ipc_mem_init(MEM_ROLE_PASSENGER);
+
+    /* Replies come straight to our mailbox; if the table is full they
+     * fall back to the shared response queues (mtype = our PID).
+     * With the socket transport they come to our own socket instead. */
+    ipc_mailbox_open();
+    if (ipc_endpoint_open(IPC_ENDPOINT_PASSENGER, g_info.pid) == -1) {
+        fprintf(stderr, "[PASSENGER %d] Failed to open reply socket\n", g_info.pid);
+        ipc_detach_all();
+        exit(EXIT_FAILURE);
+    }
     
     /* Check if simulation is still running and station is open */
-    sem_lock(SEM_SHM_MUTEX);
-    int running = shm->simulation_running;
-    int station_open = shm->station_open;
-    sem_unlock(SEM_SHM_MUTEX);
+    int running = SHM_READ(shm->simulation_running);
+    int station_open = SHM_READ(shm->station_open);
     
     if (!running) {
         log_passenger(LOG_WARN, "PID %d: Simulation not running, exiting", g_info.pid);
@@ -432,24 +531,20 @@ int main(void) {
     }
     
 
-    sem_lock(SEM_SHM_MUTEX);
-    shm->total_passengers_created += g_info.seat_count;
-    shm->adults_created += 1;
+    stat_add(&shm->stats, STAT_CREATED, g_info.seat_count);
+    stat_add(&shm->stats, STAT_ADULTS, 1);
     if (g_info.has_child_with) {
-        shm->children_created += 1;
+        stat_add(&shm->stats, STAT_CHILDREN, 1);
     }
     if (g_info.is_vip) {
-        shm->vip_people_created += g_info.seat_count;
+        stat_add(&shm->stats, STAT_VIP_CREATED, g_info.seat_count);
     }
-    sem_unlock(SEM_SHM_MUTEX);
     
 
     if (!g_info.is_vip) {
         if (!purchase_ticket(shm)) {
-            sem_lock(SEM_SHM_MUTEX);
-            int running = shm->simulation_running;
-            shm->passengers_left_early += g_info.seat_count;
-            sem_unlock(SEM_SHM_MUTEX);
+            int running = SHM_READ(shm->simulation_running);
+            stat_add(&shm->stats, STAT_LEFT_EARLY, g_info.seat_count);
             if (running) {
                 log_passenger(LOG_ERROR, "PID %d: Could not obtain ticket, leaving", g_info.pid);
             }
@@ -466,14 +561,11 @@ int main(void) {
     }
     
     /* Check if station closed while buying ticket */
-    sem_lock(SEM_SHM_MUTEX);
-    int station_closed_now = shm->station_closed;
-    sem_unlock(SEM_SHM_MUTEX);
+    int station_closed_now = SHM_READ(shm->station_closed);
     
     if (station_closed_now) {
-        sem_lock(SEM_SHM_MUTEX);
-        shm->passengers_left_early += g_info.seat_count;
-        sem_unlock(SEM_SHM_MUTEX);
+        stat_add(&shm->stats, STAT_LEFT_EARLY, g_info.seat_count);
+        cancel_booking();
         wait_for_child_thread();
         ipc_detach_all();
         return 1;
@@ -489,13 +581,12 @@ int main(void) {
     }
     
     if (enter_attempts >= 10) {
-        sem_lock(SEM_SHM_MUTEX);
-        int running = shm->simulation_running;
-        shm->passengers_left_early += g_info.seat_count;
-        sem_unlock(SEM_SHM_MUTEX);
+        int running = SHM_READ(shm->simulation_running);
+        stat_add(&shm->stats, STAT_LEFT_EARLY, g_info.seat_count);
         if (running) {
             log_passenger(LOG_ERROR, "PID %d: Could not enter station, leaving", g_info.pid);
         }
+        cancel_booking();
         wait_for_child_thread();
         ipc_detach_all();
         return 1;
@@ -504,13 +595,14 @@ int main(void) {
 
     int boarded = 0;
     int board_attempts = 0;
+    long board_from_ms = now_ms();
     
-    while (!boarded && g_running) {
+    while (!boarded && g_running && !g_board_unknown) {
+        /* Taken before looking at the bays, so a bus arriving after this is not slept through */
+        uint32_t events = shm_board_events();
         /* Check if simulation is still running or boarding is blocked */
-        sem_lock(SEM_SHM_MUTEX);
-        running = shm->simulation_running;
-        int boarding_allowed = shm->boarding_allowed;
-        sem_unlock(SEM_SHM_MUTEX);
+        running = SHM_READ(shm->simulation_running);
+        int boarding_allowed = SHM_READ(shm->boarding_allowed);
         
         if (!running || !boarding_allowed) {
             if (running) {
@@ -519,7 +611,7 @@ int main(void) {
             break;
         }
         
-        int result = attempt_boarding(shm);
+        int result = attempt_boarding(shm, board_attempts);
         
         if (result == 1) {
             boarded = 1;
@@ -529,13 +621,16 @@ int main(void) {
             log_passenger(LOG_INFO, "PID %d: Waiting for next bus (attempt %d)",
                          g_info.pid, board_attempts);
             if (!log_is_perf_mode()) {
-                sleep(1);
+                /* Until a bay or bus changes (a bus arrives or opens), at most 1 s */
+                shm_board_wait(events, 1000);
             }
         }
     }
     
 
     if (boarded) {
+        wire_passenger_t wire = passenger_to_wire(&g_info);
+        wait_hist_add(&shm->board_wait[passenger_class(&wire)], now_ms() - board_from_ms);
         if (g_info.has_child_with) {
             log_passenger(LOG_INFO, "PID %d (Adult age=%d + Child age=%d): Journey complete on bus %d",
                          g_info.pid, g_info.age, g_info.child_age, g_info.assigned_bus);
@@ -543,15 +638,12 @@ int main(void) {
             log_passenger(LOG_INFO, "PID %d (Age=%d): Journey complete on bus %d",
                          g_info.pid, g_info.age, g_info.assigned_bus);
         }
-    } else {
-        sem_lock(SEM_SHM_MUTEX);
-        int running = shm->simulation_running;
-        shm->passengers_waiting -= g_info.seat_count;
-        if (shm->passengers_waiting < 0) {
-            shm->passengers_waiting = 0;
-        }
-        shm->passengers_left_early += g_info.seat_count;
-        sem_unlock(SEM_SHM_MUTEX);
+    } else if (!g_board_unknown) {
+        int running = SHM_READ(shm->simulation_running);
+        /* Count the destination first so a racing sum never loses us */
+        stat_add(&shm->stats, STAT_LEFT_EARLY, g_info.seat_count);
+        stat_add(&shm->stats, STAT_WAITING, -g_info.seat_count);
+        cancel_booking();
         if (running) {
             log_passenger(LOG_WARN, "PID %d: Could not board any bus, leaving station",
                          g_info.pid);
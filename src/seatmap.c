@@ -0,0 +1,84 @@
+#include "seatmap.h"
+
+#include <stdio.h>
+
+#define ROW_FIRST  0x5555555555555555ull  /* First place of every row in a word */
+
+/* Places past the end of the map in word w, kept taken so they are never given */
+static uint64_t padding(const seat_map_t *m, int w) {
+    int used = m->places - 64 * w;
+    return used >= 64 ? 0 : ~0ull << used;
+}
+
+/* Store word w and bring its summary bits up to date */
+static void set_word(seat_map_t *m, int w, uint64_t bits) {
+    uint64_t free = ~bits;
+    uint64_t bit = 1ull << w;
+    atomic_store_explicit(&m->bits[w], bits, memory_order_release);
+    m->any_free = free ? m->any_free | bit : m->any_free & ~bit;
+    m->row_free = (free & (free >> 1) & ROW_FIRST) ? m->row_free | bit : m->row_free & ~bit;
+    m->half_free = ((bits ^ (bits >> 1)) & ROW_FIRST) ? m->half_free | bit : m->half_free & ~bit;
+}
+
+void seatmap_init(seat_map_t *m, int places, bool rows) {
+    m->places = places;
+    m->rows = rows;
+    seatmap_clear(m);
+}
+
+void seatmap_clear(seat_map_t *m) {
+    m->any_free = m->row_free = m->half_free = 0;
+    for (int w = 0; w < SEATMAP_MAX_WORDS; w++) {
+        if (w < SEATMAP_WORDS(m->places)) {
+            set_word(m, w, padding(m, w));
+        } else {
+            atomic_store_explicit(&m->bits[w], ~0ull, memory_order_relaxed);
+        }
+    }
+}
+
+int seatmap_take(seat_map_t *m) {
+    uint64_t words = m->rows && m->half_free ? m->half_free : m->any_free;
+    if (words == 0) {
+        return -1;
+    }
+    int w = __builtin_ctzll(words);
+    uint64_t bits = atomic_load_explicit(&m->bits[w], memory_order_relaxed);
+    int place;
+    if (m->rows && (m->half_free & (1ull << w))) {
+        int row = __builtin_ctzll((bits ^ (bits >> 1)) & ROW_FIRST);
+        place = (bits >> row) & 1 ? row + 1 : row;
+    } else {
+        place = __builtin_ctzll(~bits);
+    }
+    set_word(m, w, bits | (1ull << place));
+    return 64 * w + place;
+}
+
+int seatmap_take_pair(seat_map_t *m) {
+    if (!m->rows || m->row_free == 0) {
+        return -1;
+    }
+    int w = __builtin_ctzll(m->row_free);
+    uint64_t bits = atomic_load_explicit(&m->bits[w], memory_order_relaxed);
+    uint64_t free = ~bits;
+    int row = __builtin_ctzll(free & (free >> 1) & ROW_FIRST);
+    set_word(m, w, bits | (3ull << row));
+    return 64 * w + row;
+}
+
+char *seatmap_format(const seat_map_t *m, char *buf, size_t len) {
+    size_t pos = 0;
+    if (len == 0) {
+        return buf;
+    }
+    for (int i = 0; i < m->places && pos + 2 < len; i++) {
+        uint64_t bits = atomic_load_explicit(&m->bits[i / 64], memory_order_acquire);
+        if (m->rows && i > 0 && i % 2 == 0) {
+            buf[pos++] = ' ';
+        }
+        buf[pos++] = (bits >> (i % 64)) & 1 ? 'X' : '.';
+    }
+    buf[pos] = '\0';
+    return buf;
+}
@@ -0,0 +1,125 @@
+#include "shm_ring.h"
+#include "futex_lock.h"
+
+#include <string.h>
+#include <errno.h>
+
+#define RING_MASK (SHM_RING_SLOTS - 1)
+
+_Static_assert((SHM_RING_SLOTS & RING_MASK) == 0, "SHM_RING_SLOTS must be a power of two");
+
+void shm_ring_init(shm_ring_t *ring) {
+    memset(ring, 0, sizeof(*ring));
+    for (uint32_t i = 0; i < SHM_RING_SLOTS; i++) {
+        atomic_store_explicit(&ring->slots[i].seq, i, memory_order_relaxed);
+    }
+}
+
+static void notify(_Atomic uint32_t *ec, _Atomic uint32_t *waiters) {
+    atomic_fetch_add(ec, 1);
+    if (atomic_load(waiters) > 0) {
+        futex_wake(ec, 1);
+    }
+}
+
+int shm_ring_try_enqueue(shm_ring_t *ring, const void *data, size_t len) {
+    if (len > SHM_RING_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    shm_ring_slot_t *slot;
+    uint32_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (1) {
+        slot = &ring->slots[pos & RING_MASK];
+        uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            errno = EAGAIN;
+            return -1;  /* Slot still holds an unconsumed lap: full */
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->data, data, len);
+    slot->len = (uint32_t)len;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    notify(&ring->items_ec, &ring->items_waiters);
+    return 0;
+}
+
+int shm_ring_try_dequeue(shm_ring_t *ring, void *data, size_t len) {
+    shm_ring_slot_t *slot;
+    uint32_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (1) {
+        slot = &ring->slots[pos & RING_MASK];
+        uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            errno = EAGAIN;
+            return -1;  /* Producer has not published this position yet: empty */
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    size_t n = slot->len < len ? slot->len : len;
+    memcpy(data, slot->data, n);
+    atomic_store_explicit(&slot->seq, pos + SHM_RING_SLOTS, memory_order_release);
+
+    notify(&ring->space_ec, &ring->space_waiters);
+    return 0;
+}
+
+/* Readiness is checked after registering as a waiter and sampling the
+ * eventcount, so a notify between the check and FUTEX_WAIT is never lost. */
+static int ring_has_items(shm_ring_t *ring) {
+    uint32_t pos = atomic_load(&ring->head);
+    return atomic_load(&ring->slots[pos & RING_MASK].seq) == pos + 1;
+}
+
+static int ring_has_space(shm_ring_t *ring) {
+    uint32_t pos = atomic_load(&ring->tail);
+    return atomic_load(&ring->slots[pos & RING_MASK].seq) == pos;
+}
+
+static int ring_wait(_Atomic uint32_t *ec, _Atomic uint32_t *waiters,
+                     shm_ring_t *ring, int (*ready)(shm_ring_t *),
+                     const struct timespec *timeout) {
+    uint32_t ticket = atomic_load(ec);
+    atomic_fetch_add(waiters, 1);
+    int ret = 0;
+    if (!ready(ring)) {
+        if (futex_wait(ec, ticket, timeout) == -1 && errno != EAGAIN) {
+            ret = -1;
+        }
+    }
+    atomic_fetch_sub(waiters, 1);
+    return ret;
+}
+
+int shm_ring_wait_items(shm_ring_t *ring, const struct timespec *timeout) {
+    return ring_wait(&ring->items_ec, &ring->items_waiters, ring, ring_has_items, timeout);
+}
+
+int shm_ring_wait_space(shm_ring_t *ring, const struct timespec *timeout) {
+    return ring_wait(&ring->space_ec, &ring->space_waiters, ring, ring_has_space, timeout);
+}
+
+int shm_ring_depth(shm_ring_t *ring) {
+    uint32_t head = atomic_load(&ring->head);
+    uint32_t tail = atomic_load(&ring->tail);
+    return (int)(tail - head);
+}
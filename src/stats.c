@@ -0,0 +1,91 @@
+#define _GNU_SOURCE
+#include "stats.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+void stat_reset(stat_counters_t *stats) {
+    for (int s = 0; s < STAT_SHARDS; s++) {
+        for (int c = 0; c < STAT_COUNT; c++) {
+            atomic_store_explicit(&stats->shards[s].value[c], 0, memory_order_relaxed);
+        }
+    }
+}
+
+/* Shard of the CPU we run on (vDSO call); PID if the kernel can't tell */
+static int shard_index(void) {
+    int cpu = sched_getcpu();
+    if (cpu < 0) {
+        cpu = (int)getpid();
+    }
+    return cpu % STAT_SHARDS;
+}
+
+void stat_add(stat_counters_t *stats, int counter, int delta) {
+    atomic_fetch_add_explicit(&stats->shards[shard_index()].value[counter], delta, memory_order_relaxed);
+}
+
+int stat_sum(stat_counters_t *stats, int counter) {
+    int total = 0;
+    for (int s = 0; s < STAT_SHARDS; s++) {
+        total += atomic_load_explicit(&stats->shards[s].value[counter], memory_order_relaxed);
+    }
+    return total;
+}
+
+static int wait_bucket(long ms) {
+    if (ms < WAIT_SUB_BUCKETS) {
+        return ms < 0 ? 0 : (int)ms;
+    }
+    int octave = 63 - __builtin_clzl((unsigned long)ms);  /* >= log2(WAIT_SUB_BUCKETS) */
+    int shift = octave - __builtin_ctz(WAIT_SUB_BUCKETS);
+    int bucket = WAIT_SUB_BUCKETS * (shift + 1) + (int)((ms >> shift) - WAIT_SUB_BUCKETS);
+    return bucket < WAIT_BUCKETS ? bucket : WAIT_BUCKETS - 1;
+}
+
+/* Largest wait that falls in `bucket` */
+static long wait_bucket_high(int bucket) {
+    if (bucket < WAIT_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / WAIT_SUB_BUCKETS - 1;
+    long low = (long)(WAIT_SUB_BUCKETS + bucket % WAIT_SUB_BUCKETS) << shift;
+    return low + (1L << shift) - 1;
+}
+
+void wait_hist_add(wait_hist_t *hist, long ms) {
+    atomic_fetch_add_explicit(&hist->count[wait_bucket(ms)], 1, memory_order_relaxed);
+    long max = atomic_load_explicit(&hist->max_ms, memory_order_relaxed);
+    while (ms > max && !atomic_compare_exchange_weak(&hist->max_ms, &max, ms)) {
+    }
+}
+
+int wait_hist_count(wait_hist_t *hist) {
+    int total = 0;
+    for (int b = 0; b < WAIT_BUCKETS; b++) {
+        total += atomic_load_explicit(&hist->count[b], memory_order_relaxed);
+    }
+    return total;
+}
+
+long wait_hist_percentile(wait_hist_t *hist, int pct) {
+    int total = wait_hist_count(hist);
+    if (total == 0) {
+        return 0;
+    }
+    /* Rank of the percentile, rounded up: p100 is the last wait */
+    long rank = ((long)total * pct + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
+    }
+    long seen = 0;
+    for (int b = 0; b < WAIT_BUCKETS; b++) {
+        seen += atomic_load_explicit(&hist->count[b], memory_order_relaxed);
+        if (seen >= rank) {
+            long high = wait_bucket_high(b);
+            long max = atomic_load_explicit(&hist->max_ms, memory_order_relaxed);
+            return high < max ? high : max;
+        }
+    }
+    return atomic_load_explicit(&hist->max_ms, memory_order_relaxed);
+}
@@ -40,7 +40,7 @@ static void setup_signals(void) {
 
 
 
-static int validate_passenger(const passenger_info_t *passenger) {
+static int validate_passenger(const wire_passenger_t *passenger) {
     /* Validate age */
     if (passenger->age < MIN_AGE || passenger->age > MAX_AGE) {
         return 0;
@@ -56,8 +56,8 @@ static int validate_passenger(const passenger_info_t *passenger) {
 
 /* Safeguard: validate ticket request message */
 static int validate_ticket_request(const ticket_msg_t *request) {
-    /* Check mtype is valid ticket request */
-    if (request->mtype != MSG_TICKET_REQUEST) {
+    /* Check mtype is the ticket request type of the passenger's class */
+    if (request->mtype != ticket_request_type(passenger_class(&request->passenger))) {
         log_ticket_office(LOG_ERROR, "Office %d: Invalid message type %ld", 
                          g_office_id, request->mtype);
         return 0;
@@ -73,23 +73,24 @@ static int validate_ticket_request(const ticket_msg_t *request) {
     return 1;
 }
 
-static void process_ticket_request(shm_data_t *shm, ticket_msg_t *request) {
-    ticket_msg_t response;
-    memset(&response, 0, sizeof(response));
+/* Fills in the reply; the caller sends a whole batch of them at once */
+static void process_ticket_request(shm_data_t *shm, const ticket_msg_t *request,
+                                   ticket_msg_t *response) {
+    memset(response, 0, sizeof(*response));
     
     /* Set response mtype to passenger's PID for targeted delivery */
-    response.mtype = request->passenger.pid;
-    response.passenger = request->passenger;
-    response.ticket_office_id = g_office_id;
+    response->mtype = request->passenger.pid;
+    response->reply_slot = request->reply_slot;
+    response->request_id = request->request_id;
+    response->passenger = request->passenger;
+    response->ticket_office_id = (uint8_t)g_office_id;
+    response->bus_id = -1;
     
     /* Validate passenger data */
     if (!validate_passenger(&request->passenger)) {
-        response.approved = false;
-        /* Ticket denied still must clear 'in_office' counter */
-        sem_lock(SEM_SHM_MUTEX);
-        shm->tickets_denied++;
-        shm->passengers_in_office--;
-        sem_unlock(SEM_SHM_MUTEX);
+        response->approved = false;
+        /* The passenger clears its own 'in_office' count when the reply arrives */
+        atomic_fetch_add_explicit(&shm->offices[g_office_id].tickets_denied, 1, memory_order_relaxed);
         log_ticket_office(LOG_WARN, "Office %d: Invalid passenger data from PID %d",
                          g_office_id, request->passenger.pid);
     } else {
@@ -98,18 +99,17 @@ static void process_ticket_request(shm_data_t *shm, ticket_msg_t *request) {
         }
         
         /* Issue the ticket */
-        response.approved = true;
-        response.passenger.has_ticket = true;
+        response->approved = true;
+        response->passenger.flags |= PASSENGER_TICKET;
         
 
-        sem_lock(SEM_SHM_MUTEX);
-        shm->tickets_issued++;
-        shm->tickets_sold_people += request->passenger.seat_count > 0 ? request->passenger.seat_count : 1;
-        shm->passengers_in_office--;
-        sem_unlock(SEM_SHM_MUTEX);
+        office_state_t *office = &shm->offices[g_office_id];
+        int seats = request->passenger.seat_count > 0 ? request->passenger.seat_count : 1;
+        atomic_fetch_add_explicit(&office->tickets_issued, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&office->tickets_sold_people, seats, memory_order_relaxed);
         
         /* Log ticket issuance with child info if applicable */
-        if (request->passenger.has_child_with) {
+        if (request->passenger.flags & PASSENGER_CHILD_WITH) {
             log_ticket_office(LOG_INFO, 
                              "Office %d: Ticket issued to adult PID %d (Age=%d) WITH CHILD (Age=%d) - %d seats",
                              g_office_id,
@@ -123,22 +123,27 @@ static void process_ticket_request(shm_data_t *shm, ticket_msg_t *request) {
                              g_office_id,
                              request->passenger.pid,
                              request->passenger.age,
-                             request->passenger.has_bike ? "YES" : "NO");
+                             (request->passenger.flags & PASSENGER_BIKE) ? "YES" : "NO");
+        }
+        
+        /* --assign: the ticket comes with a seat on the next bus that has one */
+        if (shm->assign_seats) {
+            response->bus_id = (int8_t)shm_book_seat(&request->passenger);
+            if (response->bus_id >= 0) {
+                log_ticket_office(LOG_INFO, "Office %d: PID %d booked on bus %d",
+                                 g_office_id, request->passenger.pid, response->bus_id);
+            } else {
+                log_ticket_office(LOG_INFO, "Office %d: Every bus booked out, PID %d books at the station",
+                                 g_office_id, request->passenger.pid);
+            }
         }
-    }
-    
-    /* Send response back to passenger */
-    if (msg_send_ticket_resp(&response) == -1) {
-        log_ticket_office(LOG_ERROR, "Office %d: Failed to send ticket response to PID %d",
-                         g_office_id, request->passenger.pid);
     }
 }
 
 static int check_shutdown(shm_data_t *shm) {
-    sem_lock(SEM_SHM_MUTEX);
-    int running = shm->simulation_running;
-    int station_closed = shm->station_closed;
-    sem_unlock(SEM_SHM_MUTEX);
+    /* Polled once per request: read the station flags without the station lock */
+    int running = SHM_READ(shm->simulation_running);
+    int station_closed = SHM_READ(shm->station_closed);
     
     return !running || station_closed;
 }
@@ -148,21 +153,23 @@ static int check_shutdown(shm_data_t *shm) {
 static void drain_queue_on_close(shm_data_t *shm) {
     ticket_msg_t request;
     ssize_t ret;
-    while ((ret = msg_recv_ticket(&request, MSG_TICKET_REQUEST, IPC_NOWAIT)) > 0) {
+    while ((ret = msg_recv_ticket(&request, 0, IPC_NOWAIT)) > 0) {
         /* Slot was held by passenger; we consumed the message */
-        sem_unlock(SEM_TICKET_QUEUE_SLOTS);
+        if (ipc_queue_slots_enabled(SEM_TICKET_QUEUE_SLOTS)) {
+            sem_unlock(SEM_TICKET_QUEUE_SLOTS);
+        }
         
         ticket_msg_t response;
         memset(&response, 0, sizeof(response));
         response.mtype = request.passenger.pid;
+        response.reply_slot = request.reply_slot;
+        response.request_id = request.request_id;
         response.passenger = request.passenger;
-        response.ticket_office_id = g_office_id;
+        response.ticket_office_id = (uint8_t)g_office_id;
+        response.bus_id = -1;
         response.approved = false;  /* Station closed - no ticket, passenger must leave */
         
-        sem_lock(SEM_SHM_MUTEX);
-        shm->passengers_in_office--;
-        shm->tickets_denied++;
-        sem_unlock(SEM_SHM_MUTEX);
+        atomic_fetch_add_explicit(&shm->offices[g_office_id].tickets_denied, 1, memory_order_relaxed);
         
         if (msg_send_ticket_resp(&response) == -1) {
             log_ticket_office(LOG_WARN, "Office %d: Failed to send close response to PID %d",
@@ -176,6 +183,13 @@ static void drain_queue_on_close(shm_data_t *shm) {
 
 
 
+static void send_responses(ticket_msg_t *responses, int count) {
+    if (count > 0 && msg_send_ticket_resp_batch(responses, count) == -1) {
+        log_ticket_office(LOG_ERROR, "Office %d: Failed to send %d ticket response(s)",
+                         g_office_id, count);
+    }
+}
+
 int main(int argc, char *argv[]) {
     /* Parse office ID from command line argument */
     if (argc > 1) {
@@ -206,6 +220,7 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "[TICKET_OFFICE %d] Failed to get shared memory\n", g_office_id);
         exit(EXIT_FAILURE);
     }
+    ipc_mem_init(MEM_ROLE_OFFICE);
     
 
     sem_lock(SEM_SHM_MUTEX);
@@ -222,6 +237,13 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     
+    /* Socket transport: passengers send their requests to this office's socket */
+    if (ipc_endpoint_open(IPC_ENDPOINT_OFFICE, g_office_id) == -1) {
+        fprintf(stderr, "[TICKET_OFFICE %d] Failed to open request socket\n", g_office_id);
+        ipc_detach_all();
+        exit(EXIT_FAILURE);
+    }
+    
     /* Select the appropriate semaphore for this office */
     int office_sem = SEM_TICKET_OFFICE(g_office_id);
     
@@ -235,10 +257,12 @@ int main(int argc, char *argv[]) {
         }
         
 
-        ticket_msg_t request;
-        ssize_t ret = msg_recv_ticket(&request, MSG_TICKET_REQUEST, 0);
+        /* One request, or with the socket transport everything queued up to SOCK_BATCH */
+        ticket_msg_t requests[SOCK_BATCH];
+        ticket_msg_t responses[SOCK_BATCH];
+        int received = msg_recv_ticket_batch(requests, SOCK_BATCH, 0, 0);
         
-        if (ret == -1) {
+        if (received == -1) {
             if (errno == EINTR) {
                 /* Interrupted by signal - check if we should continue */
                 continue;
@@ -250,36 +274,53 @@ int main(int argc, char *argv[]) {
             /* Other error - continue */
             continue;
         }
-
-        /* A request has been removed from the ticket queue */
-        sem_unlock(SEM_TICKET_QUEUE_SLOTS);
         
-        /* Validate message before processing */
-        if (!validate_ticket_request(&request)) {
-            log_ticket_office(LOG_WARN, "Office %d: Discarding invalid ticket request", g_office_id);
-            continue;
+        int replies = 0;
+        for (int i = 0; i < received; i++) {
+            ticket_msg_t *request = &requests[i];
+            
+            /* A request has been removed from the ticket queue */
+            if (ipc_queue_slots_enabled(SEM_TICKET_QUEUE_SLOTS)) {
+                sem_unlock(SEM_TICKET_QUEUE_SLOTS);
+            }
+            
+            /* Validate message before processing */
+            if (!validate_ticket_request(request)) {
+                log_ticket_office(LOG_WARN, "Office %d: Discarding invalid ticket request", g_office_id);
+                continue;
+            }
+            
+            /* Got a ticket request */
+            log_ticket_office(LOG_INFO, "Office %d: Processing request from passenger PID %d",
+                             g_office_id, request->passenger.pid);
+            
+            /* Mark office as busy */
+            sem_lock(SEM_OFFICE_MUTEX(g_office_id));
+            shm->offices[g_office_id].busy_pid = request->passenger.pid;
+            sem_unlock(SEM_OFFICE_MUTEX(g_office_id));
+            
+            sem_lock(office_sem);
+            
+            process_ticket_request(shm, request, &responses[replies++]);
+            
+            sem_unlock(office_sem);
+            
+            /* Mark office as free */
+            sem_lock(SEM_OFFICE_MUTEX(g_office_id));
+            shm->offices[g_office_id].busy_pid = 0;
+            sem_unlock(SEM_OFFICE_MUTEX(g_office_id));
+            
+            /* Outside --perf every request takes TICKET_PROCESS_TIME: answer
+             * it now, not after the rest of the batch has been served */
+            if (!log_is_perf_mode()) {
+                send_responses(responses, replies);
+                replies = 0;
+            }
         }
         
-        /* Got a ticket request */
-        log_ticket_office(LOG_INFO, "Office %d: Processing request from passenger PID %d",
-                         g_office_id, request.passenger.pid);
-        
-        /* Mark office as busy */
-        sem_lock(SEM_SHM_MUTEX);
-        shm->ticket_office_busy[g_office_id] = request.passenger.pid;
-        sem_unlock(SEM_SHM_MUTEX);
-        
-
-        sem_lock(office_sem);
-        
-        process_ticket_request(shm, &request);
-        
-        sem_unlock(office_sem);
-        
-        /* Mark office as free */
-        sem_lock(SEM_SHM_MUTEX);
-        shm->ticket_office_busy[g_office_id] = 0;
-        sem_unlock(SEM_SHM_MUTEX);
+        /* Send responses back to passengers, in one sendmmsg() with sockets */
+        send_responses(responses, replies);
+        ipc_mem_tick();
     }
     
     /* Cleanup */